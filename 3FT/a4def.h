@@ -10,7 +10,7 @@
 enum { SUCCESS,
        INITIALIZATION_ERROR, PARENT_CHILD_ERROR , ALREADY_IN_TREE,
        NO_SUCH_PATH, CONFLICTING_PATH, NOT_A_DIRECTORY, NOT_A_FILE,
-       MEMORY_ERROR
+       MEMORY_ERROR, QUOTA_EXCEEDED, IO_ERROR
 };
 
 /* In lieu of a proper boolean datatype */
@@ -23,4 +23,27 @@ enum type { DIRECTORY, FT_FILE };
 /* Declaration of nodeType datatype */
 typedef enum type nodeType;
 
+/* Bytes of memory held by the nodes of a File Tree, by category. */
+struct MemoryUsage {
+   /* the node structures themselves */
+   size_t nodeBytes;
+   /* the names stored in the nodes, one path component each */
+   size_t pathBytes;
+   /* the child pointers currently in use in directories' child
+      arrays (their logical length) */
+   size_t childLogicalBytes;
+   /* the child arrays as allocated, including each array's header
+      and unused capacity (their physical length) */
+   size_t childPhysicalBytes;
+   /* the arrays in which file nodes keep their contents references
+      (the contents themselves belong to the client) */
+   size_t fileBytes;
+   /* the contents copied into the tree's own storage, each copy
+      counted once however many files (or views) share it */
+   size_t storedBytes;
+   /* the number of nodes, and how many of them are files */
+   size_t numNodes;
+   size_t numFiles;
+};
+
 #endif
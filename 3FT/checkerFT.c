@@ -12,10 +12,7 @@
 
 /* see checkerFT.h for specification */
 boolean CheckerFT_Node_isValid(Node_T n) {
-   Node_T parent;
-   const char* npath;
-   const char* ppath;
-   const char* rest;
+   const char* name;
    size_t i;
    size_t num_children;
 
@@ -52,57 +49,39 @@ boolean CheckerFT_Node_isValid(Node_T n) {
 
 
 
-   parent = Node_getParent(n);
-   if(parent != NULL) {
-      npath = Node_getPath(n);
+   /********** NAME CHECKS ****************/
 
-      /********** PATH CHECKS ****************/
-
-      /* Sample check that parent's path must be prefix of n's path */
-      ppath = Node_getPath(parent);
-      /* Checks that parent's path is not null. */
-      if(ppath == NULL) {
-         fprintf(stderr, "P has NULL path\n");
-         return FALSE;
-      }
-      i = strlen(ppath);
-      if(strncmp(npath, ppath, i)) {
-         fprintf(stderr, "P's path is not a prefix of C's path\n");
-         return FALSE;
-      }
-      /* Sample check that n's path after parent's path + '/'
-         must have no further '/' characters */
-      rest = npath + i;
-      rest++;
-      if(strstr(rest, "/") != NULL) {
-         fprintf(stderr, "C's path has grandchild of P's path\n");
-         return FALSE;
-      }
+   /* Check that n's name is a single, non-empty path component */
+   name = Node_getName(n);
+   if(name == NULL || *name == '\0') {
+      fprintf(stderr, "Node has an empty name\n");
+      return FALSE;
+   }
+   if(strchr(name, '/') != NULL) {
+      fprintf(stderr, "Node's name has more than one component\n");
+      return FALSE;
+   }
 
-      /********** CHILD CHECKS ****************/
-
-      /* Check that children nodes of dir node are in sorted order */
-      /* if file node, num_children = 1 so will skip this loop */
-      num_children = Node_getNumChildren(parent);
-      if (num_children > 1){
-         for (i = 0; i < num_children - 1; i++){
-            /* check that the children are not null */
-            if (Node_getChild(parent, i) == NULL){
-               fprintf(stderr, "P has a NULL child node\n");
-               return FALSE;
-            }
-            if (Node_getChild(parent, i + 1) == NULL){
-               fprintf(stderr, "P has a NULL child node!\n");
-               return FALSE;
-            }
-
-            if (Node_compare(Node_getChild(parent, i), Node_getChild(parent, i+1)) >= 0){
-               fprintf(stderr, "P's children are not in sorted order\n");
-               return FALSE;
-            }
+   /********** CHILD CHECKS ****************/
+
+   /* Check that children nodes of dir node are in sorted order. The
+      check is made on n's own children rather than its parent's,
+      since a node shared by several directories records only one of
+      them as its parent. */
+   if (Node_getType(n) == DIRECTORY) {
+      num_children = Node_getNumChildren(n);
+      for (i = 0; i < num_children; i++){
+         /* check that the children are not null */
+         if (Node_getChild(n, i) == NULL){
+            fprintf(stderr, "P has a NULL child node\n");
+            return FALSE;
+         }
+         if (i > 0 && Node_compare(Node_getChild(n, i - 1),
+                                   Node_getChild(n, i)) >= 0){
+            fprintf(stderr, "P's children are not in sorted order\n");
+            return FALSE;
          }
       }
-
    }
    return TRUE;
 }
@@ -118,6 +97,8 @@ boolean CheckerFT_Node_isValid(Node_T n) {
 */
 static boolean CheckerFT_treeCheck(Node_T n) {
    size_t c;
+   size_t numNodes;
+   size_t totalLength;
 
    if(n != NULL) {
 
@@ -126,6 +107,26 @@ static boolean CheckerFT_treeCheck(Node_T n) {
       if(!CheckerFT_Node_isValid(n))
          return FALSE;
 
+      /* Check that n's maintained subtree size and file length total
+         count n and each of its children's subtrees */
+      numNodes = 1;
+      totalLength = 0;
+      if(Node_getType(n) == DIRECTORY)
+         for(c = 0; c < Node_getNumChildren(n); c++) {
+            numNodes += Node_getNumNodes(Node_getChild(n, c));
+            totalLength += Node_getTotalLength(Node_getChild(n, c));
+         }
+      else
+         totalLength = Node_getLength(n);
+      if(Node_getNumNodes(n) != numNodes) {
+         fprintf(stderr, "Node's subtree size is not maintained\n");
+         return FALSE;
+      }
+      if(Node_getTotalLength(n) != totalLength) {
+         fprintf(stderr, "Node's total file length is not maintained\n");
+         return FALSE;
+      }
+
 
       for(c = 0; c < Node_getNumChildren(n); c++)
       {
@@ -177,6 +178,11 @@ boolean CheckerFT_isValid(boolean isInit, Node_T root, size_t count) {
             fprintf(stderr, "Root has parent node\n");
             return FALSE;
          }  
+         /* check that count agrees with the root's subtree size */
+         if (Node_getNumNodes(root) != count){
+            fprintf(stderr, "Count does not match the tree's size\n");
+            return FALSE;
+         }
       }
    }
 
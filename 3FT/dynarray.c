@@ -13,6 +13,11 @@
 
 static const size_t MIN_PHYS_LENGTH = 2;
 
+/* The factor by which a full DynArray object's physical length
+   grows. */
+
+static const size_t GROWTH_FACTOR = 2;
+
 /*--------------------------------------------------------------------*/
 
 /* A DynArray consists of an array, along with its logical and
@@ -56,8 +61,6 @@ static int DynArray_isValid(DynArray_T oDynArray)
 
 static int DynArray_grow(DynArray_T oDynArray)
 {
-   const size_t GROWTH_FACTOR = 2;
-
    size_t uNewLength;
    const void **ppvNewArray;
 
@@ -125,6 +128,51 @@ size_t DynArray_getLength(DynArray_T oDynArray)
 
 /*--------------------------------------------------------------------*/
 
+size_t DynArray_getFootprint(DynArray_T oDynArray)
+{
+   assert(oDynArray != NULL);
+   assert(DynArray_isValid(oDynArray));
+
+   return sizeof(struct DynArray)
+      + oDynArray->uPhysLength * sizeof(void*);
+}
+
+/*--------------------------------------------------------------------*/
+
+size_t DynArray_getNewFootprint(size_t uLength)
+{
+   if (uLength < MIN_PHYS_LENGTH)
+      uLength = MIN_PHYS_LENGTH;
+
+   return sizeof(struct DynArray) + uLength * sizeof(void*);
+}
+
+/*--------------------------------------------------------------------*/
+
+size_t DynArray_getGrownFootprint(size_t uLength)
+{
+   size_t uPhysLength = MIN_PHYS_LENGTH;
+
+   while (uPhysLength < uLength)
+      uPhysLength *= GROWTH_FACTOR;
+
+   return sizeof(struct DynArray) + uPhysLength * sizeof(void*);
+}
+
+/*--------------------------------------------------------------------*/
+
+size_t DynArray_getAddCost(DynArray_T oDynArray)
+{
+   assert(oDynArray != NULL);
+   assert(DynArray_isValid(oDynArray));
+
+   if (oDynArray->uLength < oDynArray->uPhysLength)
+      return 0;
+   return (GROWTH_FACTOR - 1) * oDynArray->uPhysLength * sizeof(void*);
+}
+
+/*--------------------------------------------------------------------*/
+
 void *DynArray_get(DynArray_T oDynArray, size_t uIndex)
 {
    assert(oDynArray != NULL);
@@ -34,6 +34,33 @@ size_t DynArray_getLength(DynArray_T oDynArray);
 
 /*--------------------------------------------------------------------*/
 
+/* Return the number of bytes of memory held by oDynArray: its own
+   structure plus its underlying array at its physical length. */
+
+size_t DynArray_getFootprint(DynArray_T oDynArray);
+
+/*--------------------------------------------------------------------*/
+
+/* Return the footprint that DynArray_new(uLength) would have. */
+
+size_t DynArray_getNewFootprint(size_t uLength);
+
+/*--------------------------------------------------------------------*/
+
+/* Return the footprint that DynArray_new(0) would have once uLength
+   elements had been added to it one at a time. */
+
+size_t DynArray_getGrownFootprint(size_t uLength);
+
+/*--------------------------------------------------------------------*/
+
+/* Return the number of bytes by which adding one element to oDynArray
+   would grow its footprint: 0 if it has unused physical capacity. */
+
+size_t DynArray_getAddCost(DynArray_T oDynArray);
+
+/*--------------------------------------------------------------------*/
+
 /* Return the uIndex'th element of oDynArray. */
 
 void *DynArray_get(DynArray_T oDynArray, size_t uIndex);
@@ -3,11 +3,25 @@
 /* Authors: Michael Garcia and Ellen Su                               */
 /*--------------------------------------------------------------------*/
 
+#define _POSIX_C_SOURCE 200809L
+/* for getdents64 and the d_type values of <dirent.h> */
+#define _DEFAULT_SOURCE
+
 #include <assert.h>
 #include <string.h>
 #include <stdio.h>
 #include <stddef.h>
 #include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <dirent.h>
 
 #include "a4def.h"
 #include "dynarray.h"
@@ -27,80 +41,214 @@ static boolean isInitialized;
 static Node_T root;
 /* a counter of the number of nodes in the hierarchy */
 static size_t count;
+/* the most bytes the hierarchy's nodes may hold, or 0 for no limit */
+static size_t memoryBudget;
+/* the size above which removed subtrees are freed in parallel, or 0
+   to always free them on the calling thread, and the number of
+   threads that free them */
+static size_t destroyThreshold;
+static size_t destroyThreads;
+/* TRUE if FT_rmDir hands removed subtrees to the reclaimer thread */
+static boolean asyncReclaim;
+/* TRUE if the calls that insert files or replace their contents copy
+   contents into the content store, or into copies the tree owns, and
+   the stored contents FT_replaceFileContents last returned, whose
+   reference is kept until the next one, or NULL */
+static boolean contentStore;
+static boolean ownedContents;
+static void *replacedContents;
+/* TRUE between FT_begin and FT_commit or FT_abort, with the root and
+   count to restore if the transaction is rolled back, and the status
+   of the first call in it that failed, or SUCCESS */
+static boolean inTransaction;
+static Node_T txRoot;
+static size_t txCount;
+static int txStatus;
+/* the blocks FT_load allocated for the contents of the files it
+   loaded, which the hierarchy owns until FT_destroy, or NULL */
+static DynArray_T loadedContents;
+
+/* Validates the whole hierarchy, as every FT function does on entry
+   and exit, except during a transaction, which FT_commit validates
+   once for all of its calls. */
+#define FT_CHECK() \
+    assert(inTransaction || CheckerFT_isValid(isInitialized, root, count))
+
+static boolean FT_doContainsDir(char *path);
+static boolean FT_doContainsFile(char *path);
+static size_t FT_destroySubtree(Node_T n);
+static boolean FT_reclaimLater(Node_T n);
+static void FT_foldReclaimed(void);
+static void FT_stopReclaimer(void);
+
+/* The kinds of change that FT_walNote logs. */
+enum { FT_WAL_INSERTDIR, FT_WAL_INSERTFILE, FT_WAL_RMDIR, FT_WAL_RMFILE,
+       FT_WAL_REPLACE, FT_WAL_SETQUOTA, FT_WAL_MOVE, FT_WAL_COPY };
+
+static void FT_walNote(int status, int kind, const char *path,
+                       const char *otherPath, const void *contents,
+                       size_t length, size_t maxNodes,
+                       size_t maxLength);
+static void FT_walEndTransaction(boolean keep);
+static int FT_doCloseLog(void);
+
+/*--------------------------------------------------------------------*/
+/* Instrumentation                                                    */
+/*--------------------------------------------------------------------*/
 
-/* 
-    Returns directory node at the farthest end of the input path and
-    curr Node, or NULL if no node exists at this path. 
+/*
+   When ft.c is compiled with FT_STATS defined, every public FT call
+   records its latency, returned status, and the number of nodes its
+   path walks visited. Otherwise the FT_STATS_* macros expand to
+   nothing and FT_getStats reports all zeros.
 */
-static Node_T FT_getEndOfPathNode(char *path, Node_T curr) {
-    Node_T found;
-    size_t i;
+#ifdef FT_STATS
 
-    assert(path != NULL);
+/* the counters and histograms reported by FT_getStats */
+static struct FT_Stats stats;
+/* the time at which the current public call started */
+static struct timespec statsStart;
+/* the number of nodes visited so far by the current public call, on
+   the calling thread (FT_build's workers count their own) */
+static __thread unsigned long statsVisits;
 
-    /* If root is NULL, then return NULL. */
-    if (curr == NULL){
-        return NULL;
-    }
+/*
+   Returns the histogram bucket for value v in a histogram of
+   numBuckets buckets: 0 for v == 0, otherwise 1 + floor(log2(v)),
+   with the last bucket absorbing every larger value.
+*/
+static size_t FT_statsBucket(unsigned long v, size_t numBuckets) {
+    size_t bucket = 0;
 
-    /* If query path and path to current node are equivalent (and the current
-    node is a directory), return the currrent node. If they match and
-    are not a directory, return NULL. */
-    if(!strcmp(path,Node_getPath(curr))) { 
-        if (Node_getType(curr) == DIRECTORY) {
-            return curr;
-        }
-        else {
-            return NULL;
-        }
-    }
-    /* Otherwise, if the current path to the node matches the query path to
-    that point, examine the current node's children to see if the query path exists there. */
-    else if(!strncmp(path, Node_getPath(curr), strlen(Node_getPath(curr)))) {
-        for(i = 0; i < Node_getNumChildren(curr); i++) {
-            found = FT_getEndOfPathNode(path,
-                                    Node_getChild(curr, i));
-            if(found != NULL)
-                return found;
-        }
-        if (Node_getType(curr) == DIRECTORY){
-            return curr;
-        }
+    while (v != 0 && bucket < numBuckets - 1) {
+        v >>= 1;
+        bucket++;
     }
-    return NULL;
+    return bucket;
+}
+
+/* Begins measuring a public call. */
+static void FT_statsStart(void) {
+    statsVisits = 0;
+    (void) clock_gettime(CLOCK_MONOTONIC, &statsStart);
+}
+
+/*
+   Finishes measuring the public call op, which returned status
+   (or -1 if op does not return a status code).
+*/
+static void FT_statsStop(int op, int status) {
+    struct timespec end;
+    unsigned long ns;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &end);
+    ns = (unsigned long)(end.tv_sec - statsStart.tv_sec) * 1000000000UL
+        + (unsigned long)end.tv_nsec - (unsigned long)statsStart.tv_nsec;
+
+    stats.calls[op]++;
+    if (status >= 0 && status < FT_NUM_STATUSES)
+        stats.statuses[op][status]++;
+    stats.latency[op][FT_statsBucket(ns, FT_LATENCY_BUCKETS)]++;
+    stats.visits[op][FT_statsBucket(statsVisits, FT_VISIT_BUCKETS)]++;
+}
+
+#define FT_STATS_START() FT_statsStart()
+#define FT_STATS_VISIT() (statsVisits++)
+#define FT_STATS_STOP(op, status) FT_statsStop((op), (status))
+
+#else
+
+#define FT_STATS_START() ((void) 0)
+#define FT_STATS_VISIT() ((void) 0)
+#define FT_STATS_STOP(op, status) ((void) 0)
+
+#endif
+
+/*--------------------------------------------------------------------*/
+
+/*
+    Records status, the result of a call that changes the hierarchy,
+    as the transaction's failure if a transaction is in progress and
+    no earlier call in it has failed.
+*/
+static void FT_txNote(int status) {
+    if(inTransaction && txStatus == SUCCESS)
+        txStatus = status;
 }
 
-/* 
-    Returns file node at given path, or NULL if it does not exist. 
+/*
+    Walks path from top, the root of the hierarchy or of a snapshot of
+    it, one component at a time, binary searching each directory's
+    children by name, and returns the node at path, or NULL if there
+    is none. If pDeepest is not NULL, *pDeepest is set
+    to the last node found along path -- NULL if even the root does not
+    match path's first component -- and if pRest is not NULL, *pRest
+    is set to the part of path beneath that node (all of path if
+    *pDeepest is NULL, and the empty string at path's end if the node
+    at path was found). A file stops the walk, since it has no
+    children.
+
+    If own is TRUE, top must be root, and every node found that is
+    shared with another hierarchy (see FT_copy) or with a snapshot
+    (see FT_snapshot) is first replaced with a private copy, so that
+    the nodes found may be changed and their parents are reliable.
+    Should a copy not be allocated, the walk stops there, NULL is
+    returned and *pRest, which must then be requested, is set to NULL.
 */
-static Node_T FT_getFileNode(char *path) {
-    Node_T fileNode;
+static Node_T FT_findNode(Node_T top, const char *path, boolean own,
+                          Node_T *pDeepest, const char **pRest) {
+    Node_T curr = NULL;
     Node_T child;
-    Node_T parent;
-    size_t i;
+    const char *rest = path;
+    size_t length;
+    size_t childID;
 
     assert(path != NULL);
+    assert(!own || (pRest != NULL && top == root));
 
-    /* Retrieve directory node closest to file node
-    along given path. */
-    parent = FT_getEndOfPathNode(path, root);
-    if (parent == NULL) {
-        return NULL;
+    length = strcspn(rest, "/");
+    if(top != NULL) {
+        FT_STATS_VISIT();
+        if(strlen(Node_getName(top)) == length
+           && !strncmp(Node_getName(top), rest, length)) {
+            curr = top;
+            rest += length;
+        }
     }
-
-    /* Examine directory node's children to find file node at given path.
-    If no file node exists, return NULL. */
-    for (i = 0; i < Node_getNumChildren(parent); i++) {
-        child = Node_getChild(parent, i);
-        if (child == NULL) {
+    if(own && curr != NULL) {
+        curr = Node_own(root);
+        if(curr == NULL) {
+            if(pDeepest != NULL)
+                *pDeepest = NULL;
+            *pRest = NULL;
             return NULL;
         }
-        if(!strncmp(path, Node_getPath(child), strlen(Node_getPath(child)))){
-            fileNode = Node_getChild(parent, i);
-            return fileNode;
+        root = curr;
+    }
+
+    while(curr != NULL && *rest == '/'
+          && Node_getType(curr) == DIRECTORY) {
+        length = strcspn(rest + 1, "/");
+        if(Node_hasChild(curr, rest + 1, length, &childID) != 1)
+            break;
+        child = own ? Node_ownChild(curr, childID)
+                    : Node_getChild(curr, childID);
+        if(child == NULL) {
+            if(pDeepest != NULL)
+                *pDeepest = curr;
+            *pRest = NULL;
+            return NULL;
         }
+        FT_STATS_VISIT();
+        curr = child;
+        rest += length + 1;
     }
-    return NULL;
+
+    if(pDeepest != NULL)
+        *pDeepest = curr;
+    if(pRest != NULL)
+        *pRest = (curr == NULL || *rest == '\0') ? rest : rest + 1;
+    return (curr != NULL && *rest == '\0') ? curr : NULL;
 }
 
 /*
@@ -122,56 +270,177 @@ static int FT_linkParentToChild(Node_T parent, Node_T child) {
 }
 
 /*
-   Inserts a new path into the tree rooted at parent, or, if
-   parent is NULL, as the root of the data structure. The leaf
-   node of the path should be set to type type. 
+   Returns the number of components in path: one more than the
+   number of '/' separators in it.
+*/
+static size_t FT_countComponents(const char *path) {
+    size_t components = 1;
+
+    assert(path != NULL);
+
+    for(; *path != '\0'; path++)
+        if(*path == '/')
+            components++;
+    return components;
+}
+
+/*
+   Returns TRUE if adding cost bytes, as estimated by Node_getInsertCost,
+   Node_getCopyCost or FT_storeCost, would take the bytes held by the
+   hierarchy's nodes and the contents it owns past memoryBudget, and
+   FALSE otherwise or if there is no budget.
+*/
+static boolean FT_exceedsBudget(size_t cost) {
+    struct MemoryUsage usage;
+    size_t used;
+
+    if(memoryBudget == 0)
+        return FALSE;
+
+    FT_foldReclaimed();
+    Node_getMemoryUsage(&usage);
+    used = usage.nodeBytes + usage.pathBytes
+        + usage.childPhysicalBytes + usage.fileBytes + usage.storedBytes;
+    return (boolean)(used + cost > memoryBudget);
+}
+
+/*
+   Returns the bytes of room to make in a new file node for contents
+   of the given length: if the tree owns contents, and they are not
+   empty and fit inline, their length rounded up to whole pointers,
+   the least room a node can have; and 0 otherwise.
+*/
+static size_t FT_roomFor(const void *contents, size_t length) {
+    if ((contentStore || ownedContents) && contents != NULL
+        && length > 0 && length <= FT_INLINE_MAX)
+        return (length + sizeof(void*) - 1) / sizeof(void*)
+            * sizeof(void*);
+    return 0;
+}
+
+/*
+   Returns the bytes FT_prepareContents would copy contents of the
+   given length into: if the tree owns contents and they do not fit
+   inline, the cost of a new stored copy, even if the content store
+   would share one it already has; and 0 otherwise.
+*/
+static size_t FT_storeCost(const void *contents, size_t length) {
+    if ((contentStore || ownedContents) && contents != NULL
+        && FT_roomFor(contents, length) == 0)
+        return Node_getStoreCost(length);
+    return 0;
+}
+
+/*
+   Prepares contents of the given length for a new file node: stores
+   in *pRoom the room to make in the node, and in *pStored a copy of
+   contents that the tree owns but that do not fit the room, or NULL.
+   Copying before the node is made means nothing is inserted unless
+   the contents can be.
+   Returns MEMORY_ERROR if unable to allocate the copy, and SUCCESS
+   otherwise.
+*/
+static int FT_prepareContents(const void *contents, size_t length,
+                              size_t *pRoom, void **pStored) {
+    assert(pRoom != NULL);
+    assert(pStored != NULL);
+
+    *pRoom = FT_roomFor(contents, length);
+    *pStored = NULL;
+    if ((contentStore || ownedContents) && contents != NULL
+        && *pRoom == 0) {
+        *pStored = Node_storeContents(contents, length, contentStore);
+        if (*pStored == NULL)
+            return MEMORY_ERROR;
+    }
+    return SUCCESS;
+}
+
+/*
+   Sets the contents of leaf, a file node just made with the room and
+   stored copy from FT_prepareContents, to contents of the given
+   length. A new file node has room for its contents, so this cannot
+   fail.
+*/
+static void FT_setNewContents(Node_T leaf, void *contents, size_t length,
+                              size_t room, void *stored) {
+    assert(leaf != NULL);
+    assert(Node_getType(leaf) == FT_FILE);
+
+    if (room > 0)
+        (void) Node_updateInlineContents(leaf, contents, length);
+    else if (stored != NULL)
+        (void) Node_updateStoredContents(leaf, stored);
+    else
+        (void) Node_updateFileContents(leaf, contents);
+    Node_updateLength(leaf, length);
+}
+
+/*
+   Inserts the components of rest as a new chain of nodes beneath the
+   directory parent, or, if parent is NULL, as the root hierarchy of
+   the data structure. The leaf node of the chain is set to type type,
+   and, if it is a file, given contents of size length bytes, prepared
+   as by FT_prepareContents; every other new node is a directory. The
+   caller has checked that the first component of rest is not already
+   a child of parent.
 
-   If a node representing path already exists, returns ALREADY_IN_TREE
+   If the new nodes, together with length bytes of file contents,
+   would exceed the quota of parent or any directory above it, returns
+   QUOTA_EXCEEDED without allocating anything.
 
-   If there is an allocation error in creating any of the new nodes or
-   their fields, returns MEMORY_ERROR
+   If the new nodes, with any copy of the contents the tree owns,
+   would exceed the memory budget, returns MEMORY_ERROR without
+   allocating anything. If there is an allocation
+   error in creating any of the new nodes or their fields, returns
+   MEMORY_ERROR
 
    If there is an error linking any of the new nodes,
    returns PARENT_CHILD_ERROR
 
    Otherwise, returns SUCCESS
 */
-static int FT_insertRestOfPath(char* path, Node_T parent, nodeType type) {
+static int FT_insertRestOfPath(const char* rest, Node_T parent,
+                               nodeType type, void *contents,
+                               size_t length) {
     Node_T curr = parent;
     Node_T firstNew = NULL;
     Node_T new;
     char* copyPath;
-    char* restPath = path;
     char* dirToken;
-    int restPathCount;
+    char* nextToken;
     int result;
     size_t newCount = 0;
+    size_t room;
+    void *stored;
 
-    assert(path != NULL);
-    assert(CheckerFT_isValid(isInitialized, root, count));
+    assert(rest != NULL);
+    assert(type == FT_FILE || contents == NULL);
+    FT_CHECK();
 
-    /* Invariant check. */
-    if(curr == NULL) {
-        if(root != NULL) {
-            return CONFLICTING_PATH;
-        }
-    }
-    else {
-        if(!strcmp(path, Node_getPath(curr))) {
-            return ALREADY_IN_TREE;
-        }
-        restPath += (strlen(Node_getPath(curr)) + 1);
-    }
+    /* Fail before any allocation if the new nodes would not fit. */
+    if(parent != NULL
+       && !Node_fitsQuotas(parent, FT_countComponents(rest), length))
+        return QUOTA_EXCEEDED;
+    if(FT_exceedsBudget(Node_getInsertCost(parent, rest,
+                                           FT_roomFor(contents, length))
+                        + FT_storeCost(contents, length)))
+        return MEMORY_ERROR;
+
+    /* Small contents the tree owns go inline in the file node;
+    larger ones are copied first. */
+    if(FT_prepareContents(contents, length, &room, &stored) != SUCCESS)
+        return MEMORY_ERROR;
 
-    /* Allocates memory for defensive copy, copies restPath -> 
-    copyPath, and gets first instance of a non-'/' character. 
-    Also gets restPathCount which is used to track where we're at
-    in the path as we iterate through dirToken.*/
-    copyPath = malloc(strlen(restPath)+1);
-    if(copyPath == NULL)
+    /* Allocates memory for defensive copy, copies rest -> copyPath,
+    and gets first instance of a non-'/' character. */
+    copyPath = malloc(strlen(rest)+1);
+    if(copyPath == NULL) {
+        if(stored != NULL)
+            Node_releaseContents(stored);
         return MEMORY_ERROR;
-    strcpy(copyPath, restPath);
-    restPathCount = (int)strlen(copyPath);
+    }
+    strcpy(copyPath, rest);
     dirToken = strtok(copyPath, "/");
 
     /* While there are still dirToken elements that exist (meaning
@@ -183,21 +452,21 @@ static int FT_insertRestOfPath(char* path, Node_T parent, nodeType type) {
     the path. For example, if we're trying to insert a file at 
     'a/b/D', insert a file node once dirToken = D. */
     while(dirToken != NULL) {
-        restPathCount -= strlen(dirToken) + 1;
-        /* Add the last file node */
-        if (type == FT_FILE && restPathCount == -1) {
-            new = Node_create(dirToken, curr, FT_FILE);
-        }
-        /* For every other new node in the path, make a
-        new directory node. */
-        else{
-            new = Node_create(dirToken, curr, DIRECTORY);
-        }
+        nextToken = strtok(NULL, "/");
+        /* Add the last node with the requested type, and every other
+        new node in the path as a directory. */
+        if(nextToken == NULL && type == FT_FILE && room > 0)
+            new = Node_createWithRoom(dirToken, curr, room);
+        else
+            new = Node_create(dirToken, curr,
+                              nextToken == NULL ? type : DIRECTORY);
 
         if(new == NULL) {
             if(firstNew != NULL)
                 (void) Node_destroy(firstNew);
             free(copyPath);
+            if(stored != NULL)
+                Node_releaseContents(stored);
             return MEMORY_ERROR;
         }
 
@@ -209,112 +478,73 @@ static int FT_insertRestOfPath(char* path, Node_T parent, nodeType type) {
         else {
             result = FT_linkParentToChild(curr, new);
             if(result != SUCCESS) {
-                (void) Node_destroy(new);
                 (void) Node_destroy(firstNew);
                 free(copyPath);
+                if(stored != NULL)
+                    Node_releaseContents(stored);
                 return result;
             }
         }
         curr = new;
-        dirToken = strtok(NULL, "/");
+        dirToken = nextToken;
     }
 
     free(copyPath);
+    if(firstNew == NULL) {
+        if(stored != NULL)
+            Node_releaseContents(stored);
+        return CONFLICTING_PATH;
+    }
 
     /* Initialize root and count if they do not exist. */
     if(parent == NULL) {
         root = firstNew;
         count = newCount;
-        assert(CheckerFT_isValid(isInitialized, root, count));
-        return SUCCESS;
     }
     /* Otherwise, link parent to the first new node you 
-    created in traversing restPath. */
+    created in traversing rest. */
     else {
         result = FT_linkParentToChild(parent, firstNew);
-        if(result == SUCCESS)
-            count += newCount;
-        else
-            (void) Node_destroy(firstNew);
-        return result;
-   }
+        if(result != SUCCESS) {
+            if(stored != NULL)
+                Node_releaseContents(stored);
+            return result;
+        }
+        count += newCount;
+    }
+
+    /* The leaf's contents are set once it is linked, so that its
+    length counts toward every directory above it. */
+    if(type == FT_FILE)
+        FT_setNewContents(curr, contents, length, room, stored);
+    FT_CHECK();
+    return SUCCESS;
 }
 
 /*
-  Removes the directory hierarchy rooted at path starting from
-  curr. If curr is the data structure's root, root becomes NULL.
-
-  Returns NO_SUCH_PATH if curr is not the node for path,
-  and SUCCESS otherwise.
+  Removes the hierarchy rooted at curr from the data structure and
+  frees it, or hands it to the background reclaimer. If curr is the
+  data structure's root, root becomes NULL.
  */
-static int FT_rmPathAt(const char* path, Node_T curr) {
+static void FT_removeNode(Node_T curr) {
     Node_T parent;
 
-    assert(path != NULL);
     assert(curr != NULL);
 
     parent = Node_getParent(curr);
-
-    if(!strcmp(path,Node_getPath(curr))) {
-            if(parent == NULL)
-                root = NULL;
-            else
-                Node_unlinkChild(parent, curr);
-
-            /* Taken from DT_removePathFrom. */
-            if(curr != NULL) {
-                count -= Node_destroy(curr);
-            }
-        return SUCCESS;
-    }
+    if(parent == NULL)
+        root = NULL;
     else
-        return NO_SUCH_PATH;
-
-}
+        (void) Node_unlinkChild(parent, curr);
 
-/*
-   Performs a pre-order traversal of the tree rooted at n,
-   inserting each payload to DynArray_T d beginning at index i.
-   Returns the next unused index in d after the insertion(s).
-*/
-static size_t FT_preOrderTraversal(Node_T n, DynArray_T d, size_t i) {
-    size_t c;
-
-    assert(d != NULL);
-
-    if(n != NULL) {
-        (void*) DynArray_set(d, i, Node_getPath(n));
-        i++;
-        for(c = 0; c < Node_getNumChildren(n); c++)
-            i = FT_preOrderTraversal(Node_getChild(n, c), d, i);
-    }
-    return i;
-}
-
-/*
-   Alternate version of strlen that uses pAcc as an in-out parameter
-   to accumulate a string length, rather than returning the length of
-   str, and also always adds one more in addition to str's length.
-*/
-static void FT_strlenAccumulate(char* str, size_t* pAcc) {
-    assert(str != NULL);
-    assert(pAcc != NULL);
-
-    if(str != NULL)
-        *pAcc += (strlen(str) + 1);
-}
-
-/*
-   Alternate version of strcat that inverts the typical argument
-   order, appending str onto acc, and also always adds a newline at
-   the end of the concatenated string.
-*/
-static void FT_strcatAccumulate(char* str, char* acc) {
-    assert(str != NULL);
-    assert(acc != NULL);
-
-    if(str != NULL)
-        strcat(acc, str); strcat(acc, "\n");
+    /* Taken from DT_removePathFrom. The subtree's size is
+    maintained, so when it can be freed in the background
+    nothing beneath it need be visited here. It counts every node
+    the hierarchy showed, including any still shared by a copy,
+    which are not freed. */
+    count -= Node_getNumNodes(curr);
+    if(!asyncReclaim || !FT_reclaimLater(curr))
+        (void) FT_destroySubtree(curr);
 }
 
 /*
@@ -324,46 +554,39 @@ static void FT_strcatAccumulate(char* str, char* acc) {
    Returns CONFLICTING_PATH if path is not underneath existing root.
    Returns NOT_A_DIRECTORY if a proper prefix of path exists as a file.
    Returns ALREADY_IN_TREE if the path already exists (as dir or file).
+   Returns QUOTA_EXCEEDED if the new directories would take a
+                          directory above them past its quota.
    Returns MEMORY_ERROR if unable to allocate any node or any field.
    Returns PARENT_CHILD_ERROR if a parent cannot link to a new child.
 */
-int FT_insertDir(char *path) {
-    Node_T curr;
-    Node_T fileNode;
-    char *pathCopy;
+static int FT_doInsertDir(char *path) {
+    Node_T deepest;
+    const char *rest;
     int result;
 
-    assert(CheckerFT_isValid(isInitialized,root,count));
+    FT_CHECK();
     assert(path != NULL);
 
     /* Invariant check. */
     if(!isInitialized)
         return INITIALIZATION_ERROR;
-    
-    if (FT_containsFile(path)) {
-        return ALREADY_IN_TREE;
-    }
-    if (FT_containsDir(path)) {
-        return ALREADY_IN_TREE;
-    }
 
-    /* Gets node at the end of the query path, so we can insert directory
-    at the end of this path. */
-    curr = FT_getEndOfPathNode(path, root);
+    /* Walk as far down path as the tree goes; whatever remains of
+    path is created beneath the deepest node found. */
+    if(FT_findNode(root, path, TRUE, &deepest, &rest) != NULL)
+        return ALREADY_IN_TREE;
+    if(rest == NULL)
+        return MEMORY_ERROR;
+    if(deepest == NULL && root != NULL)
+        return CONFLICTING_PATH;
 
     /* Check that we're not inserting a directory behind a file. */
-    fileNode = FT_getFileNode(path);
-    pathCopy = NULL;
-    if (fileNode != NULL) {
-        pathCopy = (char*)Node_getPath(fileNode);
-        if (FT_containsFile(pathCopy)) {
-            return NOT_A_DIRECTORY;
-        }
-    }
-    
-    /* Inserts path at the farthest node in the current path. */
-    result = FT_insertRestOfPath(path, curr, DIRECTORY);
-    assert(CheckerFT_isValid(isInitialized,root,count));
+    if(deepest != NULL && Node_getType(deepest) == FT_FILE)
+        return NOT_A_DIRECTORY;
+
+    /* Inserts the rest of path at the farthest node in the path. */
+    result = FT_insertRestOfPath(rest, deepest, DIRECTORY, NULL, 0);
+    FT_CHECK();
     return result;
 }
 
@@ -371,37 +594,18 @@ int FT_insertDir(char *path) {
   Returns TRUE if the tree contains the full path parameter as a
   directory and FALSE otherwise.
 */
-boolean FT_containsDir(char *path) {
+static boolean FT_doContainsDir(char *path) {
     Node_T curr;
-    boolean result;
 
-    assert(CheckerFT_isValid(isInitialized,root,count));
+    FT_CHECK();
     assert(path != NULL);
 
     /* Invariant check. */
     if(!isInitialized)
         return FALSE;
 
-    if (root == NULL){
-        return FALSE;
-    }
-
-    /* Get directory node at path. If FT contains
-    the directory, then the path of this node 
-    will match the input path. */
-    curr = FT_getEndOfPathNode(path, root);
-        
-    if(curr == NULL)
-        result = FALSE;
-    else if(strcmp(path, Node_getPath(curr)))
-        result = FALSE;
-    else {
-        assert(Node_getType(curr) == DIRECTORY);
-        result = TRUE;
-    }
-
-    assert(CheckerFT_isValid(isInitialized,root,count));
-    return result;
+    curr = FT_findNode(root, path, FALSE, NULL, NULL);
+    return (boolean)(curr != NULL && Node_getType(curr) == DIRECTORY);
 }
 
 /*
@@ -410,32 +614,30 @@ boolean FT_containsDir(char *path) {
   Returns INITIALIZATION_ERROR if not in an initialized state.
   Returns NOT_A_DIRECTORY if path exists but is a file not a directory.
   Returns NO_SUCH_PATH if the path does not exist in the hierarchy.
+  Returns MEMORY_ERROR if unable to copy a node shared by FT_copy.
 */
-int FT_rmDir(char *path) {
+static int FT_doRmDir(char *path) {
     Node_T curr;
-    int result;
+    const char *rest;
 
-    assert(CheckerFT_isValid(isInitialized,root,count));
+    FT_CHECK();
     assert(path != NULL);
 
     if(!isInitialized)
         return INITIALIZATION_ERROR;
 
-    /* Get directory node at given path and remove
-    that node, return NO_SUCH_PATH if directory node does 
-    not exists at given path. If file node exist at path,
-    return NOT_A_DIRECTORY. */
-    curr = FT_getEndOfPathNode(path, root);
+    /* Get the node at the given path and remove it, returning
+    NO_SUCH_PATH if no node exists at path and NOT_A_DIRECTORY
+    if a file node does. */
+    curr = FT_findNode(root, path, TRUE, NULL, &rest);
     if(curr == NULL)
-        result =  NO_SUCH_PATH;
-    else
-        result = FT_rmPathAt(path, curr);
-    if (FT_containsFile(path)) {
+        return rest == NULL ? MEMORY_ERROR : NO_SUCH_PATH;
+    if(Node_getType(curr) == FT_FILE)
         return NOT_A_DIRECTORY;
-    }
+    FT_removeNode(curr);
 
-    assert(CheckerFT_isValid(isInitialized,root,count));
-    return result;
+    FT_CHECK();
+    return SUCCESS;
 }
 
 /*
@@ -447,133 +649,1001 @@ int FT_rmDir(char *path) {
                             or if path would be the FT root.
    Returns NOT_A_DIRECTORY if a proper prefix of path exists as a file.
    Returns ALREADY_IN_TREE if the path already exists (as dir or file).
+   Returns QUOTA_EXCEEDED if the new nodes or contents would take a
+                          directory above them past its quota.
    Returns MEMORY_ERROR if unable to allocate any node or any field.
    Returns PARENT_CHILD_ERROR if a parent cannot link to a new child.
 */
-int FT_insertFile(char *path, void *contents, size_t length){
-    Node_T curr;
+static int FT_doInsertFile(char *path, void *contents, size_t length){
+    Node_T deepest;
+    const char *rest;
     int result;
-    void *oldContents;
 
-    assert(CheckerFT_isValid(isInitialized, root, count));
+    FT_CHECK();
     assert(path != NULL);
 
     /* Invariant check. */
     if(!isInitialized)
         return INITIALIZATION_ERROR;
-    if (root == NULL){
-        return CONFLICTING_PATH;
-    }
-    if (FT_containsFile(path) || FT_containsDir(path)) {
+    if(FT_findNode(root, path, TRUE, &deepest, &rest) != NULL)
         return ALREADY_IN_TREE;
-    }
-    if (FT_getFileNode(path)!= NULL){
+    if(rest == NULL)
+        return MEMORY_ERROR;
+    if(deepest == NULL)
+        return CONFLICTING_PATH;
+    if(Node_getType(deepest) == FT_FILE)
         return NOT_A_DIRECTORY;
-    }
 
-    /* Get directory node farthest down given path and 
-    insert file node as a child. */
-    curr = FT_getEndOfPathNode(path, root);
-    result = FT_insertRestOfPath(path, curr, FT_FILE);
+    /* Insert the file node, and any directories leading to it,
+    beneath the directory node farthest down the given path. */
+    result = FT_insertRestOfPath(rest, deepest, FT_FILE, contents,
+                                 length);
+    FT_CHECK();
+    return result;
+}
+
 
-    if (result != SUCCESS) {
-        return result;
-    }
+/*
+   Returns the number of leading path components that path and prev
+   have in common, or 0 if prev is NULL.
+*/
+static size_t FT_sharedComponents(const char *path, const char *prev) {
+    size_t shared = 0;
+    size_t i;
+    boolean endPath;
+    boolean endPrev;
 
-    /* Set file contents.
-    Do so by retrieving the newly created file node, update
-    its contents and length, and verify its contents were 
-    sucessfully set. 
-    This will only return NULL if curr is a directory or if
-    contents itself is NULL. We will check for the first case. 
-    The second is acceptable. */
-    curr = FT_getFileNode(path);
-    assert(curr != NULL);
-    assert(Node_getType(curr) == FT_FILE);
+    assert(path != NULL);
 
-    oldContents = Node_updateFileContents(curr, contents);
-    Node_updateLength(curr, length);
+    if(prev == NULL)
+        return 0;
 
-    if (oldContents == NULL) {
-        if (Node_getLength(curr) == 0) {
-            return MEMORY_ERROR;
+    for(i = 0; ; i++) {
+        endPath = (boolean)(path[i] == '/' || path[i] == '\0');
+        endPrev = (boolean)(prev[i] == '/' || prev[i] == '\0');
+        if(endPath && endPrev) {
+            shared++;
+            if(path[i] == '\0' || prev[i] == '\0')
+                return shared;
         }
+        else if(path[i] != prev[i])
+            return shared;
     }
-
-    assert(CheckerFT_isValid(isInitialized,root,count));
-    return result;
 }
 
-
 /*
-  Returns TRUE if the tree contains the full path parameter as a
-  file and FALSE otherwise.
+   Inserts path as a node of the given type -- a file with the given
+   contents and length, or a directory -- as the next entry of a bulk
+   insert. chain holds the nodes that earlier
+   entries resolved to: chain[d] is the node for the first d + 1
+   components of the previous entry, and *pChainLength is how many of
+   them are valid. The first shared (<= *pChainLength) components of
+   path are taken to match the previous entry's and are taken from
+   chain without any lookup. Each remaining component is first
+   compared against the last child of its parent: when it sorts after
+   it -- always, for sorted input -- the new node is appended with no
+   search or shifting; otherwise the parent's children are binary
+   searched. Every node created is added to *pCount.
+   path is modified while in use but restored before returning.
+   On return chain and *pChainLength describe path's nodes (as far as
+   they were resolved).
+
+   Returns SUCCESS or any status FT_insertFile (or, for a directory,
+   FT_insertDir) would return for path.
 */
-boolean FT_containsFile(char *path){
+static int FT_insertNext(char *path, nodeType type, void *contents,
+                         size_t length, size_t shared, DynArray_T chain,
+                         size_t *pChainLength, size_t *pCount) {
+    size_t depth;
+    size_t start = 0;
+    size_t end = 0;
+    boolean isLast;
+    char saved;
+    Node_T parent = NULL;
     Node_T curr;
+    Node_T last;
+    size_t numChildren;
+    size_t childID;
+    int found;
+    int result;
+    size_t room;
+    void *stored;
 
-    assert(CheckerFT_isValid(isInitialized, root, count));
     assert(path != NULL);
+    assert(chain != NULL);
+    assert(pChainLength != NULL);
+    assert(shared <= *pChainLength);
+    assert(pCount != NULL);
 
-    /* Invariant check. */
-    if (!isInitialized)
-        return FALSE;
+    for(depth = 0; ; depth++) {
+        while(path[end] != '/' && path[end] != '\0')
+            end++;
+        isLast = (boolean)(path[end] == '\0');
+        saved = path[end];
+        path[end] = '\0';
 
-    curr = FT_getFileNode(path);
+        if(depth < shared) {
+            /* Resolved by the previous entry. */
+            curr = DynArray_get(chain, depth);
+            found = 1;
+        }
+        else if(parent == NULL) {
+            /* The first component must be the root. */
+            if(root == NULL)
+                found = 0;
+            else if(!strcmp(path, Node_getName(root))) {
+                curr = Node_own(root);
+                if(curr != NULL)
+                    root = curr;
+                found = 1;
+            }
+            else {
+                path[end] = saved;
+                return CONFLICTING_PATH;
+            }
+            childID = 0;
+        }
+        else {
+            FT_STATS_VISIT();
+            numChildren = Node_getNumChildren(parent);
+            found = 0;
+            childID = numChildren;
+            if(numChildren > 0) {
+                last = Node_getChild(parent, numChildren - 1);
+                result = strcmp(path + start, Node_getName(last));
+                if(result == 0) {
+                    curr = Node_ownChild(parent, numChildren - 1);
+                    found = 1;
+                }
+                else if(result < 0) {
+                    /* Out of order: fall back to a binary search. */
+                    found = Node_hasChild(parent, path + start,
+                                          end - start, &childID);
+                    if(found)
+                        curr = Node_ownChild(parent, childID);
+                }
+            }
+        }
 
-    if (curr == NULL)
-        return FALSE;
-    if (Node_getType(curr) == DIRECTORY)
-        return FALSE;
-    else if (strcmp(path, Node_getPath(curr)))
-        return FALSE;
+        if(found) {
+            /* A node shared by FT_copy or a snapshot is copied before
+            anything is inserted beneath it. */
+            if(curr == NULL) {
+                path[end] = saved;
+                return MEMORY_ERROR;
+            }
+            if(isLast || Node_getType(curr) == FT_FILE) {
+                path[end] = saved;
+                return isLast ? ALREADY_IN_TREE : NOT_A_DIRECTORY;
+            }
+        }
+        else {
+            /* A file may not be the root. */
+            if(parent == NULL && isLast && type == FT_FILE) {
+                path[end] = saved;
+                return CONFLICTING_PATH;
+            }
+            /* Fail before any allocation if the rest of the path
+            would not fit the quotas above it or the memory budget. */
+            path[end] = saved;
+            if(parent != NULL && !Node_fitsQuotas(parent,
+                   FT_countComponents(path + start), length))
+                return QUOTA_EXCEEDED;
+            room = (type == FT_FILE) ? FT_roomFor(contents, length) : 0;
+            if(FT_exceedsBudget(Node_getInsertCost(parent,
+                                                   path + start, room)
+                                + (type == FT_FILE
+                                   ? FT_storeCost(contents, length)
+                                   : 0)))
+                return MEMORY_ERROR;
+            path[end] = '\0';
 
-    assert(CheckerFT_isValid(isInitialized, root, count));
-    return TRUE;
+            /* A new file's contents are prepared as FT_insertFile
+            prepares them. */
+            room = 0;
+            stored = NULL;
+            if(isLast && type == FT_FILE
+               && FT_prepareContents(contents, length, &room, &stored)
+                  != SUCCESS) {
+                path[end] = saved;
+                return MEMORY_ERROR;
+            }
+            if(room > 0)
+                curr = Node_createWithRoom(path + start, parent, room);
+            else
+                curr = Node_create(path + start, parent,
+                                   isLast ? type : DIRECTORY);
+            if(curr == NULL) {
+                if(stored != NULL)
+                    Node_releaseContents(stored);
+                path[end] = saved;
+                return MEMORY_ERROR;
+            }
+            if(parent == NULL)
+                root = curr;
+            else if(Node_insertChildAt(parent, curr, childID)
+                    != SUCCESS) {
+                if(stored != NULL)
+                    Node_releaseContents(stored);
+                (void) Node_destroy(curr);
+                path[end] = saved;
+                return PARENT_CHILD_ERROR;
+            }
+            (*pCount)++;
+            if(isLast && type == FT_FILE)
+                FT_setNewContents(curr, contents, length, room, stored);
+        }
+
+        /* Record curr as this entry's node at depth. */
+        if(depth < DynArray_getLength(chain))
+            (void) DynArray_set(chain, depth, curr);
+        else if(!DynArray_add(chain, curr)) {
+            path[end] = saved;
+            *pChainLength = depth;
+            return MEMORY_ERROR;
+        }
+        *pChainLength = depth + 1;
+
+        path[end] = saved;
+        if(isLast)
+            return SUCCESS;
+        parent = curr;
+        end++;
+        start = end;
+    }
 }
 
 /*
-  Removes the FT file at path.
-  Returns SUCCESS if found and removed.
-  Returns INITIALIZATION_ERROR if not in an initialized state.
-  Returns NOT_A_FILE if path exists but is a directory not a file.
-  Returns NO_SUCH_PATH if the path does not exist in the hierarchy.
+   Inserts the n files paths[i], with contents contents[i] of size
+   lengths[i] bytes, in order, creating missing directories as
+   FT_insertFile does. contents or lengths may be NULL to give every
+   file NULL contents or length 0. Sorted input (in strcmp order) takes
+   a fast path that reuses the previous path's resolved ancestors and
+   appends new nodes at the end of each parent's children; unsorted
+   input is accepted but falls back to a binary search where needed.
+   Returns SUCCESS if every file is inserted. Otherwise stops at the
+   first path that cannot be inserted and returns the status
+   FT_insertFile would have returned for it; the files before it
+   remain inserted.
 */
-int FT_rmFile(char *path){
-    Node_T parent;
-    Node_T curr;
-    int result;
+static int FT_doInsertMany(char *paths[], void *contents[],
+                           size_t lengths[], size_t n) {
+    DynArray_T chain;
+    size_t chainLength = 0;
+    char *buffer = NULL;
+    size_t bufferSize = 0;
+    size_t pathLength;
+    size_t shared;
+    size_t i;
+    int result = SUCCESS;
 
-    assert(CheckerFT_isValid(isInitialized, root, count));
-    assert(path != NULL);
+    FT_CHECK();
+    assert(paths != NULL || n == 0);
 
-    /* Invariant check. */
-    if (!isInitialized)
+    if(!isInitialized)
         return INITIALIZATION_ERROR;
-    
-    curr = FT_getFileNode(path);
 
-    /* If file node does not exists or the paths do not 
-    match, return NOT_A_FILE or NO_SUCH_PATH, respectively. */
-    if (curr == NULL) {
-        return NOT_A_FILE;
-    }
-    if (strcmp(path, Node_getPath(curr))) {
-        if (Node_getType(curr) == FT_FILE) {
-            return NO_SUCH_PATH;
+    chain = DynArray_new(0);
+    if(chain == NULL)
+        return MEMORY_ERROR;
+
+    for(i = 0; i < n && result == SUCCESS; i++) {
+        assert(paths[i] != NULL);
+
+        /* Work on a private copy, since the client's path may be
+        read-only and FT_insertNext terminates each prefix in turn. */
+        pathLength = strlen(paths[i]);
+        if(pathLength + 1 > bufferSize) {
+            free(buffer);
+            bufferSize = 2 * (pathLength + 1);
+            buffer = malloc(bufferSize);
+            if(buffer == NULL) {
+                result = MEMORY_ERROR;
+                break;
+            }
         }
+        strcpy(buffer, paths[i]);
+
+        shared = FT_sharedComponents(paths[i],
+                                     i == 0 ? NULL : paths[i - 1]);
+        if(shared > chainLength)
+            shared = chainLength;
+        result = FT_insertNext(buffer, FT_FILE,
+                               contents == NULL ? NULL : contents[i],
+                               lengths == NULL ? 0 : lengths[i],
+                               shared, chain, &chainLength, &count);
+        /* Each file is logged as it is inserted, since a failure
+        leaves the ones before it in place. */
+        FT_walNote(result, FT_WAL_INSERTFILE, paths[i], NULL,
+                   contents == NULL ? NULL : contents[i],
+                   lengths == NULL ? 0 : lengths[i], 0, 0);
+    }
+
+    free(buffer);
+    DynArray_free(chain);
+    FT_CHECK();
+    return result;
+}
+
+/*--------------------------------------------------------------------*/
+/* Parallel bulk construction                                         */
+/*--------------------------------------------------------------------*/
+
+/* One input entry of FT_build: its path and its index in the input. */
+struct FT_entry {
+    char *path;
+    size_t index;
+};
+
+/*
+   Compares paths component by component, so that a path sorts
+   immediately before its descendants and siblings sort by name: this
+   is strcmp order with '/' ranking below every other character, and
+   it is the pre-order in which FT_toString lists nodes.
+*/
+static int FT_comparePaths(const char *path1, const char *path2) {
+    int c1;
+    int c2;
+
+    assert(path1 != NULL);
+    assert(path2 != NULL);
+
+    for(;; path1++, path2++) {
+        c1 = (*path1 == '\0') ? 0
+            : (*path1 == '/') ? 1 : (unsigned char)*path1 + 1;
+        c2 = (*path2 == '\0') ? 0
+            : (*path2 == '/') ? 1 : (unsigned char)*path2 + 1;
+        if(c1 != c2)
+            return c1 - c2;
+        if(c1 == 0)
+            return 0;
+    }
+}
+
+/* Compares the entries pvEntry1 and pvEntry2 by path, for qsort. */
+static int FT_compareEntries(const void *pvEntry1, const void *pvEntry2) {
+    return FT_comparePaths(((const struct FT_entry *)pvEntry1)->path,
+                           ((const struct FT_entry *)pvEntry2)->path);
+}
+
+/*
+   Runs pfWork on each of the numTasks tasks of taskSize bytes starting
+   at pvTasks, each on its own thread, the last one on the calling
+   thread, and returns once all have finished. A task whose thread
+   cannot be created is run on the calling thread instead.
+*/
+static void FT_runTasks(void *(*pfWork)(void *), void *pvTasks,
+                        size_t taskSize, size_t numTasks) {
+    pthread_t *threads;
+    boolean *started;
+    char *tasks = pvTasks;
+    size_t i;
+
+    assert(pfWork != NULL);
+    assert(pvTasks != NULL || numTasks == 0);
+
+    if(numTasks == 0)
+        return;
+
+    threads = malloc(numTasks * sizeof(pthread_t));
+    started = calloc(numTasks, sizeof(boolean));
+    for(i = 0; i + 1 < numTasks; i++) {
+        if(threads != NULL && started != NULL)
+            started[i] = (boolean)(pthread_create(&threads[i], NULL,
+                pfWork, tasks + i * taskSize) == 0);
+        if(started == NULL || !started[i])
+            (void) pfWork(tasks + i * taskSize);
+    }
+    (void) pfWork(tasks + (numTasks - 1) * taskSize);
+
+    for(i = 0; i + 1 < numTasks; i++)
+        if(started != NULL && started[i])
+            (void) pthread_join(threads[i], NULL);
+    free(threads);
+    free(started);
+}
+
+/*
+   Returns numThreads, or the number of online processors if
+   numThreads is 0.
+*/
+static size_t FT_defaultThreads(size_t numThreads) {
+    long online;
+
+    if(numThreads != 0)
+        return numThreads;
+    online = sysconf(_SC_NPROCESSORS_ONLN);
+    return online > 0 ? (size_t)online : 1;
+}
+
+/* A range of FT_build's entries to sort, or two sorted runs to merge. */
+struct FT_sortTask {
+    /* the runs [lo, mid) and [mid, hi) of src, merged into dst;
+       a sort task sorts [lo, hi) of src in place */
+    struct FT_entry *src;
+    struct FT_entry *dst;
+    size_t lo;
+    size_t mid;
+    size_t hi;
+};
+
+/* Sorts the range of the struct FT_sortTask pvTask. */
+static void *FT_sortRun(void *pvTask) {
+    struct FT_sortTask *task = pvTask;
+
+    qsort(task->src + task->lo, task->hi - task->lo,
+          sizeof(struct FT_entry), FT_compareEntries);
+    return NULL;
+}
+
+/* Merges the two runs of the struct FT_sortTask pvTask. */
+static void *FT_mergeRuns(void *pvTask) {
+    struct FT_sortTask *task = pvTask;
+    size_t i = task->lo;
+    size_t j = task->mid;
+    size_t k = task->lo;
+
+    while(i < task->mid && j < task->hi) {
+        if(FT_compareEntries(&task->src[j], &task->src[i]) < 0)
+            task->dst[k++] = task->src[j++];
+        else
+            task->dst[k++] = task->src[i++];
+    }
+    while(i < task->mid)
+        task->dst[k++] = task->src[i++];
+    while(j < task->hi)
+        task->dst[k++] = task->src[j++];
+    return NULL;
+}
+
+/*
+   Sorts the n entries with FT_comparePaths using numThreads threads:
+   each sorts one run, and then pairs of runs are merged in parallel
+   until one remains. Returns FALSE if memory runs out.
+*/
+static boolean FT_sortEntries(struct FT_entry *entries, size_t n,
+                              size_t numThreads) {
+    struct FT_entry *scratch;
+    struct FT_entry *src = entries;
+    struct FT_entry *dst;
+    struct FT_sortTask *tasks;
+    size_t *bounds;
+    size_t numRuns;
+    size_t numTasks;
+    size_t r;
+
+    assert(entries != NULL);
+
+    if(numThreads > n)
+        numThreads = n;
+    if(numThreads <= 1) {
+        qsort(entries, n, sizeof(struct FT_entry), FT_compareEntries);
+        return TRUE;
+    }
+
+    scratch = malloc(n * sizeof(struct FT_entry));
+    tasks = malloc(numThreads * sizeof(struct FT_sortTask));
+    bounds = malloc((numThreads + 1) * sizeof(size_t));
+    if(scratch == NULL || tasks == NULL || bounds == NULL) {
+        free(scratch);
+        free(tasks);
+        free(bounds);
+        return FALSE;
+    }
+    dst = scratch;
+
+    numRuns = numThreads;
+    for(r = 0; r <= numRuns; r++)
+        bounds[r] = r * n / numRuns;
+    for(r = 0; r < numRuns; r++) {
+        tasks[r].src = src;
+        tasks[r].lo = bounds[r];
+        tasks[r].hi = bounds[r + 1];
+    }
+    FT_runTasks(FT_sortRun, tasks, sizeof(struct FT_sortTask), numRuns);
+
+    while(numRuns > 1) {
+        numTasks = 0;
+        for(r = 0; r < numRuns; r += 2) {
+            tasks[numTasks].src = src;
+            tasks[numTasks].dst = dst;
+            tasks[numTasks].lo = bounds[r];
+            /* an unpaired last run is merged with an empty one */
+            tasks[numTasks].mid = bounds[r + (r + 1 < numRuns)];
+            tasks[numTasks].hi = bounds[r + 1 + (r + 1 < numRuns)];
+            if(r + 1 >= numRuns)
+                tasks[numTasks].mid = tasks[numTasks].hi;
+            bounds[numTasks] = bounds[r];
+            numTasks++;
+        }
+        bounds[numTasks] = n;
+        FT_runTasks(FT_mergeRuns, tasks, sizeof(struct FT_sortTask),
+                    numTasks);
+        numRuns = numTasks;
+        dst = src;
+        src = tasks[0].dst;
+    }
+
+    if(src != entries)
+        memcpy(entries, src, n * sizeof(struct FT_entry));
+    free(scratch);
+    free(tasks);
+    free(bounds);
+    return TRUE;
+}
+
+/* The work shared by all of FT_build's workers. */
+struct FT_buildWork {
+    /* the sorted entries and the client's contents and lengths */
+    struct FT_entry *entries;
+    void **contents;
+    size_t *lengths;
+    /* the root, which workers only read */
+    Node_T root;
+    /* groupStart[g] is the first entry of the g'th top-level subtree,
+       and groupStart[numGroups] is the number of entries */
+    size_t *groupStart;
+    size_t numGroups;
+    /* the subtree built for each group, its node count, and the
+       status of building it */
+    Node_T *tops;
+    size_t *counts;
+    int *results;
+    /* the next group for a worker to claim, taken atomically */
+    size_t nextGroup;
+};
+
+/* One of FT_build's workers. */
+struct FT_buildWorker {
+    /* the work shared by all workers */
+    struct FT_buildWork *work;
+    /* the memory totals of the nodes this worker has created */
+    struct MemoryUsage usage;
+};
+
+/*
+   Builds group g of work as a subtree that is not yet linked to the
+   root, storing it, its node count and the resulting status in work.
+   chain and buffer are the worker's scratch space.
+*/
+static void FT_buildGroup(struct FT_buildWork *work, size_t g,
+                          DynArray_T chain, char **pBuffer,
+                          size_t *pBufferSize) {
+    size_t first = work->groupStart[g];
+    size_t last = work->groupStart[g + 1];
+    char *path = work->entries[first].path;
+    size_t index;
+    size_t start;
+    size_t end;
+    size_t pathLength;
+    size_t chainLength;
+    size_t shared;
+    size_t i;
+    Node_T top;
+    char *name;
+    void *contents;
+    size_t length;
+    size_t room;
+    void *stored;
+    int result = SUCCESS;
+
+    /* Isolate the top-level component, the second of every path in
+    the group. */
+    /* Group paths always have a '/', being below the root. */
+    assert(strchr(path, '/') != NULL);
+    start = (size_t) (strchr(path, '/') - path) + 1;
+    for(end = start; path[end] != '/' && path[end] != '\0'; end++)
+        ;
+    name = malloc(end - start + 1);
+    if(name == NULL) {
+        work->results[g] = MEMORY_ERROR;
+        return;
+    }
+    memcpy(name, path + start, end - start);
+    name[end - start] = '\0';
+
+    /* A top-level file must be alone in its group: anything after it
+    is a duplicate or a path through it. */
+    if(path[end] == '\0') {
+        if(last - first > 1) {
+            free(name);
+            work->results[g] = strcmp(path, work->entries[first + 1].path)
+                ? NOT_A_DIRECTORY : ALREADY_IN_TREE;
+            return;
+        }
+        index = work->entries[first].index;
+        contents = work->contents == NULL ? NULL : work->contents[index];
+        length = work->lengths == NULL ? 0 : work->lengths[index];
+        if(FT_prepareContents(contents, length, &room, &stored)
+           != SUCCESS) {
+            free(name);
+            work->results[g] = MEMORY_ERROR;
+            return;
+        }
+        if(room > 0)
+            top = Node_createWithRoom(name, work->root, room);
+        else
+            top = Node_create(name, work->root, FT_FILE);
+        free(name);
+        if(top == NULL) {
+            if(stored != NULL)
+                Node_releaseContents(stored);
+            work->results[g] = MEMORY_ERROR;
+            return;
+        }
+        FT_setNewContents(top, contents, length, room, stored);
+        work->tops[g] = top;
+        work->counts[g] = 1;
+        work->results[g] = SUCCESS;
+        return;
+    }
+
+    top = Node_create(name, work->root, DIRECTORY);
+    free(name);
+    if(top == NULL) {
+        work->results[g] = MEMORY_ERROR;
+        return;
+    }
+    work->tops[g] = top;
+    work->counts[g] = 1;
+
+    /* Insert every path beneath top, which with the root is already
+    resolved for all of them. */
+    (void) DynArray_set(chain, 0, work->root);
+    (void) DynArray_set(chain, 1, top);
+    chainLength = 2;
+    for(i = first; i < last && result == SUCCESS; i++) {
+        path = work->entries[i].path;
+        pathLength = strlen(path);
+        if(pathLength + 1 > *pBufferSize) {
+            free(*pBuffer);
+            *pBufferSize = 2 * (pathLength + 1);
+            *pBuffer = malloc(*pBufferSize);
+            if(*pBuffer == NULL) {
+                *pBufferSize = 0;
+                result = MEMORY_ERROR;
+                break;
+            }
+        }
+        strcpy(*pBuffer, path);
+
+        shared = 2;
+        if(i > first) {
+            shared = FT_sharedComponents(path, work->entries[i - 1].path);
+            if(shared > chainLength)
+                shared = chainLength;
+        }
+        index = work->entries[i].index;
+        result = FT_insertNext(*pBuffer, FT_FILE,
+            work->contents == NULL ? NULL : work->contents[index],
+            work->lengths == NULL ? 0 : work->lengths[index],
+            shared, chain, &chainLength, &work->counts[g]);
+    }
+    work->results[g] = result;
+}
+
+/*
+   Runs the FT_build worker pvWorker: claims groups until none are
+   left, building each, with its node allocations accounted privately.
+*/
+static void *FT_buildWorker(void *pvWorker) {
+    struct FT_buildWorker *worker = pvWorker;
+    struct FT_buildWork *work = worker->work;
+    DynArray_T chain;
+    char *buffer = NULL;
+    size_t bufferSize = 0;
+    size_t g;
+
+    Node_setAccounting(&worker->usage);
+    chain = DynArray_new(2);
+    for(;;) {
+        g = __sync_fetch_and_add(&work->nextGroup, 1);
+        if(g >= work->numGroups)
+            break;
+        if(chain == NULL)
+            work->results[g] = MEMORY_ERROR;
+        else
+            FT_buildGroup(work, g, chain, &buffer, &bufferSize);
+    }
+    free(buffer);
+    if(chain != NULL)
+        DynArray_free(chain);
+    Node_setAccounting(NULL);
+    return NULL;
+}
+
+/*
+   Stores in *pCost the bytes by which building the n entries, sorted
+   into pre-order, with the given contents and lengths as FT_build
+   does, would grow the totals reported by Node_getMemoryUsage: every
+   component not shared with the previous entry becomes a node, every
+   directory's child array grows to hold all of its children, and
+   contents the tree owns that do not fit inline are copied. Entries
+   that FT_build would reject are priced as far as they go.
+   Returns FALSE if unable to allocate, and TRUE otherwise.
+*/
+static boolean FT_buildCost(struct FT_entry *entries, size_t n,
+                            void *contents[], size_t lengths[],
+                            size_t *pCost) {
+    size_t *counts;
+    size_t maxDepth = 0;
+    size_t open = 0;
+    size_t cost = 0;
+    size_t components;
+    size_t shared;
+    size_t index;
+    size_t i;
+    size_t d;
+    const char *rest;
+    void *entryContents;
+    size_t length;
+
+    assert(entries != NULL);
+    assert(pCost != NULL);
+
+    for(i = 0; i < n; i++) {
+        components = FT_countComponents(entries[i].path);
+        if(components > maxDepth)
+            maxDepth = components;
+    }
+    counts = malloc(maxDepth * sizeof(size_t));
+    if(counts == NULL)
+        return FALSE;
+
+    /* counts[d] is the number of children so far of the directory at
+    depth d on the previous entry's path, of which the first open are
+    directories. */
+    for(i = 0; i < n; i++) {
+        rest = entries[i].path;
+        components = FT_countComponents(rest);
+        shared = FT_sharedComponents(rest,
+                                     i == 0 ? NULL : entries[i - 1].path);
+        if(shared > open)
+            shared = open;
+        /* The directories left behind have all their children. */
+        for(; open > shared; open--)
+            cost += DynArray_getGrownFootprint(counts[open - 1])
+                - DynArray_getNewFootprint(0);
+        if(shared >= components)
+            continue;
+        if(shared > 0)
+            counts[shared - 1]++;
+        for(d = shared; d + 1 < components; d++)
+            counts[d] = 1;
+        open = components - 1;
+
+        for(d = 0; d < shared; d++)
+            rest = strchr(rest, '/') + 1;
+        index = entries[i].index;
+        entryContents = contents == NULL ? NULL : contents[index];
+        length = lengths == NULL ? 0 : lengths[index];
+        cost += Node_getInsertCost(NULL, rest,
+                                   FT_roomFor(entryContents, length))
+            + FT_storeCost(entryContents, length);
+    }
+    for(; open > 0; open--)
+        cost += DynArray_getGrownFootprint(counts[open - 1])
+            - DynArray_getNewFootprint(0);
+
+    free(counts);
+    *pCost = cost;
+    return TRUE;
+}
+
+/*
+   Builds the hierarchy of the n files paths[i], with contents
+   contents[i] of size lengths[i] bytes, into an empty tree using
+   numThreads threads (0 for one per online processor). The entries
+   are sorted in parallel into pre-order, split into one group per
+   top-level subtree beneath the root, and the groups are built
+   concurrently, each worker accounting for its nodes privately,
+   before being linked under the root in order.
+
+   Returns SUCCESS if every file is inserted, giving the same tree as
+   FT_insertFile on each path in turn.
+   Returns INITIALIZATION_ERROR if not in an initialized state.
+   Returns CONFLICTING_PATH if the tree is not empty, if the paths do
+   not share one root, or if a path would be a file at the root.
+   Returns ALREADY_IN_TREE if a path appears twice.
+   Returns NOT_A_DIRECTORY if a proper prefix of a path is a file.
+   Returns MEMORY_ERROR if allocation fails or the tree would exceed
+   the memory budget.
+   On any error the tree is left empty.
+*/
+static int FT_doBuild(char *paths[], void *contents[], size_t lengths[],
+                      size_t n, size_t numThreads) {
+    struct FT_buildWork work;
+    struct FT_buildWorker *workers = NULL;
+    struct FT_entry *entries;
+    char *rootName;
+    const char *first;
+    const char *prev;
+    const char *path;
+    size_t rootLength;
+    size_t numWorkers;
+    size_t cost;
+    size_t i;
+    size_t g;
+    int result = SUCCESS;
+
+    FT_CHECK();
+    assert(paths != NULL || n == 0);
+
+    if(!isInitialized)
+        return INITIALIZATION_ERROR;
+    if(root != NULL)
+        return CONFLICTING_PATH;
+    if(n == 0)
+        return SUCCESS;
+    numThreads = FT_defaultThreads(numThreads);
+
+    entries = malloc(n * sizeof(struct FT_entry));
+    if(entries == NULL)
+        return MEMORY_ERROR;
+    for(i = 0; i < n; i++) {
+        assert(paths[i] != NULL);
+        entries[i].path = paths[i];
+        entries[i].index = i;
+    }
+    if(!FT_sortEntries(entries, n, numThreads)) {
+        free(entries);
+        return MEMORY_ERROR;
+    }
+
+    /* Every path must be beneath one root directory, which sorts
+    before everything else if it appears by itself. */
+    first = entries[0].path;
+    rootLength = strcspn(first, "/");
+    for(i = 0; i < n && result == SUCCESS; i++) {
+        path = entries[i].path;
+        if(strncmp(path, first, rootLength) || path[rootLength] != '/')
+            result = CONFLICTING_PATH;
+    }
+    /* Fail before building anything if the tree would not fit. */
+    if(result == SUCCESS && memoryBudget != 0) {
+        if(!FT_buildCost(entries, n, contents, lengths, &cost))
+            result = MEMORY_ERROR;
+        else if(FT_exceedsBudget(cost))
+            result = MEMORY_ERROR;
+    }
+    if(result != SUCCESS) {
+        free(entries);
+        return result;
+    }
+
+    /* Split the entries into groups by their top-level component. */
+    memset(&work, 0, sizeof(work));
+    work.entries = entries;
+    work.contents = contents;
+    work.lengths = lengths;
+    work.groupStart = malloc((n + 1) * sizeof(size_t));
+    if(work.groupStart == NULL) {
+        free(entries);
+        return MEMORY_ERROR;
+    }
+    for(i = 0; i < n; i++) {
+        prev = (i == 0) ? NULL : entries[i - 1].path;
+        if(FT_sharedComponents(entries[i].path, prev) < 2)
+            work.groupStart[work.numGroups++] = i;
+    }
+    work.groupStart[work.numGroups] = n;
+
+    rootName = malloc(rootLength + 1);
+    work.tops = calloc(work.numGroups, sizeof(Node_T));
+    work.counts = calloc(work.numGroups, sizeof(size_t));
+    work.results = calloc(work.numGroups, sizeof(int));
+    numWorkers = numThreads < work.numGroups ? numThreads
+        : work.numGroups;
+    workers = calloc(numWorkers, sizeof(struct FT_buildWorker));
+    if(rootName != NULL) {
+        memcpy(rootName, first, rootLength);
+        rootName[rootLength] = '\0';
+        work.root = Node_create(rootName, NULL, DIRECTORY);
+        free(rootName);
+    }
+    if(work.root == NULL || work.tops == NULL || work.counts == NULL
+       || work.results == NULL || workers == NULL)
+        result = MEMORY_ERROR;
+
+    if(result == SUCCESS) {
+        for(i = 0; i < numWorkers; i++)
+            workers[i].work = &work;
+        FT_runTasks(FT_buildWorker, workers,
+                    sizeof(struct FT_buildWorker), numWorkers);
+        for(i = 0; i < numWorkers; i++)
+            Node_mergeAccounting(&workers[i].usage);
+
+        /* Report the failure of the earliest group, if any. */
+        for(g = 0; g < work.numGroups && result == SUCCESS; g++)
+            result = work.results[g];
     }
-    
-    /* Remove file. */
-    parent = Node_getParent(curr);
-    Node_unlinkChild(parent, curr);
-    count -= Node_destroy(curr);
-    result = SUCCESS;
 
-    assert(CheckerFT_isValid(isInitialized, root, count));
+    /* Stitch the subtrees under the root, in order. */
+    if(result == SUCCESS) {
+        count = 1;
+        for(g = 0; g < work.numGroups && result == SUCCESS; g++) {
+            result = Node_insertChildAt(work.root, work.tops[g], g);
+            if(result == SUCCESS) {
+                count += work.counts[g];
+                work.tops[g] = NULL;
+            }
+        }
+        root = work.root;
+    }
+
+    /* On failure, leave the tree empty. */
+    if(result != SUCCESS) {
+        for(g = 0; work.tops != NULL && g < work.numGroups; g++)
+            if(work.tops[g] != NULL)
+                (void) Node_destroy(work.tops[g]);
+        if(work.root != NULL)
+            (void) Node_destroy(work.root);
+        root = NULL;
+        count = 0;
+    }
+
+    free(workers);
+    free(work.tops);
+    free(work.counts);
+    free(work.results);
+    free(work.groupStart);
+    free(entries);
+    FT_CHECK();
     return result;
 }
 
+/*
+  Returns TRUE if the tree contains the full path parameter as a
+  file and FALSE otherwise.
+*/
+static boolean FT_doContainsFile(char *path){
+    Node_T curr;
+
+    FT_CHECK();
+    assert(path != NULL);
+
+    /* Invariant check. */
+    if (!isInitialized)
+        return FALSE;
+
+    curr = FT_findNode(root, path, FALSE, NULL, NULL);
+    return (boolean)(curr != NULL && Node_getType(curr) == FT_FILE);
+}
+
+/*
+  Removes the FT file at path.
+  Returns SUCCESS if found and removed.
+  Returns INITIALIZATION_ERROR if not in an initialized state.
+  Returns NOT_A_FILE if path exists but is a directory not a file.
+  Returns NO_SUCH_PATH if the path does not exist in the hierarchy.
+  Returns MEMORY_ERROR if unable to copy a node shared by FT_copy.
+*/
+static int FT_doRmFile(char *path){
+    Node_T curr;
+    const char *rest;
+
+    FT_CHECK();
+    assert(path != NULL);
+
+    /* Invariant check. */
+    if (!isInitialized)
+        return INITIALIZATION_ERROR;
+
+    /* If no node exists at path or it is a directory node,
+    return NO_SUCH_PATH or NOT_A_FILE, respectively. */
+    curr = FT_findNode(root, path, TRUE, NULL, &rest);
+    if (curr == NULL)
+        return rest == NULL ? MEMORY_ERROR : NO_SUCH_PATH;
+    if (Node_getType(curr) == DIRECTORY)
+        return NOT_A_FILE;
+
+    /* Remove file. */
+    FT_removeNode(curr);
+
+    FT_CHECK();
+    return SUCCESS;
+}
+
 /*
   Returns the contents of the file at the full path parameter.
   Returns NULL if the path does not exist or is a directory.
@@ -581,30 +1651,20 @@ int FT_rmFile(char *path){
   Note: checking for a non-NULL return is not an appropriate
   contains check -- the contents of a file may be NULL.
 */
-void *FT_getFileContents(char *path){
+static void *FT_doGetFileContents(char *path){
     Node_T curr;
-    DynArray_T temp;
-    void* contents;
 
     assert(path != NULL);
 
     /* Invariant check. */
-    if (!FT_containsFile(path)){
+    if (!isInitialized)
         return NULL;
-    }
 
-    curr = FT_getFileNode(path);
-    if (curr == NULL) {
-        return NULL;
-    }
-    temp = Node_getFileContents(curr);
-    if (temp == NULL) {
+    curr = FT_findNode(root, path, FALSE, NULL, NULL);
+    if (curr == NULL || Node_getType(curr) != FT_FILE)
         return NULL;
-    }
-    /* A file's contents will always be stored at 
-    index 0 in the DynArray. */
-    contents = (void*) DynArray_get(temp, 0);
-    return contents;
+    /* Inline contents are read straight from the node. */
+    return (void*) Node_getContents(curr);
 }
 
 /*
@@ -612,23 +1672,101 @@ void *FT_getFileContents(char *path){
   the parameter newContents of size newLength.
   Returns the old contents if successful. (Note: contents may be NULL.)
   Returns NULL if the path does not already exist or is a directory.
+  Stores in *pStatus SUCCESS, or INITIALIZATION_ERROR, NO_SUCH_PATH,
+  MEMORY_ERROR or QUOTA_EXCEEDED for why the contents were not
+  replaced.
 */
-void *FT_replaceFileContents(char *path, void *newContents, size_t newLength) {
+static void *FT_doReplaceFileContents(char *path, void *newContents,
+                                      size_t newLength, int *pStatus) {
     void *oldContents; 
     Node_T queryNode;
+    const char *rest;
+    void *stored = NULL;
+    void *oldCopy = NULL;
+    boolean wasStored;
+    boolean toInline;
 
     assert(path != NULL);
+    assert(pStatus != NULL);
 
     /* Get File Node. */
-    queryNode = FT_getFileNode(path);
-    if (queryNode == NULL)
+    if (!isInitialized) {
+        *pStatus = INITIALIZATION_ERROR;
+        return NULL;
+    }
+    queryNode = FT_findNode(root, path, TRUE, NULL, &rest);
+    if (queryNode == NULL || Node_getType(queryNode) != FT_FILE) {
+        *pStatus = rest == NULL ? MEMORY_ERROR : NO_SUCH_PATH;
         return NULL;
+    }
+
+    /* Growing the file must not take any directory above it past its
+    byte quota. */
+    if (newLength > Node_getLength(queryNode)
+        && !Node_fitsQuotas(Node_getParent(queryNode), 0,
+                            newLength - Node_getLength(queryNode))) {
+        *pStatus = QUOTA_EXCEEDED;
+        return NULL;
+    }
+
+    /* Contents the tree owns stay inline if they fit the room the
+    file node was made with. */
+    toInline = (boolean)((contentStore || ownedContents)
+                         && newContents != NULL
+                         && Node_getRoom(queryNode) > 0
+                         && newLength <= Node_getRoom(queryNode));
+    if ((contentStore || ownedContents) && newContents != NULL
+        && !toInline) {
+        /* A copy for a file that grows must fit the memory budget. */
+        if (newLength > Node_getLength(queryNode)
+            && FT_exceedsBudget(Node_getStoreCost(newLength))) {
+            *pStatus = MEMORY_ERROR;
+            return NULL;
+        }
+        stored = Node_storeContents(newContents, newLength,
+                                    contentStore);
+        if (stored == NULL) {
+            *pStatus = MEMORY_ERROR;
+            return NULL;
+        }
+    }
+
+    /* Inline contents about to be overwritten are returned as a
+    counted copy, kept as stored ones are. */
+    if (Node_isInline(queryNode)) {
+        oldCopy = Node_storeContents(Node_getContents(queryNode),
+                                     Node_getLength(queryNode), FALSE);
+        if (oldCopy == NULL) {
+            if (stored != NULL)
+                Node_releaseContents(stored);
+            *pStatus = MEMORY_ERROR;
+            return NULL;
+        }
+    }
 
     /* Get File Nodes's DynArray, update its contents to newContents, and 
     store the old contents in local variable. */ 
-    oldContents = Node_updateFileContents(queryNode, newContents);
+    wasStored = Node_isStored(queryNode);
+    if (toInline)
+        oldContents = Node_updateInlineContents(queryNode, newContents,
+                                                newLength);
+    else if (stored != NULL)
+        oldContents = Node_updateStoredContents(queryNode, stored);
+    else
+        oldContents = Node_updateFileContents(queryNode, newContents);
+
+    /* Owned contents returned to the client are kept until the next
+    replacement, rather than freed or overwritten as the file lets go
+    of them. */
+    if (wasStored || oldCopy != NULL) {
+        if (replacedContents != NULL)
+            Node_releaseContents(replacedContents);
+        replacedContents = wasStored ? oldContents : oldCopy;
+        oldContents = replacedContents;
+    }
     Node_updateLength(queryNode, newLength);
 
+    *pStatus = SUCCESS;
     return oldContents;
 }
 
@@ -644,7 +1782,7 @@ void *FT_replaceFileContents(char *path, void *newContents, size_t newLength) {
 
   When returning a non-SUCCESS status, *type and *length are unchanged.
  */
-int FT_stat(char *path, boolean *type, size_t *length) {
+static int FT_doStat(char *path, boolean *type, size_t *length) {
     Node_T queryNode;
 
     assert(path != NULL);
@@ -655,16 +1793,14 @@ int FT_stat(char *path, boolean *type, size_t *length) {
     if (!isInitialized) {
         return INITIALIZATION_ERROR;
     }
-    if (FT_containsDir(path) == FALSE && FT_containsFile(path) == FALSE) {
+    queryNode = FT_findNode(root, path, FALSE, NULL, NULL);
+    if (queryNode == NULL) {
         return NO_SUCH_PATH;
     }
 
-    /* Verify type and length of content matches (if a file). */
-    /* IF A FILE, store type and file contents and return SUCCESS. */
-    if (FT_getFileNode(path) != NULL) {
-        queryNode = FT_getFileNode(path);
+    /* IF A FILE, store type and file length and return SUCCESS. */
+    if (Node_getType(queryNode) == FT_FILE) {
         *type = TRUE;
-        /* add 1 for the null char at the end */
         *length = Node_getLength(queryNode);
     }
     else {
@@ -674,73 +1810,3715 @@ int FT_stat(char *path, boolean *type, size_t *length) {
 }
 
 /*
-  Sets the data structure to initialized status.
-  The data structure is initially empty.
-  Returns INITIALIZATION_ERROR if already initialized,
-  and SUCCESS otherwise.
+  Stores in *pNodes the number of nodes beneath path and in *pBytes
+  the summed length of the files at or beneath it, both read from the
+  totals each node maintains rather than by visiting the subtree.
+  Returns SUCCESS if path exists in the hierarchy,
+  returns NO_SUCH_PATH if it does not, and
+  returns INITIALIZATION_ERROR if the structure is not initialized.
+  On a non-SUCCESS status, *pNodes and *pBytes are unchanged.
 */
-int FT_init(void) {
-    assert(CheckerFT_isValid(isInitialized,root,count));
-    if(isInitialized)
+static int FT_doDu(char *path, size_t *pNodes, size_t *pBytes) {
+    Node_T curr;
+
+    FT_CHECK();
+    assert(path != NULL);
+    assert(pNodes != NULL);
+    assert(pBytes != NULL);
+
+    if(!isInitialized)
         return INITIALIZATION_ERROR;
-    isInitialized = 1;
-    root = NULL;
-    count = 0;
-    assert(CheckerFT_isValid(isInitialized,root,count));
+
+    curr = FT_findNode(root, path, FALSE, NULL, NULL);
+    if(curr == NULL)
+        return NO_SUCH_PATH;
+
+    *pNodes = Node_getNumNodes(curr) - 1;
+    *pBytes = Node_getTotalLength(curr);
     return SUCCESS;
 }
 
 /*
-  Removes all contents of the data structure and
-  returns it to uninitialized status.
-  Returns INITIALIZATION_ERROR if not already initialized,
-  and SUCCESS otherwise.
+  Stores in *pHash the hash of the hierarchy at path, rehashing only
+  the nodes changed since it was last asked for.
+  Returns SUCCESS if path exists in the hierarchy,
+  returns NO_SUCH_PATH if it does not, and
+  returns INITIALIZATION_ERROR if the structure is not initialized.
+  On a non-SUCCESS status, *pHash is unchanged.
 */
-int FT_destroy(void) {
-    assert(CheckerFT_isValid(isInitialized,root,count));
+static int FT_doHash(char *path, size_t *pHash) {
+    Node_T curr;
+
+    FT_CHECK();
+    assert(path != NULL);
+    assert(pHash != NULL);
+
     if(!isInitialized)
         return INITIALIZATION_ERROR;
-    FT_rmPathAt(Node_getPath(root), root);
-    root = NULL;
-    isInitialized = 0;
-    assert(CheckerFT_isValid(isInitialized,root,count));
+
+    curr = FT_findNode(root, path, FALSE, NULL, NULL);
+    if(curr == NULL)
+        return NO_SUCH_PATH;
+
+    *pHash = Node_hash(curr);
     return SUCCESS;
 }
 
 /*
-  Returns a string representation of the
-  data structure, or NULL if the structure is
-  not initialized or there is an allocation error.
-
-  Allocates memory for the returned string,
-  which is then owned by client!
+  Limits the hierarchy beneath the directory path to maxNodes nodes
+  and maxBytes bytes of file contents; 0 leaves either unlimited.
+  Returns SUCCESS if the quota is set.
+  Returns INITIALIZATION_ERROR if not in an initialized state.
+  Returns NOT_A_DIRECTORY if path is a file.
+  Returns NO_SUCH_PATH if path does not exist in the hierarchy.
+  Returns MEMORY_ERROR if unable to copy a node shared by FT_copy.
 */
-char *FT_toString(void) {
-    DynArray_T nodes;
-    size_t totalStrlen = 1;
-    char* result = NULL;
+static int FT_doSetQuota(char *path, size_t maxNodes, size_t maxBytes) {
+    Node_T curr;
+    const char *rest;
 
-    assert(CheckerFT_isValid(isInitialized,root,count));
+    FT_CHECK();
+    assert(path != NULL);
 
     if(!isInitialized)
-        return NULL;
+        return INITIALIZATION_ERROR;
+
+    curr = FT_findNode(root, path, TRUE, NULL, &rest);
+    if(curr == NULL)
+        return rest == NULL ? MEMORY_ERROR : NO_SUCH_PATH;
+    if(Node_getType(curr) == FT_FILE)
+        return NOT_A_DIRECTORY;
+
+    Node_setQuota(curr, maxNodes, maxBytes);
+    return SUCCESS;
+}
+
+/*
+  Moves the node at oldPath, and the hierarchy beneath it, to newPath
+  by unlinking it from its parent, renaming it and linking it beneath
+  newPath's parent. No node beneath it is visited, since none stores
+  more than its own name.
+  Returns SUCCESS if the node is moved.
+  Returns INITIALIZATION_ERROR if not in an initialized state.
+  Returns NO_SUCH_PATH if oldPath or newPath's parent does not exist.
+  Returns CONFLICTING_PATH if oldPath is the root, newPath is not
+                           underneath the root, or newPath lies
+                           within oldPath.
+  Returns ALREADY_IN_TREE if newPath already exists.
+  Returns NOT_A_DIRECTORY if a proper prefix of newPath is a file.
+  Returns QUOTA_EXCEEDED if the node would take a directory above
+                         newPath past its quota.
+  Returns MEMORY_ERROR if unable to allocate the new name or to copy
+                      a node shared by FT_copy.
+  Returns PARENT_CHILD_ERROR if newPath's parent cannot link to it.
+  On a non-SUCCESS status the hierarchy is unchanged.
+*/
+static int FT_doMove(char *oldPath, char *newPath) {
+    Node_T curr;
+    Node_T oldParent;
+    Node_T newParent;
+    Node_T ancestor;
+    const char *rest;
+    char *name;
+    int result;
+
+    FT_CHECK();
+    assert(oldPath != NULL);
+    assert(newPath != NULL);
+
+    if(!isInitialized)
+        return INITIALIZATION_ERROR;
+
+    curr = FT_findNode(root, oldPath, TRUE, NULL, &rest);
+    if(curr == NULL)
+        return rest == NULL ? MEMORY_ERROR : NO_SUCH_PATH;
+    oldParent = Node_getParent(curr);
+    if(oldParent == NULL)
+        return CONFLICTING_PATH;
+
+    /* newPath must name a new child of an existing directory. */
+    if(FT_findNode(root, newPath, TRUE, &newParent, &rest) != NULL)
+        return ALREADY_IN_TREE;
+    if(rest == NULL)
+        return MEMORY_ERROR;
+    if(newParent == NULL)
+        return CONFLICTING_PATH;
+    if(Node_getType(newParent) == FT_FILE)
+        return NOT_A_DIRECTORY;
+    if(strchr(rest, '/') != NULL)
+        return NO_SUCH_PATH;
+
+    /* A directory cannot be moved beneath itself. */
+    for(ancestor = newParent; ancestor != NULL;
+        ancestor = Node_getParent(ancestor))
+        if(ancestor == curr)
+            return CONFLICTING_PATH;
+
+    name = malloc(strlen(rest) + 1);
+    if(name == NULL)
+        return MEMORY_ERROR;
+    strcpy(name, rest);
+
+    /* Unlink first, so that the quotas of directories above both
+    paths are checked without the moved nodes counted twice. Unlinking
+    never shrinks the old parent's children, so relinking it there
+    cannot fail. */
+    (void) Node_unlinkChild(oldParent, curr);
+    if(!Node_fitsQuotas(newParent, Node_getNumNodes(curr),
+                        Node_getTotalLength(curr))) {
+        (void) Node_linkChild(oldParent, curr);
+        free(name);
+        return QUOTA_EXCEEDED;
+    }
+
+    name = Node_setName(curr, name);
+    result = Node_linkChild(newParent, curr);
+    if(result != SUCCESS) {
+        name = Node_setName(curr, name);
+        (void) Node_linkChild(oldParent, curr);
+    }
+    free(name);
+
+    FT_CHECK();
+    return result;
+}
+
+/*
+  Copies the node at srcPath, and the hierarchy beneath it, to
+  dstPath without copying anything beneath it: the copy's top node
+  refers to the source's children, which both hierarchies then share
+  until either changes beneath them, when FT_findNode copies the
+  shared nodes along the way one at a time.
+  Returns SUCCESS if the hierarchy is copied.
+  Returns INITIALIZATION_ERROR if not in an initialized state.
+  Returns NO_SUCH_PATH if srcPath or dstPath's parent does not exist.
+  Returns CONFLICTING_PATH if srcPath is the root, dstPath is not
+                           underneath the root, or dstPath lies
+                           within srcPath.
+  Returns ALREADY_IN_TREE if dstPath already exists.
+  Returns NOT_A_DIRECTORY if a proper prefix of dstPath is a file.
+  Returns QUOTA_EXCEEDED if the copy would take a directory above
+                         dstPath past its quota.
+  Returns MEMORY_ERROR if unable to allocate the copy's top node.
+  Returns PARENT_CHILD_ERROR if dstPath's parent cannot link to it.
+  On a non-SUCCESS status the hierarchy is unchanged.
+*/
+static int FT_doCopy(char *srcPath, char *dstPath) {
+    Node_T src;
+    Node_T parent;
+    Node_T ancestor;
+    Node_T new;
+    const char *rest;
+    int result;
+
+    FT_CHECK();
+    assert(srcPath != NULL);
+    assert(dstPath != NULL);
+
+    if(!isInitialized)
+        return INITIALIZATION_ERROR;
+
+    /* dstPath must name a new child of an existing directory, which is
+    made private before the source is found, so that the source cannot
+    be one of the nodes that walk replaces. */
+    if(FT_findNode(root, dstPath, TRUE, &parent, &rest) != NULL)
+        return ALREADY_IN_TREE;
+    if(rest == NULL)
+        return MEMORY_ERROR;
+    src = FT_findNode(root, srcPath, FALSE, NULL, NULL);
+    if(src == NULL)
+        return NO_SUCH_PATH;
+    if(src == root || parent == NULL)
+        return CONFLICTING_PATH;
+    if(Node_getType(parent) == FT_FILE)
+        return NOT_A_DIRECTORY;
+    if(strchr(rest, '/') != NULL)
+        return NO_SUCH_PATH;
+
+    /* A directory cannot be copied beneath itself. */
+    for(ancestor = parent; ancestor != NULL;
+        ancestor = Node_getParent(ancestor))
+        if(ancestor == src)
+            return CONFLICTING_PATH;
+
+    if(!Node_fitsQuotas(parent, Node_getNumNodes(src),
+                        Node_getTotalLength(src)))
+        return QUOTA_EXCEEDED;
+    if(FT_exceedsBudget(Node_getCopyCost(parent, src, rest)))
+        return MEMORY_ERROR;
+
+    new = Node_copy(src, rest, parent);
+    if(new == NULL)
+        return MEMORY_ERROR;
+    result = Node_linkChild(parent, new);
+    if(result != SUCCESS) {
+        (void) Node_destroy(new);
+        return result;
+    }
+    count += Node_getNumNodes(new);
+
+    FT_CHECK();
+    return result;
+}
+
+/*
+  Sets the data structure to initialized status.
+  The data structure is initially empty.
+  Returns INITIALIZATION_ERROR if already initialized,
+  and SUCCESS otherwise.
+*/
+static int FT_doInit(void) {
+    FT_CHECK();
+    if(isInitialized)
+        return INITIALIZATION_ERROR;
+    isInitialized = 1;
+    root = NULL;
+    count = 0;
+    memoryBudget = 0;
+    destroyThreshold = 0;
+    asyncReclaim = FALSE;
+    contentStore = FALSE;
+    ownedContents = FALSE;
+    FT_CHECK();
+    return SUCCESS;
+}
+
+/* Frees pvBlock, one of the blocks in loadedContents. */
+static void FT_freeBlock(void *pvBlock, void *pvExtra) {
+    (void) pvExtra;
+    free(pvBlock);
+}
+
+/*
+  Removes all contents of the data structure and
+  returns it to uninitialized status.
+  Returns INITIALIZATION_ERROR if not already initialized,
+  and SUCCESS otherwise.
+*/
+static int FT_doDestroy(void) {
+    FT_CHECK();
+    if(!isInitialized)
+        return INITIALIZATION_ERROR;
+    FT_stopReclaimer();
+    asyncReclaim = FALSE;
+    if(replacedContents != NULL)
+        Node_releaseContents(replacedContents);
+    replacedContents = NULL;
+    if(root != NULL)
+        FT_removeNode(root);
+    root = NULL;
+    /* An unfinished transaction is dropped with the hierarchy. */
+    if(inTransaction && txRoot != NULL)
+        (void) FT_destroySubtree(txRoot);
+    inTransaction = FALSE;
+    (void) FT_doCloseLog();
+    if(loadedContents != NULL) {
+        DynArray_map(loadedContents, FT_freeBlock, NULL);
+        DynArray_free(loadedContents);
+        loadedContents = NULL;
+    }
+    isInitialized = 0;
+    FT_CHECK();
+    return SUCCESS;
+}
+
+/*
+   Returns the number of characters FT_toString writes for the subtree
+   rooted at n: its path and every descendant's, each with a newline.
+   n's path is its name following a path of prefixLength characters
+   and a '/', or just its name if prefixLength is 0.
+*/
+static size_t FT_subtreeStrlen(Node_T n, size_t prefixLength) {
+    size_t lineLength;
+    size_t length;
+    size_t c;
+
+    assert(n != NULL);
+
+    lineLength = strlen(Node_getName(n));
+    if(prefixLength > 0)
+        lineLength += prefixLength + 1;
+    length = lineLength + 1;
+    if(Node_getType(n) == DIRECTORY)
+        for(c = 0; c < Node_getNumChildren(n); c++)
+            length += FT_subtreeStrlen(Node_getChild(n, c), lineLength);
+    return length;
+}
+
+/*
+   Writes the FT_toString lines of the subtree rooted at n, in
+   pre-order, starting at dest, and returns the end of what it wrote.
+   n's path is built from the prefixLength characters at prefix, a
+   '/' and n's name (or just its name if prefixLength is 0), and each
+   line written then serves as the prefix of the children's paths, so
+   no path is ever rebuilt from the root. No terminating '\0' is
+   written.
+*/
+static char *FT_subtreeWrite(Node_T n, const char *prefix,
+                             size_t prefixLength, char *dest) {
+    const char *name;
+    char *line = dest;
+    size_t length;
+    size_t c;
+
+    assert(n != NULL);
+    assert(prefix != NULL || prefixLength == 0);
+    assert(dest != NULL);
+
+    if(prefixLength > 0) {
+        memcpy(dest, prefix, prefixLength);
+        dest[prefixLength] = '/';
+        dest += prefixLength + 1;
+    }
+    name = Node_getName(n);
+    length = strlen(name);
+    memcpy(dest, name, length);
+    dest[length] = '\n';
+    dest += length + 1;
+    length = (size_t)(dest - line) - 1;
+    if(Node_getType(n) == DIRECTORY)
+        for(c = 0; c < Node_getNumChildren(n); c++)
+            dest = FT_subtreeWrite(Node_getChild(n, c), line, length,
+                                   dest);
+    return dest;
+}
+
+/*
+   Returns the FT_toString representation of the hierarchy rooted at
+   top, which may be NULL for an empty one, or NULL if there is an
+   allocation error. The string is owned by the caller.
+*/
+static char *FT_treeToString(Node_T top) {
+    size_t totalStrlen = 0;
+    char* result;
+
+    /* Size the output first, then write each path once, built from
+    its parent's line, so the total work is linear in its length. */
+    if(top != NULL)
+        totalStrlen = FT_subtreeStrlen(top, 0);
+    result = malloc(totalStrlen + 1);
+    if(result == NULL)
+        return NULL;
+    if(top != NULL)
+        (void) FT_subtreeWrite(top, NULL, 0, result);
+    result[totalStrlen] = '\0';
+    return result;
+}
+
+/*
+  Returns a string representation of the
+  data structure, or NULL if the structure is
+  not initialized or there is an allocation error.
+
+  Allocates memory for the returned string,
+  which is then owned by client!
+*/
+static char *FT_doToString(void) {
+    char* result;
+
+    FT_CHECK();
+
+    if(!isInitialized)
+        return NULL;
+    result = FT_treeToString(root);
+
+    FT_CHECK();
+    return result;
+}
+
+/*--------------------------------------------------------------------*/
+/* Parallel serialization                                             */
+/*--------------------------------------------------------------------*/
+
+/* The work shared by FT_toStringParallel's workers. */
+struct FT_serializeWork {
+    /* FALSE while sizing the root's subtrees, TRUE while writing them */
+    boolean writing;
+    /* the number of the root's subtrees, and the next one for a worker
+       to claim, taken atomically */
+    size_t numGroups;
+    size_t nextGroup;
+    /* the length of each subtree's output, and where it starts in the
+       result */
+    size_t *sizes;
+    char **starts;
+    /* the root's line, which prefixes every subtree's paths, and its
+       length without the newline */
+    const char *rootLine;
+    size_t rootLength;
+};
+
+/* One of FT_toStringParallel's workers. */
+struct FT_serializeWorker {
+    /* the work shared by all workers */
+    struct FT_serializeWork *work;
+};
+
+/*
+   Runs the FT_toStringParallel worker pvWorker: claims subtrees of
+   the root until none are left, sizing or writing each.
+*/
+static void *FT_serializeWorker(void *pvWorker) {
+    struct FT_serializeWork *work =
+        ((struct FT_serializeWorker *)pvWorker)->work;
+    size_t g;
 
-    nodes = DynArray_new(count);
-    (void) FT_preOrderTraversal(root, nodes, 0);
+    for(;;) {
+        g = __sync_fetch_and_add(&work->nextGroup, 1);
+        if(g >= work->numGroups)
+            break;
+        if(work->writing)
+            (void) FT_subtreeWrite(Node_getChild(root, g),
+                                   work->rootLine, work->rootLength,
+                                   work->starts[g]);
+        else
+            work->sizes[g] = FT_subtreeStrlen(Node_getChild(root, g),
+                                              work->rootLength);
+    }
+    return NULL;
+}
+
+/*
+   Returns the string FT_toString would return, built by numThreads
+   threads (0 for one per online processor): the output length of each
+   subtree beneath the root is computed in parallel, their offsets are
+   found by a prefix sum, and the subtrees are then written in parallel
+   into their disjoint regions of the one result.
+   Returns NULL if not in an initialized state or if there is an
+   allocation error.
+*/
+static char *FT_doToStringParallel(size_t numThreads) {
+    struct FT_serializeWork work;
+    struct FT_serializeWorker *workers;
+    const char *rootName;
+    size_t numWorkers;
+    size_t total;
+    size_t g;
+    char *result;
+
+    FT_CHECK();
 
-    DynArray_map(nodes, (void (*)(void *, void*)) FT_strlenAccumulate, (void*) &totalStrlen);
+    if(!isInitialized)
+        return NULL;
+    if(root == NULL)
+        return calloc(1, 1);
 
-    result = malloc(totalStrlen);
-    if(result == NULL) {
-        DynArray_free(nodes);
-        assert(CheckerFT_isValid(isInitialized,root,count));
+    memset(&work, 0, sizeof(work));
+    rootName = Node_getName(root);
+    work.rootLength = strlen(rootName);
+    work.numGroups = Node_getNumChildren(root);
+    numThreads = FT_defaultThreads(numThreads);
+    numWorkers = numThreads < work.numGroups ? numThreads
+        : work.numGroups;
+    work.sizes = calloc(work.numGroups + 1, sizeof(size_t));
+    work.starts = calloc(work.numGroups + 1, sizeof(char *));
+    workers = calloc(numWorkers + 1, sizeof(struct FT_serializeWorker));
+    if(work.sizes == NULL || work.starts == NULL || workers == NULL) {
+        free(work.sizes);
+        free(work.starts);
+        free(workers);
         return NULL;
     }
-    *result = '\0';
+    for(g = 0; g < numWorkers; g++)
+        workers[g].work = &work;
+
+    /* Size every subtree in parallel. */
+    FT_runTasks(FT_serializeWorker, workers,
+                sizeof(struct FT_serializeWorker), numWorkers);
+
+    total = work.rootLength + 1;
+    for(g = 0; g < work.numGroups; g++)
+        total += work.sizes[g];
+    result = malloc(total + 1);
 
-    DynArray_map(nodes, (void (*)(void *, void*)) FT_strcatAccumulate, (void *) result);
+    if(result != NULL) {
+        /* The root's line comes first, then each subtree's output at
+        the prefix sum of the sizes before it. */
+        memcpy(result, rootName, work.rootLength);
+        result[work.rootLength] = '\n';
+        result[total] = '\0';
+        work.rootLine = result;
+        work.starts[0] = result + work.rootLength + 1;
+        for(g = 1; g < work.numGroups; g++)
+            work.starts[g] = work.starts[g - 1] + work.sizes[g - 1];
 
-    DynArray_free(nodes);
-    assert(CheckerFT_isValid(isInitialized,root,count));
+        work.writing = TRUE;
+        work.nextGroup = 0;
+        FT_runTasks(FT_serializeWorker, workers,
+                    sizeof(struct FT_serializeWorker), numWorkers);
+    }
+
+    free(workers);
+    free(work.sizes);
+    free(work.starts);
+    FT_CHECK();
     return result;
 }
+
+/*
+  Stores in *pUsage the bytes currently held by the tree's nodes,
+  names, child arrays and file bookkeeping, together with its
+  node and file counts. Takes constant time.
+  Returns INITIALIZATION_ERROR if not in an initialized state,
+  and SUCCESS otherwise.
+*/
+int FT_memoryUsage(struct MemoryUsage *pUsage) {
+    assert(pUsage != NULL);
+
+    if(!isInitialized)
+        return INITIALIZATION_ERROR;
+
+    /* The node module keeps these totals up to date on every
+    allocation, resize and free, so no walk is needed; only what the
+    reclaimer has freed since the last call is still to be added. */
+    FT_foldReclaimed();
+    Node_getMemoryUsage(pUsage);
+    return SUCCESS;
+}
+
+/*
+  Limits the bytes held by the tree's nodes, as reported by
+  FT_memoryUsage, to maxBytes; 0 removes the limit. Inserts that would
+  exceed the limit fail with MEMORY_ERROR before allocating anything.
+  The limit lasts until FT_destroy.
+  Returns INITIALIZATION_ERROR if not in an initialized state,
+  and SUCCESS otherwise.
+*/
+int FT_setMemoryBudget(size_t maxBytes) {
+    if(!isInitialized)
+        return INITIALIZATION_ERROR;
+
+    memoryBudget = maxBytes;
+    return SUCCESS;
+}
+
+/*--------------------------------------------------------------------*/
+/* Parallel destruction                                               */
+/*--------------------------------------------------------------------*/
+
+/*
+   Destroys the unlinked subtree rooted at n and returns its exact node
+   count. Subtrees of more than destroyThreshold nodes are freed by
+   destroyThreads work-stealing threads; the threshold is checked with
+   a walk that stops as soon as it is passed, so small subtrees cost
+   no more than before.
+*/
+static size_t FT_destroySubtree(Node_T n) {
+    assert(n != NULL);
+
+    if(destroyThreshold != 0
+       && Node_countUpTo(n, destroyThreshold + 1) > destroyThreshold)
+        return Node_destroyParallel(n, FT_defaultThreads(destroyThreads));
+    return Node_destroy(n);
+}
+
+/*
+  Makes FT_rmDir and FT_destroy free any subtree of more than threshold
+  nodes on numThreads threads (0 for one per online processor);
+  threshold 0 frees every subtree on the calling thread. The setting
+  lasts until FT_destroy.
+  Returns INITIALIZATION_ERROR if not in an initialized state,
+  and SUCCESS otherwise.
+*/
+int FT_setParallelDestroy(size_t threshold, size_t numThreads) {
+    if(!isInitialized)
+        return INITIALIZATION_ERROR;
+    destroyThreshold = threshold;
+    destroyThreads = numThreads;
+    return SUCCESS;
+}
+
+/*--------------------------------------------------------------------*/
+/* Deferred reclamation                                               */
+/*--------------------------------------------------------------------*/
+
+/* guards every reclaim* variable below */
+static pthread_mutex_t reclaimLock = PTHREAD_MUTEX_INITIALIZER;
+/* signalled when a subtree is queued, when one has been freed, and
+   when the reclaimer is asked to stop */
+static pthread_cond_t reclaimCond = PTHREAD_COND_INITIALIZER;
+/* the subtrees waiting for the reclaimer */
+static DynArray_T reclaimQueue;
+/* the number of subtrees queued or being freed */
+static size_t reclaimPending;
+/* the memory totals of what the reclaimer has freed since they were
+   last folded into the shared totals */
+static struct MemoryUsage reclaimed;
+/* TRUE while the reclaimer thread exists, and TRUE once it has been
+   asked to exit after draining its queue */
+static boolean reclaimRunning;
+static boolean reclaimStop;
+/* the reclaimer thread */
+static pthread_t reclaimer;
+
+/*
+   Runs the reclaimer thread: frees each queued subtree, with its
+   memory accounted privately and added to reclaimed once the subtree
+   is gone, until asked to stop with nothing left queued.
+*/
+static void *FT_reclaimWork(void *pvUnused) {
+    struct MemoryUsage freed;
+    Node_T n;
+
+    (void) pvUnused;
+
+    Node_setAccounting(&freed);
+    (void) pthread_mutex_lock(&reclaimLock);
+    for(;;) {
+        while(DynArray_getLength(reclaimQueue) == 0 && !reclaimStop)
+            (void) pthread_cond_wait(&reclaimCond, &reclaimLock);
+        if(DynArray_getLength(reclaimQueue) == 0)
+            break;
+        n = DynArray_removeAt(reclaimQueue,
+                              DynArray_getLength(reclaimQueue) - 1);
+        (void) pthread_mutex_unlock(&reclaimLock);
+
+        memset(&freed, 0, sizeof(freed));
+        (void) Node_destroy(n);
+
+        (void) pthread_mutex_lock(&reclaimLock);
+        Node_setAccounting(&reclaimed);
+        Node_mergeAccounting(&freed);
+        Node_setAccounting(&freed);
+        reclaimPending--;
+        (void) pthread_cond_broadcast(&reclaimCond);
+    }
+    (void) pthread_mutex_unlock(&reclaimLock);
+    Node_setAccounting(NULL);
+    return NULL;
+}
+
+/*
+   Queues the unlinked subtree rooted at n to be freed by the
+   reclaimer thread, starting the thread if need be. Returns FALSE,
+   leaving n to the caller, if the thread or the queue cannot be set
+   up.
+*/
+static boolean FT_reclaimLater(Node_T n) {
+    boolean queued = FALSE;
+
+    assert(n != NULL);
+
+    (void) pthread_mutex_lock(&reclaimLock);
+    if(reclaimQueue == NULL)
+        reclaimQueue = DynArray_new(0);
+    if(reclaimQueue != NULL && !reclaimRunning)
+        reclaimRunning = (boolean)(pthread_create(&reclaimer, NULL,
+            FT_reclaimWork, NULL) == 0);
+    if(reclaimRunning && DynArray_add(reclaimQueue, n)) {
+        reclaimPending++;
+        queued = TRUE;
+        (void) pthread_cond_broadcast(&reclaimCond);
+    }
+    (void) pthread_mutex_unlock(&reclaimLock);
+    return queued;
+}
+
+/*
+   Adds what the reclaimer has freed so far to the shared memory
+   totals, so that FT_memoryUsage and the memory budget see it.
+*/
+static void FT_foldReclaimed(void) {
+    (void) pthread_mutex_lock(&reclaimLock);
+    Node_mergeAccounting(&reclaimed);
+    memset(&reclaimed, 0, sizeof(reclaimed));
+    (void) pthread_mutex_unlock(&reclaimLock);
+}
+
+/* Waits until every queued subtree has been freed. */
+static void FT_waitReclaimed(void) {
+    (void) pthread_mutex_lock(&reclaimLock);
+    while(reclaimPending > 0)
+        (void) pthread_cond_wait(&reclaimCond, &reclaimLock);
+    (void) pthread_mutex_unlock(&reclaimLock);
+    FT_foldReclaimed();
+}
+
+/*
+   Waits for the reclaimer to free everything queued, then ends the
+   thread and releases its queue.
+*/
+static void FT_stopReclaimer(void) {
+    (void) pthread_mutex_lock(&reclaimLock);
+    if(!reclaimRunning) {
+        (void) pthread_mutex_unlock(&reclaimLock);
+        return;
+    }
+    reclaimStop = TRUE;
+    (void) pthread_cond_broadcast(&reclaimCond);
+    (void) pthread_mutex_unlock(&reclaimLock);
+
+    (void) pthread_join(reclaimer, NULL);
+
+    (void) pthread_mutex_lock(&reclaimLock);
+    reclaimRunning = FALSE;
+    reclaimStop = FALSE;
+    DynArray_free(reclaimQueue);
+    reclaimQueue = NULL;
+    (void) pthread_mutex_unlock(&reclaimLock);
+    FT_foldReclaimed();
+}
+
+/*
+  Makes FT_rmDir, if enable is TRUE, unlink the removed subtree and
+  return at once, leaving a background thread to free it; if enable
+  is FALSE, subtrees are freed before FT_rmDir returns again. The
+  setting lasts until FT_destroy.
+  Returns INITIALIZATION_ERROR if not in an initialized state,
+  and SUCCESS otherwise.
+*/
+int FT_setAsyncReclaim(boolean enable) {
+    if(!isInitialized)
+        return INITIALIZATION_ERROR;
+    asyncReclaim = enable;
+    return SUCCESS;
+}
+
+/*
+  Makes the calls that insert files or replace their contents, if
+  enable is TRUE, copy contents into the content store, where files
+  with equal contents share one copy, instead of keeping the client's
+  pointer. The setting lasts until FT_destroy.
+  Returns INITIALIZATION_ERROR if not in an initialized state,
+  and SUCCESS otherwise.
+*/
+int FT_setContentStore(boolean enable) {
+    if(!isInitialized)
+        return INITIALIZATION_ERROR;
+    contentStore = enable;
+    return SUCCESS;
+}
+
+/*
+  Makes the calls that insert files or replace their contents, if
+  enable is TRUE, copy contents into storage the tree owns, one copy
+  per file, instead of keeping the client's pointer. The setting lasts
+  until FT_destroy.
+  Returns INITIALIZATION_ERROR if not in an initialized state,
+  and SUCCESS otherwise.
+*/
+int FT_setOwnedContents(boolean enable) {
+    if(!isInitialized)
+        return INITIALIZATION_ERROR;
+    ownedContents = enable;
+    return SUCCESS;
+}
+
+/*
+  Waits until every subtree handed to the background thread has been
+  freed and its memory is reflected in FT_memoryUsage.
+  Returns INITIALIZATION_ERROR if not in an initialized state,
+  and SUCCESS otherwise.
+*/
+int FT_flushReclaim(void) {
+    if(!isInitialized)
+        return INITIALIZATION_ERROR;
+    FT_waitReclaimed();
+    return SUCCESS;
+}
+
+/*--------------------------------------------------------------------*/
+/* Snapshots                                                          */
+/*--------------------------------------------------------------------*/
+
+/* A read-only view of the hierarchy as it was at one point in time. */
+struct FT_Snapshot {
+    /* the root of the hierarchy when the snapshot was taken, shared
+       with it until the hierarchy changes, or NULL if it was empty */
+    Node_T root;
+};
+
+/*
+  Returns a new snapshot of the hierarchy, or NULL if not in an
+  initialized state or if there is an allocation error. Only a
+  reference to the root is taken; each later change copies the nodes
+  on its own path the first time it reaches them (see FT_findNode).
+*/
+static FT_Snapshot_T FT_doSnapshot(void) {
+    FT_Snapshot_T snapshot;
+
+    FT_CHECK();
+
+    if(!isInitialized)
+        return NULL;
+    snapshot = malloc(sizeof(struct FT_Snapshot));
+    if(snapshot == NULL)
+        return NULL;
+    snapshot->root = root == NULL ? NULL : Node_retain(root);
+    return snapshot;
+}
+
+/*
+  Returns TRUE if snapshot contains path as a directory and FALSE
+  otherwise.
+*/
+boolean FT_snapshotContainsDir(FT_Snapshot_T snapshot, char *path) {
+    Node_T curr;
+
+    assert(snapshot != NULL);
+    assert(path != NULL);
+
+    curr = FT_findNode(snapshot->root, path, FALSE, NULL, NULL);
+    return (boolean)(curr != NULL && Node_getType(curr) == DIRECTORY);
+}
+
+/*
+  Returns TRUE if snapshot contains path as a file and FALSE
+  otherwise.
+*/
+boolean FT_snapshotContainsFile(FT_Snapshot_T snapshot, char *path) {
+    Node_T curr;
+
+    assert(snapshot != NULL);
+    assert(path != NULL);
+
+    curr = FT_findNode(snapshot->root, path, FALSE, NULL, NULL);
+    return (boolean)(curr != NULL && Node_getType(curr) == FT_FILE);
+}
+
+/*
+  Returns the contents the file at path had in snapshot, or NULL if
+  the path does not exist there or is a directory.
+*/
+void *FT_snapshotGetFileContents(FT_Snapshot_T snapshot, char *path) {
+    Node_T curr;
+
+    assert(snapshot != NULL);
+    assert(path != NULL);
+
+    curr = FT_findNode(snapshot->root, path, FALSE, NULL, NULL);
+    if(curr == NULL || Node_getType(curr) != FT_FILE)
+        return NULL;
+    return (void*) Node_getContents(curr);
+}
+
+/*
+  As FT_stat, but for path in snapshot: returns SUCCESS, setting *type
+  and (for a file) *length, if path exists there, and NO_SUCH_PATH,
+  leaving them unchanged, if it does not.
+*/
+int FT_snapshotStat(FT_Snapshot_T snapshot, char *path, boolean *type,
+                    size_t *length) {
+    Node_T curr;
+
+    assert(snapshot != NULL);
+    assert(path != NULL);
+    assert(type != NULL);
+    assert(length != NULL);
+
+    curr = FT_findNode(snapshot->root, path, FALSE, NULL, NULL);
+    if(curr == NULL)
+        return NO_SUCH_PATH;
+    if(Node_getType(curr) == FT_FILE) {
+        *type = TRUE;
+        *length = Node_getLength(curr);
+    }
+    else
+        *type = FALSE;
+    return SUCCESS;
+}
+
+/*
+  Returns the string FT_toString returned when snapshot was taken, or
+  NULL if there is an allocation error. The string is owned by the
+  client.
+*/
+char *FT_snapshotToString(FT_Snapshot_T snapshot) {
+    assert(snapshot != NULL);
+
+    return FT_treeToString(snapshot->root);
+}
+
+/*
+  Frees snapshot, and any nodes that only it still referred to.
+*/
+void FT_freeSnapshot(FT_Snapshot_T snapshot) {
+    assert(snapshot != NULL);
+
+    if(snapshot->root != NULL)
+        (void) Node_destroy(snapshot->root);
+    free(snapshot);
+}
+
+/*--------------------------------------------------------------------*/
+/* Transactions                                                       */
+/*--------------------------------------------------------------------*/
+
+/*
+  Starts a transaction by keeping a reference to the current root,
+  as FT_snapshot does, so that the hierarchy can be put back as it is
+  now in constant time.
+  Returns SUCCESS if the transaction is started.
+  Returns INITIALIZATION_ERROR if not in an initialized state or if a
+  transaction is already in progress.
+*/
+static int FT_doBegin(void) {
+    FT_CHECK();
+
+    if(!isInitialized || inTransaction)
+        return INITIALIZATION_ERROR;
+    txRoot = root == NULL ? NULL : Node_retain(root);
+    txCount = count;
+    txStatus = SUCCESS;
+    inTransaction = TRUE;
+    return SUCCESS;
+}
+
+/*
+  Ends the transaction in progress by putting back the hierarchy it
+  started from: only the nodes the transaction copied or created are
+  freed, since every other node is still shared with txRoot.
+*/
+static void FT_rollback(void) {
+    assert(inTransaction);
+
+    if(root != NULL)
+        (void) FT_destroySubtree(root);
+    root = txRoot;
+    count = txCount;
+    txRoot = NULL;
+    inTransaction = FALSE;
+    FT_walEndTransaction(FALSE);
+}
+
+/*
+  Ends the transaction in progress, keeping its changes if every call
+  in it succeeded and otherwise rolling them all back. The hierarchy
+  is validated once, here, rather than on every call in the
+  transaction.
+  Returns SUCCESS if the changes are kept.
+  Returns INITIALIZATION_ERROR if not in an initialized state or if no
+  transaction is in progress.
+  Otherwise returns the status of the first call in the transaction
+  that failed.
+*/
+static int FT_doCommit(void) {
+    int result;
+
+    if(!isInitialized || !inTransaction)
+        return INITIALIZATION_ERROR;
+    result = txStatus;
+    if(result != SUCCESS)
+        FT_rollback();
+    else {
+        if(txRoot != NULL)
+            (void) FT_destroySubtree(txRoot);
+        txRoot = NULL;
+        inTransaction = FALSE;
+        FT_walEndTransaction(TRUE);
+    }
+    FT_CHECK();
+    return result;
+}
+
+/*
+  Ends the transaction in progress, rolling back all of its changes.
+  Returns SUCCESS if the changes are rolled back.
+  Returns INITIALIZATION_ERROR if not in an initialized state or if no
+  transaction is in progress.
+*/
+static int FT_doAbort(void) {
+    if(!isInitialized || !inTransaction)
+        return INITIALIZATION_ERROR;
+    FT_rollback();
+    FT_CHECK();
+    return SUCCESS;
+}
+
+/*--------------------------------------------------------------------*/
+/* Saving and loading                                                 */
+/*--------------------------------------------------------------------*/
+
+/*
+   The format written by FT_save, every size an 8-byte little-endian
+   unsigned integer:
+     header:   the 8 bytes of FT_SAVE_MAGIC, the number of nodes, the
+               bytes of the name table and the bytes of file contents
+     names:    each node's name and its '\0', in pre-order
+     records:  for each node, in pre-order, its type and whether it
+               has non-NULL contents (a byte each), then its number of
+               children, its length and its two quota limits
+     contents: each file's length bytes of non-NULL contents, in
+               pre-order
+*/
+#define FT_SAVE_MAGIC "FTSAVE1"
+enum { FT_SAVE_SIZE = 8, FT_SAVE_RECORD = 2 + 4 * FT_SAVE_SIZE,
+       FT_IO_BUFFER = 65536 };
+
+/* A buffered writer of an FT_save stream. */
+struct FT_writer {
+    int fd;
+    /* TRUE once a write has failed, after which nothing is written */
+    boolean failed;
+    /* the number of bytes appended to the stream so far */
+    size_t total;
+    size_t used;
+    unsigned char buffer[FT_IO_BUFFER];
+};
+
+/* A buffered reader of an FT_save stream. */
+struct FT_reader {
+    int fd;
+    /* the unread bytes are buffer[pos..end) */
+    size_t pos;
+    size_t end;
+    unsigned char buffer[FT_IO_BUFFER];
+};
+
+/*
+   Writes the first length bytes of buffer to fd, retrying partial
+   and interrupted writes. Returns FALSE if a write fails.
+*/
+static boolean FT_writeAll(int fd, const unsigned char *buffer,
+                           size_t length) {
+    ssize_t written;
+
+    while(length > 0) {
+        written = write(fd, buffer, length);
+        if(written < 0) {
+            if(errno == EINTR)
+                continue;
+            return FALSE;
+        }
+        buffer += written;
+        length -= (size_t)written;
+    }
+    return TRUE;
+}
+
+/* Writes what writer has buffered, unless a write has failed. */
+static void FT_flushWriter(struct FT_writer *writer) {
+    if(!writer->failed
+       && !FT_writeAll(writer->fd, writer->buffer, writer->used))
+        writer->failed = TRUE;
+    writer->used = 0;
+}
+
+/* Appends the length bytes at pvBytes to writer's stream. */
+static void FT_writeBytes(struct FT_writer *writer, const void *pvBytes,
+                          size_t length) {
+    const unsigned char *bytes = pvBytes;
+    size_t chunk;
+
+    while(length > 0) {
+        if(writer->used == FT_IO_BUFFER)
+            FT_flushWriter(writer);
+        chunk = FT_IO_BUFFER - writer->used;
+        if(chunk > length)
+            chunk = length;
+        memcpy(writer->buffer + writer->used, bytes, chunk);
+        writer->used += chunk;
+        writer->total += chunk;
+        bytes += chunk;
+        length -= chunk;
+    }
+}
+
+/* Stores size in the FT_SAVE_SIZE bytes at bytes, least significant
+   first. */
+static void FT_encodeSize(unsigned char *bytes, size_t size) {
+    size_t i;
+
+    for(i = 0; i < FT_SAVE_SIZE; i++) {
+        bytes[i] = (unsigned char)(size & 0xff);
+        size = (size >> 4) >> 4;
+    }
+}
+
+/* Appends size to writer's stream as FT_SAVE_SIZE bytes. */
+static void FT_writeSize(struct FT_writer *writer, size_t size) {
+    unsigned char bytes[FT_SAVE_SIZE];
+
+    FT_encodeSize(bytes, size);
+    FT_writeBytes(writer, bytes, FT_SAVE_SIZE);
+}
+
+/*
+   Copies the next length bytes of reader's stream to pvBytes, or
+   discards them if pvBytes is NULL. Returns FALSE if the stream ends
+   first or a read fails.
+*/
+static boolean FT_readBytes(struct FT_reader *reader, void *pvBytes,
+                            size_t length) {
+    unsigned char *bytes = pvBytes;
+    ssize_t got;
+    size_t chunk;
+
+    while(length > 0) {
+        if(reader->pos == reader->end) {
+            got = read(reader->fd, reader->buffer, FT_IO_BUFFER);
+            if(got < 0 && errno == EINTR)
+                continue;
+            if(got <= 0)
+                return FALSE;
+            reader->pos = 0;
+            reader->end = (size_t)got;
+        }
+        chunk = reader->end - reader->pos;
+        if(chunk > length)
+            chunk = length;
+        if(bytes != NULL) {
+            memcpy(bytes, reader->buffer + reader->pos, chunk);
+            bytes += chunk;
+        }
+        reader->pos += chunk;
+        length -= chunk;
+    }
+    return TRUE;
+}
+
+/*
+   Returns the size stored in the FT_SAVE_SIZE bytes at bytes by
+   FT_encodeSize, or (size_t)-1 if it does not fit in a size_t.
+*/
+static size_t FT_decodeSize(const unsigned char *bytes) {
+    size_t size = 0;
+    size_t i;
+
+    for(i = FT_SAVE_SIZE; i > 0; i--) {
+        if(((size << 4) << 4) >> 8 != size)
+            return (size_t)-1;
+        size = ((size << 4) << 4) | bytes[i - 1];
+    }
+    return size;
+}
+
+/*
+   Reads the next FT_SAVE_SIZE bytes of reader's stream into *pSize.
+   Returns FALSE if they cannot be read or do not fit in a size_t.
+*/
+static boolean FT_readSize(struct FT_reader *reader, size_t *pSize) {
+    unsigned char bytes[FT_SAVE_SIZE];
+
+    if(!FT_readBytes(reader, bytes, FT_SAVE_SIZE))
+        return FALSE;
+    *pSize = FT_decodeSize(bytes);
+    return (boolean)(*pSize != (size_t)-1);
+}
+
+/*
+   Returns the contents of the file n, or NULL if they are NULL or were
+   never set.
+*/
+static void *FT_contentsOf(Node_T n) {
+    return (void *) Node_getContents(n);
+}
+
+/*
+   Adds the bytes of the names and of the non-NULL file contents in the
+   hierarchy rooted at n to *pNameBytes and *pContentBytes.
+*/
+static void FT_saveSizes(Node_T n, size_t *pNameBytes,
+                         size_t *pContentBytes) {
+    size_t c;
+
+    *pNameBytes += strlen(Node_getName(n)) + 1;
+    if(Node_getType(n) == FT_FILE) {
+        if(FT_contentsOf(n) != NULL)
+            *pContentBytes += Node_getLength(n);
+        return;
+    }
+    for(c = 0; c < Node_getNumChildren(n); c++)
+        FT_saveSizes(Node_getChild(n, c), pNameBytes, pContentBytes);
+}
+
+/*
+   Writes the part of the FT_save stream given by part -- 0 for the
+   names, 1 for the records, 2 for the contents -- for the hierarchy
+   rooted at n, in pre-order.
+*/
+static void FT_saveNodes(struct FT_writer *writer, Node_T n, int part) {
+    const char *name;
+    unsigned char flags[2];
+    size_t maxNodes = 0;
+    size_t maxLength = 0;
+    size_t numChildren = 0;
+    size_t c;
+
+    if(Node_getType(n) == DIRECTORY) {
+        numChildren = Node_getNumChildren(n);
+        Node_getQuota(n, &maxNodes, &maxLength);
+    }
+    if(part == 0) {
+        name = Node_getName(n);
+        FT_writeBytes(writer, name, strlen(name) + 1);
+    }
+    else if(part == 1) {
+        flags[0] = (unsigned char) Node_getType(n);
+        flags[1] = (unsigned char)(Node_getType(n) == FT_FILE
+                                   && FT_contentsOf(n) != NULL);
+        FT_writeBytes(writer, flags, sizeof(flags));
+        FT_writeSize(writer, numChildren);
+        FT_writeSize(writer, Node_getType(n) == FT_FILE
+                     ? Node_getLength(n) : 0);
+        FT_writeSize(writer, maxNodes);
+        FT_writeSize(writer, maxLength);
+    }
+    else if(Node_getType(n) == FT_FILE && FT_contentsOf(n) != NULL)
+        FT_writeBytes(writer, FT_contentsOf(n), Node_getLength(n));
+    for(c = 0; c < numChildren; c++)
+        FT_saveNodes(writer, Node_getChild(n, c), part);
+}
+
+/*
+  Writes the hierarchy, with every file's contents and length and
+  every directory's quota, to fd in the format described above.
+  Returns SUCCESS if the whole hierarchy is written.
+  Returns INITIALIZATION_ERROR if not in an initialized state.
+  Returns MEMORY_ERROR if unable to allocate the write buffer.
+  Returns IO_ERROR if a write fails.
+*/
+static int FT_doSave(int fd) {
+    struct FT_writer *writer;
+    size_t nameBytes = 0;
+    size_t contentBytes = 0;
+    int part;
+    int result;
+
+    FT_CHECK();
+
+    if(!isInitialized)
+        return INITIALIZATION_ERROR;
+    writer = malloc(sizeof(struct FT_writer));
+    if(writer == NULL)
+        return MEMORY_ERROR;
+    writer->fd = fd;
+    writer->failed = FALSE;
+    writer->total = 0;
+    writer->used = 0;
+
+    if(root != NULL)
+        FT_saveSizes(root, &nameBytes, &contentBytes);
+    FT_writeBytes(writer, FT_SAVE_MAGIC, FT_SAVE_SIZE);
+    FT_writeSize(writer, count);
+    FT_writeSize(writer, nameBytes);
+    FT_writeSize(writer, contentBytes);
+    for(part = 0; part < 3 && root != NULL; part++)
+        FT_saveNodes(writer, root, part);
+    FT_flushWriter(writer);
+
+    result = writer->failed ? IO_ERROR : SUCCESS;
+    free(writer);
+    return result;
+}
+
+/* One directory being loaded, with the children still to come. */
+struct FT_loadFrame {
+    Node_T node;
+    size_t remaining;
+};
+
+/*
+   Reads numNodes node records from reader and builds the hierarchy
+   they describe in a single pass, naming the nodes from names (of
+   nameBytes bytes) and pointing file contents into arena (of
+   contentBytes bytes, to be filled in afterwards). Each node is
+   linked to its parent once its own subtree is complete, appended
+   after the siblings before it, so that no path is resolved, no
+   children are searched and no size update goes past the parent.
+   Stores the root in *pRoot and returns SUCCESS, or frees whatever it
+   built and returns MEMORY_ERROR or IO_ERROR.
+*/
+static int FT_loadNodes(struct FT_reader *reader, size_t numNodes,
+                        const char *names, size_t nameBytes,
+                        char *arena, size_t contentBytes,
+                        Node_T *pRoot) {
+    struct FT_loadFrame *stack = NULL;
+    struct FT_loadFrame *newStack;
+    size_t depth = 0;
+    size_t capacity = 0;
+    size_t namePos = 0;
+    size_t contentPos = 0;
+    size_t fields[4];
+    unsigned char flags[2];
+    const char *name;
+    Node_T n = NULL;
+    Node_T parent;
+    Node_T last;
+    size_t numChildren;
+    size_t i;
+    size_t f;
+    int result = SUCCESS;
+
+    for(i = 0; i < numNodes && result == SUCCESS; i++) {
+        /* Only the root may come when no directory awaits children. */
+        if(i > 0 && depth == 0) {
+            result = IO_ERROR;
+            break;
+        }
+        if(!FT_readBytes(reader, flags, sizeof(flags))) {
+            result = IO_ERROR;
+            break;
+        }
+        for(f = 0; f < 4 && result == SUCCESS; f++)
+            if(!FT_readSize(reader, &fields[f]))
+                result = IO_ERROR;
+        if(result != SUCCESS || flags[0] > FT_FILE || flags[1] > 1
+           || namePos >= nameBytes)
+            break;
+        name = names + namePos;
+        namePos += strlen(name) + 1;
+        if(*name == '\0' || strchr(name, '/') != NULL) {
+            result = IO_ERROR;
+            break;
+        }
+
+        parent = depth == 0 ? NULL : stack[depth - 1].node;
+        n = Node_create(name, parent, (nodeType) flags[0]);
+        if(n == NULL) {
+            result = MEMORY_ERROR;
+            break;
+        }
+        numChildren = 0;
+        if(flags[0] == FT_FILE) {
+            if(fields[0] != 0
+               || (flags[1] && fields[1] > contentBytes - contentPos)) {
+                result = IO_ERROR;
+                break;
+            }
+            (void) Node_updateFileContents(n, flags[1]
+                                           ? arena + contentPos : NULL);
+            Node_updateLength(n, fields[1]);
+            if(flags[1])
+                contentPos += fields[1];
+        }
+        else if(flags[1]) {
+            result = IO_ERROR;
+            break;
+        }
+        else {
+            numChildren = fields[0];
+            Node_setQuota(n, fields[2], fields[3]);
+        }
+
+        if(numChildren > 0) {
+            if(depth == capacity) {
+                capacity = capacity == 0 ? 16 : 2 * capacity;
+                newStack = realloc(stack, capacity
+                                   * sizeof(struct FT_loadFrame));
+                if(newStack == NULL) {
+                    result = MEMORY_ERROR;
+                    break;
+                }
+                stack = newStack;
+            }
+            stack[depth].node = n;
+            stack[depth].remaining = numChildren;
+            depth++;
+            n = NULL;
+            continue;
+        }
+
+        /* n is complete: link it, and every directory it completes,
+        to its parent. Children must arrive in sorted order. */
+        while(depth > 0) {
+            parent = stack[depth - 1].node;
+            numChildren = Node_getNumChildren(parent);
+            if(numChildren > 0) {
+                last = Node_getChild(parent, numChildren - 1);
+                if(Node_compare(last, n) >= 0) {
+                    result = IO_ERROR;
+                    break;
+                }
+            }
+            if(Node_insertChildAt(parent, n, numChildren) != SUCCESS) {
+                result = MEMORY_ERROR;
+                break;
+            }
+            n = NULL;
+            if(--stack[depth - 1].remaining > 0)
+                break;
+            n = parent;
+            depth--;
+        }
+        if(result == SUCCESS && depth == 0) {
+            *pRoot = n;
+            n = NULL;
+        }
+    }
+
+    if(result == SUCCESS && (i < numNodes || depth > 0
+                             || namePos != nameBytes
+                             || contentPos != contentBytes))
+        result = IO_ERROR;
+    if(result != SUCCESS) {
+        /* The unlinked nodes each hold the subtree built beneath them
+        so far. */
+        if(n != NULL)
+            (void) Node_destroy(n);
+        while(depth > 0)
+            (void) Node_destroy(stack[--depth].node);
+        if(*pRoot != NULL) {
+            (void) Node_destroy(*pRoot);
+            *pRoot = NULL;
+        }
+    }
+    free(stack);
+    return result;
+}
+
+/*
+  Replaces the empty hierarchy with the one saved to fd by FT_save,
+  reading the stream once from start to end. The contents of the
+  loaded files are held in one block that the hierarchy owns until
+  FT_destroy.
+  Returns SUCCESS if the whole hierarchy is loaded.
+  Returns INITIALIZATION_ERROR if not in an initialized state.
+  Returns CONFLICTING_PATH if the hierarchy is not empty.
+  Returns MEMORY_ERROR if unable to allocate any node or field.
+  Returns IO_ERROR if a read fails or the stream is not valid.
+  On a non-SUCCESS status the hierarchy remains empty.
+*/
+static int FT_doLoad(int fd) {
+    struct FT_reader *reader;
+    char magic[FT_SAVE_SIZE];
+    size_t numNodes;
+    size_t nameBytes;
+    size_t contentBytes;
+    char *names = NULL;
+    char *arena = NULL;
+    Node_T loaded = NULL;
+    int result = SUCCESS;
+
+    FT_CHECK();
+
+    if(!isInitialized)
+        return INITIALIZATION_ERROR;
+    if(root != NULL)
+        return CONFLICTING_PATH;
+    reader = malloc(sizeof(struct FT_reader));
+    if(reader == NULL)
+        return MEMORY_ERROR;
+    reader->fd = fd;
+    reader->pos = 0;
+    reader->end = 0;
+
+    if(!FT_readBytes(reader, magic, FT_SAVE_SIZE)
+       || memcmp(magic, FT_SAVE_MAGIC, FT_SAVE_SIZE)
+       || !FT_readSize(reader, &numNodes)
+       || !FT_readSize(reader, &nameBytes)
+       || !FT_readSize(reader, &contentBytes)
+       || (nameBytes > 0 && numNodes == 0))
+        result = IO_ERROR;
+    if(result == SUCCESS && nameBytes > 0) {
+        names = malloc(nameBytes);
+        if(names == NULL)
+            result = MEMORY_ERROR;
+        else if(!FT_readBytes(reader, names, nameBytes)
+                || names[nameBytes - 1] != '\0')
+            result = IO_ERROR;
+    }
+    /* The arena always has a byte to spare, so that even contents of
+    length 0 are non-NULL. */
+    if(result == SUCCESS && contentBytes == (size_t)-1)
+        result = IO_ERROR;
+    if(result == SUCCESS) {
+        arena = malloc(contentBytes + 1);
+        if(arena == NULL)
+            result = MEMORY_ERROR;
+    }
+    if(result == SUCCESS && loadedContents == NULL) {
+        loadedContents = DynArray_new(0);
+        if(loadedContents == NULL)
+            result = MEMORY_ERROR;
+    }
+    if(result == SUCCESS && numNodes > 0)
+        result = FT_loadNodes(reader, numNodes, names, nameBytes,
+                              arena, contentBytes, &loaded);
+    if(result == SUCCESS && contentBytes > 0
+       && !FT_readBytes(reader, arena, contentBytes))
+        result = IO_ERROR;
+    if(result == SUCCESS && !DynArray_add(loadedContents, arena))
+        result = MEMORY_ERROR;
+
+    if(result == SUCCESS) {
+        root = loaded;
+        count = numNodes;
+    }
+    else {
+        if(loaded != NULL)
+            (void) Node_destroy(loaded);
+        free(arena);
+    }
+    free(names);
+    free(reader);
+    FT_CHECK();
+    return result;
+}
+
+/*--------------------------------------------------------------------*/
+/* Mapped images                                                      */
+/*--------------------------------------------------------------------*/
+
+/*
+   The format written by FT_saveImage, laid out so that it can be
+   queried where it lies, every size an FT_SAVE_SIZE-byte
+   little-endian unsigned integer and every part starting at a
+   multiple of FT_SAVE_SIZE:
+     header:  the 8 bytes of FT_IMAGE_MAGIC, the number of nodes, the
+              offset of the root's record (0 if the hierarchy is
+              empty) and the size of the image
+     then, for each node in post-order:
+       its name and a '\0'
+       for a file, its contents, if they are not NULL
+       for a directory, the offsets of its children's records, in
+              sorted order
+       its record: its type, the offset and length of its name, its
+              length (for a file) or number of children (for a
+              directory), and the offset of its contents (0 if they
+              are NULL) or of its children's offsets
+   Since each node follows its children, the image is written in a
+   single traversal.
+*/
+#define FT_IMAGE_MAGIC "FTIMAGE"
+enum { FT_IMAGE_HEADER = 4 * FT_SAVE_SIZE,
+       FT_IMAGE_RECORD = 5 * FT_SAVE_SIZE };
+
+/* A hierarchy saved by FT_saveImage, mapped into memory. */
+struct FT_Image {
+    const unsigned char *base;
+    size_t size;
+};
+
+/* Appends zeros to writer's stream up to a multiple of FT_SAVE_SIZE. */
+static void FT_writePadding(struct FT_writer *writer) {
+    static const unsigned char zeros[FT_SAVE_SIZE] = { 0 };
+
+    if(writer->total % FT_SAVE_SIZE != 0)
+        FT_writeBytes(writer, zeros,
+                      FT_SAVE_SIZE - writer->total % FT_SAVE_SIZE);
+}
+
+/*
+   Writes the hierarchy rooted at n to writer's stream in post-order,
+   as described above. Returns the offset of n's record, or 0 if
+   unable to allocate.
+*/
+static size_t FT_imageWrite(struct FT_writer *writer, Node_T n) {
+    const char *name = Node_getName(n);
+    size_t nameOffset;
+    size_t dataOffset = 0;
+    size_t *childOffsets = NULL;
+    size_t numChildren = 0;
+    size_t record;
+    size_t c;
+
+    if(Node_getType(n) == DIRECTORY) {
+        numChildren = Node_getNumChildren(n);
+        if(numChildren > 0) {
+            childOffsets = malloc(numChildren * sizeof(size_t));
+            if(childOffsets == NULL)
+                return 0;
+        }
+        for(c = 0; c < numChildren; c++) {
+            childOffsets[c] = FT_imageWrite(writer, Node_getChild(n, c));
+            if(childOffsets[c] == 0) {
+                free(childOffsets);
+                return 0;
+            }
+        }
+    }
+
+    nameOffset = writer->total;
+    FT_writeBytes(writer, name, strlen(name) + 1);
+    FT_writePadding(writer);
+    if(Node_getType(n) == FT_FILE && FT_contentsOf(n) != NULL) {
+        dataOffset = writer->total;
+        FT_writeBytes(writer, FT_contentsOf(n), Node_getLength(n));
+        FT_writePadding(writer);
+    }
+    else if(Node_getType(n) == DIRECTORY) {
+        dataOffset = writer->total;
+        for(c = 0; c < numChildren; c++)
+            FT_writeSize(writer, childOffsets[c]);
+        free(childOffsets);
+    }
+
+    record = writer->total;
+    FT_writeSize(writer, (size_t) Node_getType(n));
+    FT_writeSize(writer, nameOffset);
+    FT_writeSize(writer, strlen(name));
+    FT_writeSize(writer, Node_getType(n) == FT_FILE
+                 ? Node_getLength(n) : numChildren);
+    FT_writeSize(writer, dataOffset);
+    return record;
+}
+
+/*
+  Writes the hierarchy, with every file's contents and length, to fd,
+  which must be open for writing at its start, in the image format
+  described above.
+  Returns SUCCESS if the whole hierarchy is written.
+  Returns INITIALIZATION_ERROR if not in an initialized state.
+  Returns MEMORY_ERROR if unable to allocate memory to write with.
+  Returns IO_ERROR if a write fails.
+*/
+static int FT_doSaveImage(int fd) {
+    struct FT_writer *writer;
+    size_t rootOffset = 0;
+    unsigned char header[FT_IMAGE_HEADER];
+    size_t size;
+    int result = SUCCESS;
+
+    FT_CHECK();
+
+    if(!isInitialized)
+        return INITIALIZATION_ERROR;
+    writer = malloc(sizeof(struct FT_writer));
+    if(writer == NULL)
+        return MEMORY_ERROR;
+    writer->fd = fd;
+    writer->failed = FALSE;
+    writer->total = 0;
+    writer->used = 0;
+
+    /* The header's sizes are only known at the end, so it is written
+    with them filled in once the rest is. */
+    memset(header, 0, sizeof(header));
+    FT_writeBytes(writer, header, sizeof(header));
+    if(root != NULL) {
+        rootOffset = FT_imageWrite(writer, root);
+        if(rootOffset == 0)
+            result = MEMORY_ERROR;
+    }
+    FT_flushWriter(writer);
+    size = writer->total;
+
+    if(result == SUCCESS && !writer->failed) {
+        memcpy(header, FT_IMAGE_MAGIC, FT_SAVE_SIZE);
+        FT_encodeSize(header + FT_SAVE_SIZE, count);
+        FT_encodeSize(header + 2 * FT_SAVE_SIZE, rootOffset);
+        FT_encodeSize(header + 3 * FT_SAVE_SIZE, size);
+        if(lseek(fd, -(off_t) size, SEEK_CUR) < 0
+           || !FT_writeAll(fd, header, sizeof(header))
+           || lseek(fd, (off_t)(size - sizeof(header)), SEEK_CUR) < 0)
+            writer->failed = TRUE;
+    }
+    if(result == SUCCESS && writer->failed)
+        result = IO_ERROR;
+    free(writer);
+    return result;
+}
+
+/*
+   Returns the size stored at offset in image, or (size_t)-1, which
+   no offset or length within the image can be, if it does not fit in
+   the image or in a size_t.
+*/
+static size_t FT_imageSize(FT_Image_T image, size_t offset) {
+    if(offset > image->size || image->size - offset < FT_SAVE_SIZE)
+        return (size_t)-1;
+    return FT_decodeSize(image->base + offset);
+}
+
+/*
+   Returns TRUE if the span of length bytes at offset lies within
+   image, and FALSE otherwise.
+*/
+static boolean FT_imageHolds(FT_Image_T image, size_t offset,
+                             size_t length) {
+    return (boolean)(offset <= image->size
+                     && length <= image->size - offset);
+}
+
+/*
+   Returns the offset of the record of the node at path in image, or 0
+   if there is none. Each directory's children are binary searched in
+   place; offsets that lead outside the image end the search, so that
+   a damaged image gives wrong answers rather than faults.
+*/
+static size_t FT_imageFind(FT_Image_T image, const char *path) {
+    size_t record = FT_imageSize(image, 2 * FT_SAVE_SIZE);
+    size_t children;
+    size_t child;
+    size_t nameOffset;
+    size_t nameLength;
+    size_t length;
+    size_t low;
+    size_t high;
+    size_t mid;
+    int cmp;
+
+    assert(path != NULL);
+
+    if(record == 0 || !FT_imageHolds(image, record, FT_IMAGE_RECORD))
+        return 0;
+    length = strcspn(path, "/");
+    nameOffset = FT_imageSize(image, record + FT_SAVE_SIZE);
+    nameLength = FT_imageSize(image, record + 2 * FT_SAVE_SIZE);
+    if(nameLength != length
+       || !FT_imageHolds(image, nameOffset, nameLength)
+       || memcmp(image->base + nameOffset, path, length))
+        return 0;
+    path += length;
+
+    while(*path == '/') {
+        if(FT_imageSize(image, record) != DIRECTORY)
+            return 0;
+        path++;
+        length = strcspn(path, "/");
+        low = 0;
+        high = FT_imageSize(image, record + 3 * FT_SAVE_SIZE);
+        children = FT_imageSize(image, record + 4 * FT_SAVE_SIZE);
+        if(high > image->size / FT_SAVE_SIZE)
+            return 0;
+        record = 0;
+        while(low < high) {
+            mid = low + (high - low) / 2;
+            child = FT_imageSize(image, children + mid * FT_SAVE_SIZE);
+            if(!FT_imageHolds(image, child, FT_IMAGE_RECORD))
+                return 0;
+            nameOffset = FT_imageSize(image, child + FT_SAVE_SIZE);
+            nameLength = FT_imageSize(image, child + 2 * FT_SAVE_SIZE);
+            if(!FT_imageHolds(image, nameOffset, nameLength))
+                return 0;
+            cmp = memcmp(image->base + nameOffset, path,
+                         nameLength < length ? nameLength : length);
+            if(cmp == 0 && nameLength != length)
+                cmp = nameLength < length ? -1 : 1;
+            if(cmp == 0) {
+                record = child;
+                break;
+            }
+            if(cmp < 0)
+                low = mid + 1;
+            else
+                high = mid;
+        }
+        if(record == 0)
+            return 0;
+        path += length;
+    }
+    return *path == '\0' ? record : 0;
+}
+
+/*
+  Maps the image saved to fd by FT_saveImage into memory, read-only
+  and shared, and returns a handle to query it with, or NULL if fd
+  cannot be mapped or does not hold an image.
+*/
+FT_Image_T FT_mapImage(int fd) {
+    struct stat info;
+    void *base;
+    FT_Image_T image;
+
+    if(fstat(fd, &info) < 0 || info.st_size < FT_IMAGE_HEADER
+       || (off_t)(size_t) info.st_size != info.st_size)
+        return NULL;
+    image = malloc(sizeof(struct FT_Image));
+    if(image == NULL)
+        return NULL;
+    base = mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_SHARED,
+                fd, 0);
+    if(base == MAP_FAILED) {
+        free(image);
+        return NULL;
+    }
+    image->base = base;
+    image->size = (size_t) info.st_size;
+    if(memcmp(image->base, FT_IMAGE_MAGIC, FT_SAVE_SIZE)
+       || FT_imageSize(image, 3 * FT_SAVE_SIZE) != image->size) {
+        FT_unmapImage(image);
+        return NULL;
+    }
+    return image;
+}
+
+/*
+  Returns TRUE if image contains path as a directory and FALSE
+  otherwise.
+*/
+boolean FT_imageContainsDir(FT_Image_T image, char *path) {
+    size_t record;
+
+    assert(image != NULL);
+
+    record = FT_imageFind(image, path);
+    return (boolean)(record != 0
+                     && FT_imageSize(image, record) == DIRECTORY);
+}
+
+/*
+  Returns TRUE if image contains path as a file and FALSE otherwise.
+*/
+boolean FT_imageContainsFile(FT_Image_T image, char *path) {
+    size_t record;
+
+    assert(image != NULL);
+
+    record = FT_imageFind(image, path);
+    return (boolean)(record != 0
+                     && FT_imageSize(image, record) == FT_FILE);
+}
+
+/*
+  Returns the contents of the file at path in image, where they lie
+  in the mapping, or NULL if the path does not exist there, is a
+  directory, or has NULL contents.
+*/
+const void *FT_imageGetFileContents(FT_Image_T image, char *path) {
+    size_t record;
+    size_t offset;
+
+    assert(image != NULL);
+
+    record = FT_imageFind(image, path);
+    if(record == 0 || FT_imageSize(image, record) != FT_FILE)
+        return NULL;
+    offset = FT_imageSize(image, record + 4 * FT_SAVE_SIZE);
+    if(offset == 0 || !FT_imageHolds(image, offset,
+                                     FT_imageSize(image, record
+                                                  + 3 * FT_SAVE_SIZE)))
+        return NULL;
+    return image->base + offset;
+}
+
+/*
+  As FT_stat, but for path in image: returns SUCCESS, setting *type
+  and (for a file) *length, if path exists there, and NO_SUCH_PATH,
+  leaving them unchanged, if it does not.
+*/
+int FT_imageStat(FT_Image_T image, char *path, boolean *type,
+                 size_t *length) {
+    size_t record;
+
+    assert(image != NULL);
+    assert(type != NULL);
+    assert(length != NULL);
+
+    record = FT_imageFind(image, path);
+    if(record == 0)
+        return NO_SUCH_PATH;
+    if(FT_imageSize(image, record) == FT_FILE) {
+        *type = TRUE;
+        *length = FT_imageSize(image, record + 3 * FT_SAVE_SIZE);
+    }
+    else
+        *type = FALSE;
+    return SUCCESS;
+}
+
+/*
+  Unmaps image and frees its handle.
+*/
+void FT_unmapImage(FT_Image_T image) {
+    assert(image != NULL);
+
+    (void) munmap((void *) image->base, image->size);
+    free(image);
+}
+
+/*--------------------------------------------------------------------*/
+/* Write-ahead log                                                    */
+/*--------------------------------------------------------------------*/
+
+/*
+   Each successful change is logged as a record of the call that made
+   it, which replaying on the same hierarchy repeats exactly:
+     the size of the record's body, then the body: the kind of change
+     and whether contents follow (a byte each), then the sizes of the
+     path and of the other path, each with its '\0', the file length
+     and the two quota limits, then the paths and any contents
+     themselves; then the body's FNV-1a checksum.
+   Sizes are FT_SAVE_SIZE-byte little-endian integers, as for FT_save.
+   A record cut short by a crash fails its checksum, which ends the
+   log there.
+*/
+enum { FT_WAL_HEADER = 2 + 5 * FT_SAVE_SIZE, FT_WAL_CHECK = FT_SAVE_SIZE };
+
+/* One logged change, waiting to be written, with its bytes following
+   it in the same block. */
+struct FT_walRecord {
+    struct FT_walRecord *next;
+    /* the number of bytes, size and checksum included */
+    size_t length;
+};
+
+/* Guards every wal* variable below, since FT_syncLog may run on any
+   thread, alongside the calls that log changes. */
+static pthread_mutex_t walLock = PTHREAD_MUTEX_INITIALIZER;
+/* signalled when a group of records has been written and synced */
+static pthread_cond_t walCond = PTHREAD_COND_INITIALIZER;
+/* the log's file descriptor, or -1 if no log is open */
+static int walFd = -1;
+/* the records waiting to be written, oldest first */
+static struct FT_walRecord *walHead;
+static struct FT_walRecord *walTail;
+/* the records logged so far and, of them, those synced to the log */
+static size_t walAppended;
+static size_t walDurable;
+/* TRUE while one thread writes and syncs a group for all */
+static boolean walSyncing;
+/* the first failure to log or sync, which ends all syncing */
+static int walStatus;
+/* the writer the syncing thread uses */
+static struct FT_writer walWriter;
+/* the records of the transaction in progress, logged at FT_commit */
+static struct FT_walRecord *txWalHead;
+static struct FT_walRecord *txWalTail;
+
+/* Returns the 32-bit FNV-1a hash of the length bytes at bytes. */
+static unsigned long FT_walChecksum(const unsigned char *bytes,
+                                    size_t length) {
+    unsigned long hash = 2166136261UL;
+    size_t i;
+
+    for(i = 0; i < length; i++)
+        hash = ((hash ^ bytes[i]) * 16777619UL) & 0xffffffffUL;
+    return hash;
+}
+
+/* Frees the list of records starting at record. */
+static void FT_walFree(struct FT_walRecord *record) {
+    struct FT_walRecord *next;
+
+    for(; record != NULL; record = next) {
+        next = record->next;
+        free(record);
+    }
+}
+
+/*
+   If status is SUCCESS and a log is open, logs the change of the given
+   kind that a call made with the given arguments -- any that the kind
+   does not use being NULL or 0 -- as the next record, which becomes
+   durable once FT_syncLog returns. Inside a transaction the record is
+   held until FT_commit. If the record cannot be allocated, the log
+   can no longer be complete, and every later FT_syncLog returns
+   MEMORY_ERROR.
+*/
+static void FT_walNote(int status, int kind, const char *path,
+                       const char *otherPath, const void *contents,
+                       size_t length, size_t maxNodes,
+                       size_t maxLength) {
+    struct FT_walRecord *record;
+    unsigned char *bytes;
+    size_t pathSize;
+    size_t otherSize;
+    size_t contentLength;
+    size_t bodyLength;
+
+    if(status != SUCCESS || walFd < 0)
+        return;
+    pathSize = strlen(path) + 1;
+    otherSize = otherPath == NULL ? 0 : strlen(otherPath) + 1;
+    contentLength = contents == NULL ? 0 : length;
+    bodyLength = FT_WAL_HEADER + pathSize + otherSize + contentLength;
+    record = malloc(sizeof(struct FT_walRecord) + FT_SAVE_SIZE
+                    + bodyLength + FT_WAL_CHECK);
+    if(record == NULL) {
+        (void) pthread_mutex_lock(&walLock);
+        if(walStatus == SUCCESS)
+            walStatus = MEMORY_ERROR;
+        (void) pthread_mutex_unlock(&walLock);
+        return;
+    }
+    record->next = NULL;
+    record->length = FT_SAVE_SIZE + bodyLength + FT_WAL_CHECK;
+
+    bytes = (unsigned char *)(record + 1);
+    FT_encodeSize(bytes, bodyLength);
+    bytes += FT_SAVE_SIZE;
+    bytes[0] = (unsigned char) kind;
+    bytes[1] = (unsigned char)(contents != NULL);
+    FT_encodeSize(bytes + 2, pathSize);
+    FT_encodeSize(bytes + 2 + FT_SAVE_SIZE, otherSize);
+    FT_encodeSize(bytes + 2 + 2 * FT_SAVE_SIZE, length);
+    FT_encodeSize(bytes + 2 + 3 * FT_SAVE_SIZE, maxNodes);
+    FT_encodeSize(bytes + 2 + 4 * FT_SAVE_SIZE, maxLength);
+    memcpy(bytes + FT_WAL_HEADER, path, pathSize);
+    if(otherPath != NULL)
+        memcpy(bytes + FT_WAL_HEADER + pathSize, otherPath, otherSize);
+    if(contentLength > 0)
+        memcpy(bytes + FT_WAL_HEADER + pathSize + otherSize, contents,
+               contentLength);
+    FT_encodeSize(bytes + bodyLength,
+                  (size_t) FT_walChecksum(bytes, bodyLength));
+
+    if(inTransaction) {
+        if(txWalTail == NULL)
+            txWalHead = record;
+        else
+            txWalTail->next = record;
+        txWalTail = record;
+        return;
+    }
+    (void) pthread_mutex_lock(&walLock);
+    if(walTail == NULL)
+        walHead = record;
+    else
+        walTail->next = record;
+    walTail = record;
+    walAppended++;
+    (void) pthread_mutex_unlock(&walLock);
+}
+
+/*
+   Ends the transaction in progress for the log: its records are
+   logged, in order, if keep is TRUE, and dropped otherwise.
+*/
+static void FT_walEndTransaction(boolean keep) {
+    struct FT_walRecord *record;
+    size_t numRecords = 0;
+
+    if(!keep || txWalHead == NULL) {
+        FT_walFree(txWalHead);
+        txWalHead = txWalTail = NULL;
+        return;
+    }
+    for(record = txWalHead; record != NULL; record = record->next)
+        numRecords++;
+    (void) pthread_mutex_lock(&walLock);
+    if(walTail == NULL)
+        walHead = txWalHead;
+    else
+        walTail->next = txWalHead;
+    walTail = txWalTail;
+    walAppended += numRecords;
+    (void) pthread_mutex_unlock(&walLock);
+    txWalHead = txWalTail = NULL;
+}
+
+/*
+   Waits until every record logged before the call is written to the
+   log and synced with fdatasync. Whichever caller finds no sync under
+   way writes every record waiting at that moment and syncs them with
+   a single fdatasync, while the others wait on it and then find
+   their records already durable: concurrent callers share the cost
+   of one sync. Returns SUCCESS, or the first failure to log or sync.
+*/
+static int FT_walSync(void) {
+    struct FT_walRecord *group;
+    struct FT_walRecord *record;
+    size_t target;
+    size_t groupEnd;
+    boolean synced;
+    int result;
+
+    (void) pthread_mutex_lock(&walLock);
+    target = walAppended;
+    while(walDurable < target && walStatus == SUCCESS) {
+        if(walSyncing) {
+            (void) pthread_cond_wait(&walCond, &walLock);
+            continue;
+        }
+        walSyncing = TRUE;
+        group = walHead;
+        groupEnd = walAppended;
+        walHead = walTail = NULL;
+        (void) pthread_mutex_unlock(&walLock);
+
+        walWriter.fd = walFd;
+        walWriter.failed = FALSE;
+        walWriter.total = 0;
+        walWriter.used = 0;
+        for(record = group; record != NULL; record = record->next)
+            FT_writeBytes(&walWriter, record + 1, record->length);
+        FT_flushWriter(&walWriter);
+        synced = (boolean)(!walWriter.failed && fdatasync(walFd) == 0);
+        FT_walFree(group);
+
+        (void) pthread_mutex_lock(&walLock);
+        walSyncing = FALSE;
+        if(synced)
+            walDurable = groupEnd;
+        else if(walStatus == SUCCESS)
+            walStatus = IO_ERROR;
+        (void) pthread_cond_broadcast(&walCond);
+    }
+    result = walStatus;
+    (void) pthread_mutex_unlock(&walLock);
+    return result;
+}
+
+/*
+  Starts logging every change to the hierarchy to fd, which must be
+  open for writing at the end of the log.
+  Returns SUCCESS if the log is opened.
+  Returns INITIALIZATION_ERROR if not in an initialized state, if a
+  log is already open or if fd is negative.
+*/
+static int FT_doOpenLog(int fd) {
+    if(!isInitialized || walFd >= 0 || fd < 0)
+        return INITIALIZATION_ERROR;
+    walHead = walTail = NULL;
+    walAppended = walDurable = 0;
+    walStatus = SUCCESS;
+    walFd = fd;
+    return SUCCESS;
+}
+
+/*
+  Stops logging after syncing the records logged so far, dropping
+  those of any transaction in progress.
+  Returns SUCCESS if every record was written and synced.
+  Returns INITIALIZATION_ERROR if no log is open.
+  Returns MEMORY_ERROR or IO_ERROR if a record could not be logged or
+  synced.
+*/
+static int FT_doCloseLog(void) {
+    int result;
+
+    if(walFd < 0)
+        return INITIALIZATION_ERROR;
+    result = FT_walSync();
+    FT_walFree(walHead);
+    FT_walFree(txWalHead);
+    walHead = walTail = txWalHead = txWalTail = NULL;
+    walFd = -1;
+    return result;
+}
+
+/* see ft.h for specification */
+int FT_syncLog(void) {
+    if(walFd < 0)
+        return INITIALIZATION_ERROR;
+    return FT_walSync();
+}
+
+/*
+   Applies the record whose body, of bodyLength bytes, is at body to
+   the hierarchy, copying any contents it gives a file as owned
+   contents (see FT_setOwnedContents), so that each copy is freed as
+   soon as no file holds it.
+   Returns SUCCESS if the change is made again.
+   Returns MEMORY_ERROR if unable to allocate.
+   Returns IO_ERROR if the record is malformed or cannot be applied,
+   which means the log does not continue the hierarchy it is replayed
+   on.
+*/
+static int FT_walApply(unsigned char *body, size_t bodyLength) {
+    char *path;
+    char *otherPath = NULL;
+    void *contents = NULL;
+    size_t pathSize;
+    size_t otherSize;
+    size_t length;
+    size_t contentLength;
+    size_t maxNodes;
+    size_t maxLength;
+    boolean wasOwned = ownedContents;
+    int result;
+
+    pathSize = FT_decodeSize(body + 2);
+    otherSize = FT_decodeSize(body + 2 + FT_SAVE_SIZE);
+    length = FT_decodeSize(body + 2 + 2 * FT_SAVE_SIZE);
+    maxNodes = FT_decodeSize(body + 2 + 3 * FT_SAVE_SIZE);
+    maxLength = FT_decodeSize(body + 2 + 4 * FT_SAVE_SIZE);
+    contentLength = body[1] ? length : 0;
+    if(body[1] > 1 || pathSize == 0 || pathSize > bodyLength
+       || otherSize > bodyLength || contentLength > bodyLength
+       || FT_WAL_HEADER + pathSize + otherSize + contentLength
+          != bodyLength)
+        return IO_ERROR;
+    path = (char *)(body + FT_WAL_HEADER);
+    if(path[pathSize - 1] != '\0' || strlen(path) != pathSize - 1)
+        return IO_ERROR;
+    if(otherSize > 0) {
+        otherPath = path + pathSize;
+        if(otherPath[otherSize - 1] != '\0'
+           || strlen(otherPath) != otherSize - 1)
+            return IO_ERROR;
+    }
+    /* Contents are copied straight from the record by the owned path,
+    rather than into a block of their own that would outlive any file
+    that later replaces or drops them. */
+    if(body[1])
+        contents = body + bodyLength - length;
+    ownedContents = TRUE;
+
+    switch(body[0]) {
+    case FT_WAL_INSERTDIR:
+        result = FT_doInsertDir(path);
+        break;
+    case FT_WAL_INSERTFILE:
+        result = FT_doInsertFile(path, contents, length);
+        break;
+    case FT_WAL_RMDIR:
+        result = FT_doRmDir(path);
+        break;
+    case FT_WAL_RMFILE:
+        result = FT_doRmFile(path);
+        break;
+    case FT_WAL_REPLACE:
+        (void) FT_doReplaceFileContents(path, contents, length, &result);
+        break;
+    case FT_WAL_SETQUOTA:
+        result = FT_doSetQuota(path, maxNodes, maxLength);
+        break;
+    case FT_WAL_MOVE:
+        result = otherPath == NULL ? IO_ERROR
+                                   : FT_doMove(path, otherPath);
+        break;
+    case FT_WAL_COPY:
+        result = otherPath == NULL ? IO_ERROR
+                                   : FT_doCopy(path, otherPath);
+        break;
+    default:
+        result = IO_ERROR;
+    }
+    ownedContents = wasOwned;
+    if(result != SUCCESS && result != MEMORY_ERROR)
+        result = IO_ERROR;
+    return result;
+}
+
+/*
+   Replays the records of the log in fd, from its current offset, on
+   the hierarchy. The log ends at the first record that is cut short
+   or fails its checksum, as the last one may after a crash; fd is
+   left positioned, and where possible truncated, at that point, so
+   that logging can continue there.
+   Returns SUCCESS, or the status FT_walApply returned for a record.
+*/
+static int FT_walReplay(int fd) {
+    struct FT_reader *reader;
+    struct stat info;
+    unsigned char *body = NULL;
+    unsigned char *newBody;
+    unsigned char check[FT_WAL_CHECK];
+    size_t bodyCapacity = 0;
+    size_t bodyLength;
+    size_t remaining = (size_t)-1;
+    off_t start;
+    off_t end;
+    int result = SUCCESS;
+
+    start = lseek(fd, 0, SEEK_CUR);
+    if(start < 0)
+        return IO_ERROR;
+    if(fstat(fd, &info) == 0 && S_ISREG(info.st_mode)
+       && info.st_size >= start)
+        remaining = (size_t)(info.st_size - start);
+    reader = malloc(sizeof(struct FT_reader));
+    if(reader == NULL)
+        return MEMORY_ERROR;
+    reader->fd = fd;
+    reader->pos = 0;
+    reader->end = 0;
+
+    end = start;
+    while(result == SUCCESS) {
+        if(!FT_readSize(reader, &bodyLength) || bodyLength < FT_WAL_HEADER
+           || bodyLength > remaining
+           || remaining - bodyLength < FT_SAVE_SIZE + FT_WAL_CHECK)
+            break;
+        if(bodyLength > bodyCapacity) {
+            newBody = realloc(body, bodyLength);
+            if(newBody == NULL) {
+                result = MEMORY_ERROR;
+                break;
+            }
+            body = newBody;
+            bodyCapacity = bodyLength;
+        }
+        if(!FT_readBytes(reader, body, bodyLength)
+           || !FT_readBytes(reader, check, FT_WAL_CHECK)
+           || FT_decodeSize(check) != FT_walChecksum(body, bodyLength))
+            break;
+        result = FT_walApply(body, bodyLength);
+        if(remaining != (size_t)-1)
+            remaining -= FT_SAVE_SIZE + bodyLength + FT_WAL_CHECK;
+        end += (off_t)(FT_SAVE_SIZE + bodyLength + FT_WAL_CHECK);
+    }
+
+    if(result == SUCCESS) {
+        if(lseek(fd, end, SEEK_SET) < 0)
+            result = IO_ERROR;
+        else
+            (void) ftruncate(fd, end);
+    }
+    free(body);
+    free(reader);
+    return result;
+}
+
+/*
+  Initializes the hierarchy as FT_init does, then rebuilds it from the
+  hierarchy saved by FT_save to imageFd, unless it is negative, and
+  the changes logged to logFd after it, unless it is negative.
+  Returns SUCCESS if the hierarchy is recovered.
+  Returns INITIALIZATION_ERROR if already initialized.
+  Returns MEMORY_ERROR if unable to allocate.
+  Returns IO_ERROR if either cannot be read or the log does not
+  continue the saved hierarchy.
+  On a non-SUCCESS status the structure is left uninitialized.
+*/
+static int FT_doRecover(int imageFd, int logFd) {
+    int result;
+
+    result = FT_doInit();
+    if(result != SUCCESS)
+        return result;
+    if(imageFd >= 0)
+        result = FT_doLoad(imageFd);
+    if(result == SUCCESS && logFd >= 0)
+        result = FT_walReplay(logFd);
+    if(result != SUCCESS)
+        (void) FT_doDestroy();
+    return result;
+}
+
+/*--------------------------------------------------------------------*/
+/* Importing from the file system                                     */
+/*--------------------------------------------------------------------*/
+
+/* One directory or regular file found by FT_importDir. */
+struct FT_importEntry {
+    /* its path in the hierarchy */
+    char *path;
+    nodeType type;
+    /* for a file, the bytes read from it, if any, and their number */
+    void *contents;
+    size_t length;
+};
+
+/* The work shared by all of FT_importDir's workers. */
+struct FT_importWork {
+    /* the directory being imported, and the path it is imported as */
+    const char *fsPath;
+    const char *treePath;
+    int flags;
+    /* guards every field below */
+    pthread_mutex_t lock;
+    /* signalled when a directory is queued or the scan ends */
+    pthread_cond_t cond;
+    /* the paths in the hierarchy of the directories still to scan */
+    DynArray_T queue;
+    /* the number of workers scanning a directory */
+    size_t busy;
+    /* the first failure, which stops every worker */
+    int status;
+};
+
+/* One of FT_importDir's workers. */
+struct FT_importWorker {
+    struct FT_importWork *work;
+    /* the struct FT_importEntry objects this worker has found */
+    DynArray_T entries;
+};
+
+/*
+   Records in work the failure status, unless an earlier failure was
+   recorded, and wakes every worker to stop.
+*/
+static void FT_importFail(struct FT_importWork *work, int status) {
+    (void) pthread_mutex_lock(&work->lock);
+    if(work->status == SUCCESS)
+        work->status = status;
+    (void) pthread_cond_broadcast(&work->cond);
+    (void) pthread_mutex_unlock(&work->lock);
+}
+
+/* Frees the struct FT_importEntry pvEntry, contents and all. */
+static void FT_freeImportEntry(void *pvEntry, void *pvExtra) {
+    struct FT_importEntry *entry = pvEntry;
+
+    (void) pvExtra;
+    free(entry->path);
+    free(entry->contents);
+    free(entry);
+}
+
+/*
+   Reads the regular file name in the directory open as dirFd into a
+   new block of its size, storing it and its length in entry. Returns
+   SUCCESS, MEMORY_ERROR or IO_ERROR.
+*/
+static int FT_importContents(int dirFd, const char *name,
+                             struct FT_importEntry *entry) {
+    struct stat info;
+    unsigned char *contents;
+    size_t size;
+    size_t done = 0;
+    ssize_t got;
+    int fd;
+
+    fd = openat(dirFd, name, O_RDONLY | O_NOFOLLOW);
+    if(fd < 0)
+        return IO_ERROR;
+    if(fstat(fd, &info) < 0 || info.st_size < 0
+       || (off_t)(size_t) info.st_size != info.st_size) {
+        (void) close(fd);
+        return IO_ERROR;
+    }
+    size = (size_t) info.st_size;
+    /* Even an empty file gets non-NULL contents. */
+    contents = malloc(size + 1);
+    if(contents == NULL) {
+        (void) close(fd);
+        return MEMORY_ERROR;
+    }
+    /* A file that shrinks while being read keeps what was there. */
+    while(done < size) {
+        got = read(fd, contents + done, size - done);
+        if(got < 0 && errno == EINTR)
+            continue;
+        if(got < 0) {
+            free(contents);
+            (void) close(fd);
+            return IO_ERROR;
+        }
+        if(got == 0)
+            break;
+        done += (size_t) got;
+    }
+    (void) close(fd);
+    entry->contents = contents;
+    entry->length = done;
+    return SUCCESS;
+}
+
+/*
+   Lists the directory at path dirPath in the hierarchy with
+   getdents64, recording an entry for each directory and regular file
+   in it (other kinds of file are skipped), reading each file's bytes
+   if FT_IMPORT_CONTENTS is among work's flags, and queuing each
+   directory to be scanned in turn. fsBuffer, of *pSize bytes, is the
+   worker's scratch space for the directory's path in the file system,
+   and dents for the listing. Returns SUCCESS, MEMORY_ERROR or
+   IO_ERROR.
+*/
+static int FT_importScan(struct FT_importWorker *worker,
+                         const char *dirPath, char **pFsBuffer,
+                         size_t *pSize, unsigned char *dents) {
+    struct FT_importWork *work = worker->work;
+    struct FT_importEntry *entry;
+    struct stat info;
+    const char *suffix;
+    const char *name;
+    unsigned short reclen;
+    unsigned char dtype;
+    size_t fsLength;
+    size_t dirLength;
+    long got;
+    long pos;
+    int dirFd;
+    int result = SUCCESS;
+
+    /* The directory's path in the file system is fsPath followed by
+    its path beneath treePath. */
+    suffix = dirPath + strlen(work->treePath);
+    fsLength = strlen(work->fsPath) + strlen(suffix);
+    if(fsLength + 1 > *pSize) {
+        free(*pFsBuffer);
+        *pSize = 2 * (fsLength + 1);
+        *pFsBuffer = malloc(*pSize);
+        if(*pFsBuffer == NULL) {
+            *pSize = 0;
+            return MEMORY_ERROR;
+        }
+    }
+    strcpy(*pFsBuffer, work->fsPath);
+    strcat(*pFsBuffer, suffix);
+
+    dirFd = open(*pFsBuffer, O_RDONLY | O_DIRECTORY);
+    if(dirFd < 0)
+        return IO_ERROR;
+    dirLength = strlen(dirPath);
+    while(result == SUCCESS) {
+        got = syscall(SYS_getdents64, dirFd, dents, FT_IO_BUFFER);
+        if(got < 0 && errno == EINTR)
+            continue;
+        if(got <= 0) {
+            if(got < 0)
+                result = IO_ERROR;
+            break;
+        }
+        /* Each struct linux_dirent64 holds its inode (8 bytes) and
+        offset (8), its size (2), its type (1) and its name. */
+        for(pos = 0; pos < got && result == SUCCESS; pos += reclen) {
+            memcpy(&reclen, dents + pos + 16, sizeof(reclen));
+            dtype = dents[pos + 18];
+            name = (const char *)(dents + pos + 19);
+            if(!strcmp(name, ".") || !strcmp(name, ".."))
+                continue;
+            if(dtype == DT_UNKNOWN) {
+                if(fstatat(dirFd, name, &info, AT_SYMLINK_NOFOLLOW) < 0) {
+                    result = IO_ERROR;
+                    break;
+                }
+                dtype = S_ISDIR(info.st_mode) ? DT_DIR
+                      : S_ISREG(info.st_mode) ? DT_REG : DT_UNKNOWN;
+            }
+            if(dtype != DT_DIR && dtype != DT_REG)
+                continue;
+
+            entry = calloc(1, sizeof(struct FT_importEntry));
+            if(entry == NULL) {
+                result = MEMORY_ERROR;
+                break;
+            }
+            entry->type = dtype == DT_DIR ? DIRECTORY : FT_FILE;
+            entry->path = malloc(dirLength + strlen(name) + 2);
+            if(entry->path == NULL
+               || !DynArray_add(worker->entries, entry)) {
+                free(entry->path);
+                free(entry);
+                result = MEMORY_ERROR;
+                break;
+            }
+            strcpy(entry->path, dirPath);
+            entry->path[dirLength] = '/';
+            strcpy(entry->path + dirLength + 1, name);
+
+            if(entry->type == FT_FILE) {
+                if(work->flags & FT_IMPORT_CONTENTS)
+                    result = FT_importContents(dirFd, name, entry);
+                continue;
+            }
+            (void) pthread_mutex_lock(&work->lock);
+            if(DynArray_add(work->queue, entry->path))
+                (void) pthread_cond_signal(&work->cond);
+            else
+                result = MEMORY_ERROR;
+            (void) pthread_mutex_unlock(&work->lock);
+        }
+    }
+    (void) close(dirFd);
+    return result;
+}
+
+/*
+   Runs the FT_importDir worker pvWorker: takes directories from the
+   shared queue and scans them until the queue is empty with no
+   worker left to add to it, or until any worker fails.
+*/
+static void *FT_importWorker(void *pvWorker) {
+    struct FT_importWorker *worker = pvWorker;
+    struct FT_importWork *work = worker->work;
+    unsigned char *dents;
+    char *fsBuffer = NULL;
+    size_t size = 0;
+    const char *dirPath;
+    int result;
+
+    dents = malloc(FT_IO_BUFFER);
+    if(dents == NULL) {
+        FT_importFail(work, MEMORY_ERROR);
+        return NULL;
+    }
+    (void) pthread_mutex_lock(&work->lock);
+    for(;;) {
+        while(work->status == SUCCESS && work->busy > 0
+              && DynArray_getLength(work->queue) == 0)
+            (void) pthread_cond_wait(&work->cond, &work->lock);
+        if(work->status != SUCCESS
+           || DynArray_getLength(work->queue) == 0)
+            break;
+        dirPath = DynArray_removeAt(work->queue,
+                                    DynArray_getLength(work->queue) - 1);
+        work->busy++;
+        (void) pthread_mutex_unlock(&work->lock);
+
+        result = FT_importScan(worker, dirPath, &fsBuffer, &size, dents);
+        if(result != SUCCESS)
+            FT_importFail(work, result);
+
+        (void) pthread_mutex_lock(&work->lock);
+        work->busy--;
+        if(work->busy == 0 && DynArray_getLength(work->queue) == 0)
+            (void) pthread_cond_broadcast(&work->cond);
+    }
+    (void) pthread_mutex_unlock(&work->lock);
+    free(fsBuffer);
+    free(dents);
+    return NULL;
+}
+
+/*
+  Imports the directory fsPath of the file system, with every
+  directory and regular file beneath it, as the new directory
+  treePath, creating any missing directories above it. The file
+  system is scanned with getdents64 on one thread per online
+  processor, each reading the bytes of the files it finds if flags
+  includes FT_IMPORT_CONTENTS; the entries found are then sorted in
+  parallel into pre-order and inserted as one sorted bulk insert, in
+  time linear in their total path length.
+  Returns SUCCESS if the whole directory is imported.
+  Returns INITIALIZATION_ERROR if not in an initialized state.
+  Returns IO_ERROR if a directory or file cannot be read, in which
+  case nothing is inserted.
+  Returns MEMORY_ERROR if unable to allocate.
+  Otherwise returns the status FT_insertDir or FT_insertFile would
+  return for the first entry that cannot be inserted; the entries
+  before it remain inserted.
+*/
+static int FT_doImportDir(const char *fsPath, const char *treePath,
+                          int flags) {
+    struct FT_importWork work;
+    struct FT_importWorker *workers;
+    struct FT_importEntry *top;
+    struct FT_importEntry **found = NULL;
+    struct FT_importEntry *entry;
+    struct FT_entry *entries = NULL;
+    DynArray_T chain = NULL;
+    size_t chainLength = 0;
+    size_t numThreads;
+    size_t numEntries = 0;
+    size_t shared;
+    size_t i;
+    size_t w;
+    boolean wasOwned;
+    int result = SUCCESS;
+
+    FT_CHECK();
+    assert(fsPath != NULL);
+    assert(treePath != NULL);
+
+    if(!isInitialized)
+        return INITIALIZATION_ERROR;
+    numThreads = FT_defaultThreads(0);
+
+    /* treePath itself is the first entry, and the first directory to
+    scan. */
+    top = calloc(1, sizeof(struct FT_importEntry));
+    if(top == NULL)
+        return MEMORY_ERROR;
+    top->type = DIRECTORY;
+    top->path = malloc(strlen(treePath) + 1);
+    if(top->path == NULL) {
+        free(top);
+        return MEMORY_ERROR;
+    }
+    strcpy(top->path, treePath);
+
+    memset(&work, 0, sizeof(work));
+    work.fsPath = fsPath;
+    work.treePath = top->path;
+    work.flags = flags;
+    work.status = SUCCESS;
+    (void) pthread_mutex_init(&work.lock, NULL);
+    (void) pthread_cond_init(&work.cond, NULL);
+    work.queue = DynArray_new(0);
+    workers = calloc(numThreads, sizeof(struct FT_importWorker));
+    if(work.queue == NULL || workers == NULL
+       || !DynArray_add(work.queue, top->path))
+        result = MEMORY_ERROR;
+    for(w = 0; w < numThreads && result == SUCCESS; w++) {
+        workers[w].work = &work;
+        workers[w].entries = DynArray_new(0);
+        if(workers[w].entries == NULL)
+            result = MEMORY_ERROR;
+    }
+    if(result == SUCCESS) {
+        FT_runTasks(FT_importWorker, workers,
+                    sizeof(struct FT_importWorker), numThreads);
+        result = work.status;
+    }
+
+    /* Gather the entries, the top one first, and sort them into
+    pre-order. */
+    if(result == SUCCESS) {
+        numEntries = 1;
+        for(w = 0; w < numThreads; w++)
+            numEntries += DynArray_getLength(workers[w].entries);
+        found = malloc(numEntries * sizeof(struct FT_importEntry *));
+        entries = malloc(numEntries * sizeof(struct FT_entry));
+        if(found == NULL || entries == NULL)
+            result = MEMORY_ERROR;
+    }
+    if(result == SUCCESS) {
+        found[0] = top;
+        numEntries = 1;
+        for(w = 0; w < numThreads; w++) {
+            DynArray_toArray(workers[w].entries,
+                             (void **)(found + numEntries));
+            numEntries += DynArray_getLength(workers[w].entries);
+        }
+        for(i = 0; i < numEntries; i++) {
+            entries[i].path = found[i]->path;
+            entries[i].index = i;
+        }
+        if(!FT_sortEntries(entries, numEntries, numThreads))
+            result = MEMORY_ERROR;
+    }
+
+    /* The contents read are copied into storage the hierarchy owns,
+    so each buffer is freed with its entry once inserted, and a file
+    later replaced or removed releases its copy. */
+    if(result == SUCCESS) {
+        chain = DynArray_new(0);
+        if(chain == NULL)
+            result = MEMORY_ERROR;
+    }
+    wasOwned = ownedContents;
+    ownedContents = TRUE;
+    for(i = 0; i < numEntries && result == SUCCESS; i++) {
+        shared = FT_sharedComponents(entries[i].path, i == 0
+                                     ? NULL : entries[i - 1].path);
+        if(shared > chainLength)
+            shared = chainLength;
+        entry = found[entries[i].index];
+        result = FT_insertNext(entry->path, entry->type, entry->contents,
+                               entry->length, shared, chain,
+                               &chainLength, &count);
+        FT_walNote(result, entry->type == DIRECTORY
+                   ? FT_WAL_INSERTDIR : FT_WAL_INSERTFILE,
+                   entry->path, NULL, entry->contents, entry->length,
+                   0, 0);
+    }
+    ownedContents = wasOwned;
+
+    FT_freeImportEntry(top, NULL);
+    for(w = 0; workers != NULL && w < numThreads; w++)
+        if(workers[w].entries != NULL) {
+            DynArray_map(workers[w].entries, FT_freeImportEntry, NULL);
+            DynArray_free(workers[w].entries);
+        }
+    if(chain != NULL)
+        DynArray_free(chain);
+    if(work.queue != NULL)
+        DynArray_free(work.queue);
+    (void) pthread_mutex_destroy(&work.lock);
+    (void) pthread_cond_destroy(&work.cond);
+    free(workers);
+    free(found);
+    free(entries);
+    FT_CHECK();
+    return result;
+}
+
+/*--------------------------------------------------------------------*/
+/* Exporting to the file system                                       */
+/*--------------------------------------------------------------------*/
+
+/* A directory of the hierarchy that FT_exportTo has created in the
+   file system, whose children are still to be created. */
+struct FT_exportTask {
+    Node_T node;
+    /* its path in the file system */
+    char *fsPath;
+};
+
+/* The work shared by FT_exportTo's workers on one level. */
+struct FT_exportWork {
+    /* the directories of this level */
+    struct FT_exportTask **tasks;
+    size_t numTasks;
+    /* the next task for a worker to claim, taken atomically */
+    size_t nextTask;
+};
+
+/* One of FT_exportTo's workers. */
+struct FT_exportWorker {
+    struct FT_exportWork *work;
+    /* the directories this worker has created, for the next level */
+    DynArray_T next;
+    /* the first failure this worker met */
+    int status;
+};
+
+/* Frees the struct FT_exportTask pvTask. */
+static void FT_freeExportTask(void *pvTask, void *pvExtra) {
+    struct FT_exportTask *task = pvTask;
+
+    (void) pvExtra;
+    free(task->fsPath);
+    free(task);
+}
+
+/*
+   Returns TRUE if name can name a file in the file system without
+   leaving the directory it is created in, and FALSE otherwise.
+*/
+static boolean FT_exportable(const char *name) {
+    return (boolean)(strcmp(name, ".") && strcmp(name, ".."));
+}
+
+/*
+   Creates the children of task's directory inside it, with mkdirat
+   for directories, which become tasks of worker's next level, and
+   openat and write for files, given their Node_getLength bytes of
+   contents. The directory is opened once for all of its children.
+   Returns SUCCESS, MEMORY_ERROR or IO_ERROR.
+*/
+static int FT_exportChildren(struct FT_exportWorker *worker,
+                             struct FT_exportTask *task) {
+    struct FT_exportTask *child;
+    Node_T n;
+    const char *name;
+    const void *contents;
+    size_t fsLength;
+    size_t c;
+    int dirFd;
+    int fd;
+    int result = SUCCESS;
+
+    dirFd = open(task->fsPath, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+    if(dirFd < 0)
+        return IO_ERROR;
+    fsLength = strlen(task->fsPath);
+    for(c = 0; c < Node_getNumChildren(task->node)
+               && result == SUCCESS; c++) {
+        n = Node_getChild(task->node, c);
+        name = Node_getName(n);
+        if(!FT_exportable(name)) {
+            result = IO_ERROR;
+            break;
+        }
+        if(Node_getType(n) == FT_FILE) {
+            fd = openat(dirFd, name,
+                        O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, 0666);
+            if(fd < 0) {
+                result = IO_ERROR;
+                break;
+            }
+            contents = FT_contentsOf(n);
+            if(contents != NULL
+               && !FT_writeAll(fd, contents, Node_getLength(n)))
+                result = IO_ERROR;
+            if(close(fd) < 0)
+                result = IO_ERROR;
+            continue;
+        }
+
+        /* A directory left by an earlier export is reused. */
+        if(mkdirat(dirFd, name, 0777) < 0 && errno != EEXIST) {
+            result = IO_ERROR;
+            break;
+        }
+        child = malloc(sizeof(struct FT_exportTask));
+        if(child == NULL) {
+            result = MEMORY_ERROR;
+            break;
+        }
+        child->node = n;
+        child->fsPath = malloc(fsLength + strlen(name) + 2);
+        if(child->fsPath == NULL || !DynArray_add(worker->next, child)) {
+            free(child->fsPath);
+            free(child);
+            result = MEMORY_ERROR;
+            break;
+        }
+        strcpy(child->fsPath, task->fsPath);
+        child->fsPath[fsLength] = '/';
+        strcpy(child->fsPath + fsLength + 1, name);
+    }
+    (void) close(dirFd);
+    return result;
+}
+
+/*
+   Runs the FT_exportTo worker pvWorker: claims the directories of the
+   level until none are left, creating the children of each.
+*/
+static void *FT_exportWorker(void *pvWorker) {
+    struct FT_exportWorker *worker = pvWorker;
+    struct FT_exportWork *work = worker->work;
+    size_t t;
+    int result;
+
+    for(;;) {
+        t = __sync_fetch_and_add(&work->nextTask, 1);
+        if(t >= work->numTasks)
+            break;
+        result = FT_exportChildren(worker, work->tasks[t]);
+        if(result != SUCCESS && worker->status == SUCCESS)
+            worker->status = result;
+    }
+    return NULL;
+}
+
+/*
+  Creates the hierarchy inside the directory fsDir of the file system:
+  the root directory, every directory beneath it, and every file with
+  its Node_getLength bytes of contents (none if they are NULL). The
+  hierarchy is created one level at a time, the directories of each
+  level shared among one worker per online processor, each of which
+  opens a directory once and creates all of its children relative to
+  it with mkdirat and openat. Directories that already exist are
+  reused and files that already exist are overwritten.
+  Returns SUCCESS if the whole hierarchy is created.
+  Returns INITIALIZATION_ERROR if not in an initialized state.
+  Returns MEMORY_ERROR if unable to allocate.
+  Returns IO_ERROR if a directory or file cannot be created or
+  written, or if a node is named "." or "..", in which case what was
+  created before remains.
+*/
+static int FT_doExportTo(const char *fsDir) {
+    struct FT_exportWork work;
+    struct FT_exportWorker *workers;
+    struct FT_exportTask *top;
+    DynArray_T level;
+    DynArray_T next;
+    size_t numThreads;
+    size_t numWorkers;
+    size_t w;
+    size_t i;
+    int result = SUCCESS;
+
+    FT_CHECK();
+    assert(fsDir != NULL);
+
+    if(!isInitialized)
+        return INITIALIZATION_ERROR;
+    if(root == NULL)
+        return SUCCESS;
+    if(!FT_exportable(Node_getName(root)))
+        return IO_ERROR;
+    numThreads = FT_defaultThreads(0);
+
+    /* The root is created directly, as the first level's only task. */
+    level = DynArray_new(0);
+    top = malloc(sizeof(struct FT_exportTask));
+    workers = calloc(numThreads, sizeof(struct FT_exportWorker));
+    if(level == NULL || top == NULL || workers == NULL) {
+        if(level != NULL)
+            DynArray_free(level);
+        free(top);
+        free(workers);
+        return MEMORY_ERROR;
+    }
+    top->node = root;
+    top->fsPath = malloc(strlen(fsDir) + strlen(Node_getName(root)) + 2);
+    if(top->fsPath == NULL || !DynArray_add(level, top)) {
+        FT_freeExportTask(top, NULL);
+        result = MEMORY_ERROR;
+    }
+    else {
+        strcpy(top->fsPath, fsDir);
+        strcat(top->fsPath, "/");
+        strcat(top->fsPath, Node_getName(root));
+        if(mkdir(top->fsPath, 0777) < 0 && errno != EEXIST)
+            result = IO_ERROR;
+    }
+
+    while(result == SUCCESS && DynArray_getLength(level) > 0) {
+        work.numTasks = DynArray_getLength(level);
+        work.tasks = malloc(work.numTasks * sizeof(struct FT_exportTask *));
+        if(work.tasks == NULL) {
+            result = MEMORY_ERROR;
+            break;
+        }
+        DynArray_toArray(level, (void **) work.tasks);
+        work.nextTask = 0;
+        numWorkers = numThreads < work.numTasks ? numThreads
+                                                : work.numTasks;
+        for(w = 0; w < numWorkers && result == SUCCESS; w++) {
+            workers[w].work = &work;
+            workers[w].status = SUCCESS;
+            workers[w].next = DynArray_new(0);
+            if(workers[w].next == NULL)
+                result = MEMORY_ERROR;
+        }
+        if(result == SUCCESS)
+            FT_runTasks(FT_exportWorker, workers,
+                        sizeof(struct FT_exportWorker), numWorkers);
+        free(work.tasks);
+
+        /* The directories created on this level make up the next. */
+        DynArray_map(level, FT_freeExportTask, NULL);
+        DynArray_free(level);
+        level = DynArray_new(0);
+        if(level == NULL && result == SUCCESS)
+            result = MEMORY_ERROR;
+        for(w = 0; w < numWorkers; w++) {
+            if(workers[w].next == NULL)
+                continue;
+            if(result == SUCCESS)
+                result = workers[w].status;
+            next = workers[w].next;
+            for(i = 0; i < DynArray_getLength(next); i++)
+                if(result != SUCCESS
+                   || !DynArray_add(level, DynArray_get(next, i))) {
+                    if(result == SUCCESS)
+                        result = MEMORY_ERROR;
+                    FT_freeExportTask(DynArray_get(next, i), NULL);
+                }
+            DynArray_free(next);
+            workers[w].next = NULL;
+        }
+    }
+
+    if(level != NULL) {
+        DynArray_map(level, FT_freeExportTask, NULL);
+        DynArray_free(level);
+    }
+    free(workers);
+    return result;
+}
+
+/*--------------------------------------------------------------------*/
+/* Differences between snapshots                                      */
+/*--------------------------------------------------------------------*/
+
+/* The state of one FT_diff. */
+struct FT_diffState {
+    /* the path of the node being compared, built up in place */
+    char *path;
+    size_t pathLength;
+    size_t pathCapacity;
+    /* the client's function, and its extra argument */
+    void (*pfReport)(const char *path, int change, void *pvExtra);
+    void *pvExtra;
+    /* MEMORY_ERROR once the path cannot grow, SUCCESS until then */
+    int status;
+};
+
+/*
+  Appends "/" (unless the path is empty) and name to state's path.
+  Returns the path's previous length, to be restored by the caller
+  once done with name, or (size_t)-1 if unable to allocate.
+*/
+static size_t FT_diffPush(struct FT_diffState *state, const char *name) {
+    size_t oldLength = state->pathLength;
+    size_t needed;
+    char *grown;
+
+    needed = oldLength + strlen(name) + 2;
+    if(needed > state->pathCapacity) {
+        grown = realloc(state->path, 2 * needed);
+        if(grown == NULL)
+            return (size_t)-1;
+        state->path = grown;
+        state->pathCapacity = 2 * needed;
+    }
+    if(oldLength > 0)
+        state->path[state->pathLength++] = '/';
+    strcpy(state->path + state->pathLength, name);
+    state->pathLength += strlen(name);
+    return oldLength;
+}
+
+/*
+  Returns TRUE if the nodes from and to, which have the same name,
+  hold the same hierarchy, as judged without descending into them: a
+  node that both snapshots share, two nodes with equal hashes already
+  computed by FT_hash, or two files with equal contents. Returns FALSE
+  otherwise, including for two directories it takes descending into
+  to tell apart.
+*/
+static boolean FT_diffSame(Node_T from, Node_T to) {
+    size_t fromHash;
+    size_t toHash;
+    const void *fromContents;
+    const void *toContents;
+
+    if(from == to)
+        return TRUE;
+    if(Node_getKnownHash(from, &fromHash)
+       && Node_getKnownHash(to, &toHash))
+        return (boolean)(fromHash == toHash);
+    if(Node_getType(from) != FT_FILE || Node_getType(to) != FT_FILE)
+        return FALSE;
+    if(Node_getLength(from) != Node_getLength(to))
+        return FALSE;
+    fromContents = FT_contentsOf(from);
+    toContents = FT_contentsOf(to);
+    if(fromContents == NULL || toContents == NULL)
+        return (boolean)(fromContents == toContents);
+    return (boolean)(fromContents == toContents
+                     || !memcmp(fromContents, toContents,
+                                Node_getLength(from)));
+}
+
+static void FT_diffNodes(struct FT_diffState *state, Node_T from,
+                         Node_T to);
+
+/*
+  Compares from and to, either of which may be NULL, as FT_diffNodes
+  does, at state's path extended with the name of the one that is not
+  NULL. Sets state's status on an allocation failure.
+*/
+static void FT_diffChild(struct FT_diffState *state, Node_T from,
+                         Node_T to) {
+    size_t oldLength;
+
+    oldLength = FT_diffPush(state, Node_getName(to != NULL ? to : from));
+    if(oldLength == (size_t)-1) {
+        state->status = MEMORY_ERROR;
+        return;
+    }
+    FT_diffNodes(state, from, to);
+    state->pathLength = oldLength;
+    state->path[oldLength] = '\0';
+}
+
+/*
+  Reports to state's function the differences between the hierarchies
+  from and to, each possibly NULL, at state's path, which both would
+  have: FT_DIFF_REMOVED for from if to is NULL or of the other type,
+  then FT_DIFF_ADDED for to if from is NULL or of the other type,
+  FT_DIFF_CHANGED for two files with different contents, and the
+  differences between the children of two directories, found by
+  merging their sorted arrays. Identical subtrees are skipped, as
+  FT_diffSame judges. Sets state's status on an allocation failure.
+*/
+static void FT_diffNodes(struct FT_diffState *state, Node_T from,
+                         Node_T to) {
+    Node_T fromChild;
+    Node_T toChild;
+    size_t numFrom;
+    size_t numTo;
+    size_t i = 0;
+    size_t j = 0;
+    int compare;
+
+    if(from != NULL && to != NULL && FT_diffSame(from, to))
+        return;
+    if(from != NULL && (to == NULL
+                        || Node_getType(from) != Node_getType(to))) {
+        state->pfReport(state->path, FT_DIFF_REMOVED, state->pvExtra);
+        from = NULL;
+    }
+    if(to != NULL && from == NULL) {
+        state->pfReport(state->path, FT_DIFF_ADDED, state->pvExtra);
+        return;
+    }
+    if(to == NULL)
+        return;
+    if(Node_getType(to) == FT_FILE) {
+        state->pfReport(state->path, FT_DIFF_CHANGED, state->pvExtra);
+        return;
+    }
+
+    numFrom = Node_getNumChildren(from);
+    numTo = Node_getNumChildren(to);
+    while((i < numFrom || j < numTo) && state->status == SUCCESS) {
+        fromChild = i < numFrom ? Node_getChild(from, i) : NULL;
+        toChild = j < numTo ? Node_getChild(to, j) : NULL;
+        if(fromChild == NULL)
+            compare = 1;
+        else if(toChild == NULL)
+            compare = -1;
+        else
+            compare = Node_compare(fromChild, toChild);
+        FT_diffChild(state, compare > 0 ? NULL : fromChild,
+                     compare < 0 ? NULL : toChild);
+        if(compare <= 0)
+            i++;
+        if(compare >= 0)
+            j++;
+    }
+}
+
+/* see ft.h for specification */
+int FT_diff(FT_Snapshot_T from, FT_Snapshot_T to,
+            void (*pfReport)(const char *path, int change,
+                             void *pvExtra),
+            void *pvExtra) {
+    struct FT_diffState state;
+    Node_T fromRoot;
+    Node_T toRoot;
+    int compare;
+
+    assert(from != NULL);
+    assert(to != NULL);
+    assert(pfReport != NULL);
+
+    state.pathCapacity = 64;
+    state.path = malloc(state.pathCapacity);
+    if(state.path == NULL)
+        return MEMORY_ERROR;
+    state.path[0] = '\0';
+    state.pathLength = 0;
+    state.pfReport = pfReport;
+    state.pvExtra = pvExtra;
+    state.status = SUCCESS;
+
+    /* Roots of different names are compared as two siblings would be. */
+    fromRoot = from->root;
+    toRoot = to->root;
+    if(fromRoot == NULL || toRoot == NULL)
+        compare = 0;
+    else
+        compare = Node_compare(fromRoot, toRoot);
+    if(compare > 0)
+        FT_diffChild(&state, NULL, toRoot);
+    if(fromRoot != NULL && state.status == SUCCESS)
+        FT_diffChild(&state, fromRoot, compare == 0 ? toRoot : NULL);
+    if(toRoot != NULL && compare < 0 && state.status == SUCCESS)
+        FT_diffChild(&state, NULL, toRoot);
+    if(fromRoot == NULL && toRoot != NULL)
+        FT_diffChild(&state, NULL, toRoot);
+    free(state.path);
+    return state.status;
+}
+
+/*--------------------------------------------------------------------*/
+/* Views of file contents                                             */
+/*--------------------------------------------------------------------*/
+
+/*
+  Sets *pView to a view of the contents of the file n: their address
+  and length, with a reference taken to them if the tree owns them.
+  Returns MEMORY_ERROR, leaving *pView unchanged, if unable to copy
+  inline contents, and SUCCESS otherwise.
+*/
+static int FT_viewOf(Node_T n, struct FT_View *pView) {
+    void *contents;
+
+    assert(n != NULL);
+    assert(Node_getType(n) == FT_FILE);
+    assert(pView != NULL);
+
+    contents = FT_contentsOf(n);
+    /* Inline contents live and die with the node, so the view gets a
+    counted copy of its own, which stays put however the view is
+    moved. */
+    if(Node_isInline(n)) {
+        contents = Node_storeContents(contents, Node_getLength(n), FALSE);
+        if(contents == NULL)
+            return MEMORY_ERROR;
+        pView->reference = contents;
+    }
+    else if(Node_isStored(n))
+        pView->reference = Node_retainContents(contents);
+    else
+        pView->reference = NULL;
+    pView->contents = contents;
+    pView->length = Node_getLength(n);
+    return SUCCESS;
+}
+
+/*
+  Sets *pView to a view of the contents and length of the file at
+  path, which keeps contents the tree owns alive until FT_releaseView.
+  Returns SUCCESS if path is a file in the hierarchy.
+  Returns INITIALIZATION_ERROR if not in an initialized state.
+  Returns NO_SUCH_PATH if path does not exist in the hierarchy.
+  Returns NOT_A_FILE if path is a directory.
+  Returns MEMORY_ERROR if unable to allocate.
+  On a non-SUCCESS status, *pView is unchanged.
+*/
+static int FT_doGetFileView(char *path, struct FT_View *pView) {
+    Node_T curr;
+
+    FT_CHECK();
+    assert(path != NULL);
+    assert(pView != NULL);
+
+    if(!isInitialized)
+        return INITIALIZATION_ERROR;
+
+    curr = FT_findNode(root, path, FALSE, NULL, NULL);
+    if(curr == NULL)
+        return NO_SUCH_PATH;
+    if(Node_getType(curr) != FT_FILE)
+        return NOT_A_FILE;
+
+    return FT_viewOf(curr, pView);
+}
+
+/*
+  As FT_getFileView, but for path as it was when snapshot was taken:
+  returns SUCCESS, NO_SUCH_PATH, NOT_A_FILE or MEMORY_ERROR.
+*/
+int FT_snapshotGetFileView(FT_Snapshot_T snapshot, char *path,
+                           struct FT_View *pView) {
+    Node_T curr;
+
+    assert(snapshot != NULL);
+    assert(path != NULL);
+    assert(pView != NULL);
+
+    curr = FT_findNode(snapshot->root, path, FALSE, NULL, NULL);
+    if(curr == NULL)
+        return NO_SUCH_PATH;
+    if(Node_getType(curr) != FT_FILE)
+        return NOT_A_FILE;
+
+    return FT_viewOf(curr, pView);
+}
+
+/*
+  Drops the reference *pView holds, if any, after which its contents
+  may be freed.
+*/
+void FT_releaseView(struct FT_View *pView) {
+    assert(pView != NULL);
+
+    if(pView->reference != NULL)
+        Node_releaseContents(pView->reference);
+    pView->contents = NULL;
+    pView->length = 0;
+    pView->reference = NULL;
+}
+
+/*--------------------------------------------------------------------*/
+/* Public entry points: each wraps its FT_do* implementation with the */
+/* instrumentation above, so nested calls between implementations    */
+/* are not counted twice.                                             */
+/*--------------------------------------------------------------------*/
+
+/* see ft.h for specification */
+int FT_insertDir(char *path) {
+    int result;
+
+    FT_STATS_START();
+    result = FT_doInsertDir(path);
+    FT_txNote(result);
+    FT_walNote(result, FT_WAL_INSERTDIR, path, NULL, NULL, 0, 0, 0);
+    FT_STATS_STOP(FT_OP_INSERTDIR, result);
+    return result;
+}
+
+/* see ft.h for specification */
+boolean FT_containsDir(char *path) {
+    boolean result;
+
+    FT_STATS_START();
+    result = FT_doContainsDir(path);
+    FT_STATS_STOP(FT_OP_CONTAINSDIR, result ? SUCCESS : NO_SUCH_PATH);
+    return result;
+}
+
+/* see ft.h for specification */
+int FT_rmDir(char *path) {
+    int result;
+
+    FT_STATS_START();
+    result = FT_doRmDir(path);
+    FT_txNote(result);
+    FT_walNote(result, FT_WAL_RMDIR, path, NULL, NULL, 0, 0, 0);
+    FT_STATS_STOP(FT_OP_RMDIR, result);
+    return result;
+}
+
+/* see ft.h for specification */
+int FT_insertFile(char *path, void *contents, size_t length) {
+    int result;
+
+    FT_STATS_START();
+    result = FT_doInsertFile(path, contents, length);
+    FT_txNote(result);
+    FT_walNote(result, FT_WAL_INSERTFILE, path, NULL, contents, length,
+               0, 0);
+    FT_STATS_STOP(FT_OP_INSERTFILE, result);
+    return result;
+}
+
+/* see ft.h for specification */
+int FT_insertMany(char *paths[], void *contents[], size_t lengths[],
+                  size_t n) {
+    int result;
+
+    FT_STATS_START();
+    result = FT_doInsertMany(paths, contents, lengths, n);
+    FT_txNote(result);
+    FT_STATS_STOP(FT_OP_INSERTMANY, result);
+    return result;
+}
+
+/* see ft.h for specification */
+int FT_build(char *paths[], void *contents[], size_t lengths[],
+             size_t n, size_t numThreads) {
+    int result;
+    size_t i;
+
+    FT_STATS_START();
+    result = FT_doBuild(paths, contents, lengths, n, numThreads);
+    FT_txNote(result);
+    for(i = 0; i < n && result == SUCCESS; i++)
+        FT_walNote(result, FT_WAL_INSERTFILE, paths[i], NULL,
+                   contents == NULL ? NULL : contents[i],
+                   lengths == NULL ? 0 : lengths[i], 0, 0);
+    FT_STATS_STOP(FT_OP_BUILD, result);
+    return result;
+}
+
+/* see ft.h for specification */
+boolean FT_containsFile(char *path) {
+    boolean result;
+
+    FT_STATS_START();
+    result = FT_doContainsFile(path);
+    FT_STATS_STOP(FT_OP_CONTAINSFILE, result ? SUCCESS : NO_SUCH_PATH);
+    return result;
+}
+
+/* see ft.h for specification */
+int FT_rmFile(char *path) {
+    int result;
+
+    FT_STATS_START();
+    result = FT_doRmFile(path);
+    FT_txNote(result);
+    FT_walNote(result, FT_WAL_RMFILE, path, NULL, NULL, 0, 0, 0);
+    FT_STATS_STOP(FT_OP_RMFILE, result);
+    return result;
+}
+
+/* see ft.h for specification */
+void *FT_getFileContents(char *path) {
+    void *result;
+
+    FT_STATS_START();
+    result = FT_doGetFileContents(path);
+    FT_STATS_STOP(FT_OP_GETFILECONTENTS, -1);
+    return result;
+}
+
+/* see ft.h for specification */
+void *FT_replaceFileContents(char *path, void *newContents,
+                             size_t newLength) {
+    void *result;
+    int status;
+
+    FT_STATS_START();
+    result = FT_doReplaceFileContents(path, newContents, newLength,
+                                      &status);
+    FT_txNote(status);
+    FT_walNote(status, FT_WAL_REPLACE, path, NULL, newContents,
+               newLength, 0, 0);
+    FT_STATS_STOP(FT_OP_REPLACEFILECONTENTS, -1);
+    return result;
+}
+
+/* see ft.h for specification */
+int FT_getFileView(char *path, struct FT_View *pView) {
+    int result;
+
+    FT_STATS_START();
+    result = FT_doGetFileView(path, pView);
+    FT_STATS_STOP(FT_OP_GETFILEVIEW, result);
+    return result;
+}
+
+/* see ft.h for specification */
+int FT_stat(char *path, boolean *type, size_t *length) {
+    int result;
+
+    FT_STATS_START();
+    result = FT_doStat(path, type, length);
+    FT_STATS_STOP(FT_OP_STAT, result);
+    return result;
+}
+
+/* see ft.h for specification */
+int FT_du(char *path, size_t *pNodes, size_t *pBytes) {
+    int result;
+
+    FT_STATS_START();
+    result = FT_doDu(path, pNodes, pBytes);
+    FT_STATS_STOP(FT_OP_DU, result);
+    return result;
+}
+
+/* see ft.h for specification */
+int FT_hash(char *path, size_t *pHash) {
+    int result;
+
+    FT_STATS_START();
+    result = FT_doHash(path, pHash);
+    FT_STATS_STOP(FT_OP_HASH, result);
+    return result;
+}
+
+/* see ft.h for specification */
+int FT_setQuota(char *path, size_t maxNodes, size_t maxBytes) {
+    int result;
+
+    FT_STATS_START();
+    result = FT_doSetQuota(path, maxNodes, maxBytes);
+    FT_txNote(result);
+    FT_walNote(result, FT_WAL_SETQUOTA, path, NULL, NULL, 0, maxNodes,
+               maxBytes);
+    FT_STATS_STOP(FT_OP_SETQUOTA, result);
+    return result;
+}
+
+/* see ft.h for specification */
+int FT_move(char *oldPath, char *newPath) {
+    int result;
+
+    FT_STATS_START();
+    result = FT_doMove(oldPath, newPath);
+    FT_txNote(result);
+    FT_walNote(result, FT_WAL_MOVE, oldPath, newPath, NULL, 0, 0, 0);
+    FT_STATS_STOP(FT_OP_MOVE, result);
+    return result;
+}
+
+/* see ft.h for specification */
+int FT_copy(char *srcPath, char *dstPath) {
+    int result;
+
+    FT_STATS_START();
+    result = FT_doCopy(srcPath, dstPath);
+    FT_txNote(result);
+    FT_walNote(result, FT_WAL_COPY, srcPath, dstPath, NULL, 0, 0, 0);
+    FT_STATS_STOP(FT_OP_COPY, result);
+    return result;
+}
+
+/* see ft.h for specification */
+FT_Snapshot_T FT_snapshot(void) {
+    FT_Snapshot_T result;
+
+    FT_STATS_START();
+    result = FT_doSnapshot();
+    FT_STATS_STOP(FT_OP_SNAPSHOT, -1);
+    return result;
+}
+
+/* see ft.h for specification */
+int FT_begin(void) {
+    int result;
+
+    FT_STATS_START();
+    result = FT_doBegin();
+    FT_STATS_STOP(FT_OP_BEGIN, result);
+    return result;
+}
+
+/* see ft.h for specification */
+int FT_commit(void) {
+    int result;
+
+    FT_STATS_START();
+    result = FT_doCommit();
+    FT_STATS_STOP(FT_OP_COMMIT, result);
+    return result;
+}
+
+/* see ft.h for specification */
+int FT_abort(void) {
+    int result;
+
+    FT_STATS_START();
+    result = FT_doAbort();
+    FT_STATS_STOP(FT_OP_ABORT, result);
+    return result;
+}
+
+/* see ft.h for specification */
+int FT_save(int fd) {
+    int result;
+
+    FT_STATS_START();
+    result = FT_doSave(fd);
+    FT_STATS_STOP(FT_OP_SAVE, result);
+    return result;
+}
+
+/* see ft.h for specification */
+int FT_load(int fd) {
+    int result;
+
+    FT_STATS_START();
+    result = FT_doLoad(fd);
+    FT_txNote(result);
+    FT_STATS_STOP(FT_OP_LOAD, result);
+    return result;
+}
+
+/* see ft.h for specification */
+int FT_saveImage(int fd) {
+    int result;
+
+    FT_STATS_START();
+    result = FT_doSaveImage(fd);
+    FT_STATS_STOP(FT_OP_SAVEIMAGE, result);
+    return result;
+}
+
+/* see ft.h for specification */
+int FT_openLog(int fd) {
+    int result;
+
+    FT_STATS_START();
+    result = FT_doOpenLog(fd);
+    FT_STATS_STOP(FT_OP_OPENLOG, result);
+    return result;
+}
+
+/* see ft.h for specification */
+int FT_closeLog(void) {
+    int result;
+
+    FT_STATS_START();
+    result = FT_doCloseLog();
+    FT_STATS_STOP(FT_OP_CLOSELOG, result);
+    return result;
+}
+
+/* see ft.h for specification */
+int FT_recover(int imageFd, int logFd) {
+    int result;
+
+    FT_STATS_START();
+    result = FT_doRecover(imageFd, logFd);
+    FT_STATS_STOP(FT_OP_RECOVER, result);
+    return result;
+}
+
+/* see ft.h for specification */
+int FT_importDir(const char *fsPath, const char *treePath, int flags) {
+    int result;
+
+    FT_STATS_START();
+    result = FT_doImportDir(fsPath, treePath, flags);
+    FT_txNote(result);
+    FT_STATS_STOP(FT_OP_IMPORTDIR, result);
+    return result;
+}
+
+/* see ft.h for specification */
+int FT_exportTo(const char *fsDir) {
+    int result;
+
+    FT_STATS_START();
+    result = FT_doExportTo(fsDir);
+    FT_STATS_STOP(FT_OP_EXPORTTO, result);
+    return result;
+}
+
+/* see ft.h for specification */
+int FT_init(void) {
+    int result;
+
+    FT_STATS_START();
+    result = FT_doInit();
+    FT_STATS_STOP(FT_OP_INIT, result);
+    return result;
+}
+
+/* see ft.h for specification */
+int FT_destroy(void) {
+    int result;
+
+    FT_STATS_START();
+    result = FT_doDestroy();
+    FT_STATS_STOP(FT_OP_DESTROY, result);
+    return result;
+}
+
+/* see ft.h for specification */
+char *FT_toString(void) {
+    char *result;
+
+    FT_STATS_START();
+    result = FT_doToString();
+    FT_STATS_STOP(FT_OP_TOSTRING, -1);
+    return result;
+}
+
+/* see ft.h for specification */
+char *FT_toStringParallel(size_t numThreads) {
+    char *result;
+
+    FT_STATS_START();
+    result = FT_doToStringParallel(numThreads);
+    FT_STATS_STOP(FT_OP_TOSTRINGPARALLEL, -1);
+    return result;
+}
+
+/* see ft.h for specification */
+void FT_getStats(struct FT_Stats *pStats) {
+    assert(pStats != NULL);
+
+#ifdef FT_STATS
+    *pStats = stats;
+#else
+    memset(pStats, 0, sizeof(*pStats));
+#endif
+}
+
+/* see ft.h for specification */
+void FT_resetStats(void) {
+#ifdef FT_STATS
+    memset(&stats, 0, sizeof(stats));
+#endif
+}
@@ -22,6 +22,8 @@
    Returns CONFLICTING_PATH if path is not underneath existing root.
    Returns NOT_A_DIRECTORY if a proper prefix of path exists as a file.
    Returns ALREADY_IN_TREE if the path already exists (as dir or file).
+   Returns QUOTA_EXCEEDED if the new directories would exceed the quota
+                          of a directory above them.
    Returns MEMORY_ERROR if unable to allocate any node or any field.
    Returns PARENT_CHILD_ERROR if a parent cannot link to a new child.
 */
@@ -39,6 +41,7 @@ boolean FT_containsDir(char *path);
   Returns INITIALIZATION_ERROR if not in an initialized state.
   Returns NOT_A_DIRECTORY if path exists but is a file not a directory.
   Returns NO_SUCH_PATH if the path does not exist in the hierarchy.
+  Returns MEMORY_ERROR if unable to copy a node shared by FT_copy.
 */
 int FT_rmDir(char *path);
 
@@ -51,11 +54,103 @@ int FT_rmDir(char *path);
                             or if path would be the FT root.
    Returns NOT_A_DIRECTORY if a proper prefix of path exists as a file.
    Returns ALREADY_IN_TREE if the path already exists (as dir or file).
+   Returns QUOTA_EXCEEDED if the new nodes or length would exceed the
+                          quota of a directory above them.
    Returns MEMORY_ERROR if unable to allocate any node or any field.
    Returns PARENT_CHILD_ERROR if a parent cannot link to a new child.
 */
 int FT_insertFile(char *path, void *contents, size_t length);
 
+/*
+   Inserts the n files paths[i], with contents contents[i] of size
+   lengths[i] bytes, in order, creating missing directories as
+   FT_insertFile does. contents or lengths may be NULL to give every
+   file NULL contents or length 0.
+   Input sorted in strcmp order is loaded in time linear in the total
+   path length: each path reuses the ancestors resolved for the
+   previous one, and new nodes are appended after their parent's last
+   child without searching or shifting. Unsorted input is accepted but
+   falls back to binary searches where needed.
+   Returns SUCCESS if every file is inserted.
+   Returns INITIALIZATION_ERROR if not in an initialized state.
+   Otherwise stops at the first path that cannot be inserted and
+   returns the status FT_insertFile would have returned for it; the
+   files before it remain inserted.
+*/
+int FT_insertMany(char *paths[], void *contents[], size_t lengths[],
+                  size_t n);
+
+/*
+   Builds the hierarchy of the n files paths[i], with contents
+   contents[i] of size lengths[i] bytes, into the empty tree, using
+   numThreads threads (0 for one per online processor). The paths may
+   be in any order. They are sorted in parallel, split into one group
+   per subtree directly beneath the root, and the groups are built
+   concurrently and then linked under the root, giving the same tree
+   as FT_insertFile on each path in turn. contents or lengths may be
+   NULL as for FT_insertMany.
+   Returns SUCCESS if every file is inserted.
+   Returns INITIALIZATION_ERROR if not in an initialized state.
+   Returns CONFLICTING_PATH if the tree is not empty, if the paths are
+                            not all underneath one root, or if a path
+                            would be the root.
+   Returns ALREADY_IN_TREE if a path appears more than once.
+   Returns NOT_A_DIRECTORY if a proper prefix of a path is also a file.
+   Returns MEMORY_ERROR if unable to allocate, or if the tree would not
+                        fit the memory budget.
+   On any error the tree is left empty.
+*/
+int FT_build(char *paths[], void *contents[], size_t lengths[],
+             size_t n, size_t numThreads);
+
+/* Flags for FT_importDir. */
+enum { FT_IMPORT_CONTENTS = 1 };
+
+/*
+   Imports the directory fsPath of the file system, with every
+   directory and regular file beneath it, as the new directory
+   treePath, creating any missing directories above it as
+   FT_insertDir does. Other kinds of file, such as symbolic links, are
+   skipped. The directories are listed with getdents64 on a pool of
+   one thread per online processor; the entries found are then sorted
+   in parallel and inserted as one sorted bulk insert, as
+   FT_insertMany does for sorted input. If flags includes
+   FT_IMPORT_CONTENTS, each file's bytes are read, on the same
+   threads, and copied into contents the tree owns, as with
+   FT_setOwnedContents enabled; otherwise files get NULL contents and
+   length 0.
+   Returns SUCCESS if the whole directory is imported.
+   Returns INITIALIZATION_ERROR if not in an initialized state.
+   Returns IO_ERROR if a directory or file cannot be read, in which
+                    case nothing is inserted.
+   Returns MEMORY_ERROR if unable to allocate.
+   Otherwise returns the status FT_insertDir or FT_insertFile would
+   return for the first entry that cannot be inserted (ALREADY_IN_TREE
+   if treePath exists, for instance); the entries before it remain
+   inserted.
+*/
+int FT_importDir(const char *fsPath, const char *treePath, int flags);
+
+/*
+   Creates the hierarchy inside the existing directory fsDir of the
+   file system, the reverse of FT_importDir: the root becomes fsDir's
+   subdirectory of the same name, and every directory and file
+   beneath it is created, each file holding its Node_getLength bytes
+   of contents (none if they are NULL). The hierarchy is created one
+   level at a time by a pool of one thread per online processor, each
+   directory being opened once to create all of its children with
+   mkdirat and openat. Directories that already exist are reused and
+   files that already exist are overwritten; symbolic links are never
+   followed beneath fsDir.
+   Returns SUCCESS if the whole hierarchy is created (or is empty).
+   Returns INITIALIZATION_ERROR if not in an initialized state.
+   Returns MEMORY_ERROR if unable to allocate.
+   Returns IO_ERROR if a directory or file cannot be created or
+                    written, or if a node is named "." or "..", which
+                    no file can be; what was created remains.
+*/
+int FT_exportTo(const char *fsDir);
+
 /*
   Returns TRUE if the tree contains the full path parameter as a
   file and FALSE otherwise.
@@ -68,6 +163,7 @@ boolean FT_containsFile(char *path);
   Returns INITIALIZATION_ERROR if not in an initialized state.
   Returns NOT_A_FILE if path exists but is a directory not a file.
   Returns NO_SUCH_PATH if the path does not exist in the hierarchy.
+  Returns MEMORY_ERROR if unable to copy a node shared by FT_copy.
 */
 int FT_rmFile(char *path);
 
@@ -84,7 +180,11 @@ void *FT_getFileContents(char *path);
   Replaces current contents of the file at the full path parameter with
   the parameter newContents of size newLength.
   Returns the old contents if successful. (Note: contents may be NULL.)
-  Returns NULL if the path does not already exist or is a directory.
+  Returns NULL if the path does not already exist or is a directory,
+  if newLength would exceed the byte quota of a directory above the
+  file, or if contents the tree owns (see FT_setOwnedContents) cannot
+  be copied or would not fit the memory budget, in which case the file
+  is left unchanged.
 */
 void *FT_replaceFileContents(char *path, void *newContents,
                              size_t newLength);
@@ -103,6 +203,38 @@ void *FT_replaceFileContents(char *path, void *newContents,
  */
 int FT_stat(char *path, boolean *type, size_t *length);
 
+/*
+  Reports the size of the hierarchy at path: *pNodes is set to the
+  number of directories and files beneath path (0 for a file), and
+  *pBytes to the summed length of the files at or beneath it. Every
+  directory keeps these totals up to date as the tree changes, so the
+  cost is that of finding path, independent of what lies beneath it.
+  Returns SUCCESS if path exists in the hierarchy,
+  returns NO_SUCH_PATH if it does not, and
+  returns INITIALIZATION_ERROR if the structure is not initialized.
+  When returning a non-SUCCESS status, *pNodes and *pBytes are
+  unchanged.
+*/
+int FT_du(char *path, size_t *pNodes, size_t *pBytes);
+
+/*
+  Sets *pHash to a hash of the hierarchy at path, over each node's
+  name and type and, for a file, its length and contents or, for a
+  directory, the hashes of its children in order. Equal hierarchies
+  have equal hashes, in this process or another built the same way,
+  so two replicas can compare their roots and descend only into the
+  children whose hashes differ. Each node keeps its hash until the
+  tree changes at or beneath it, so the cost is proportional to what
+  changed since the last call. Contents changed in place, without
+  FT_replaceFileContents, are not noticed. The hash has as many bits
+  as a size_t.
+  Returns SUCCESS if path exists in the hierarchy,
+  returns NO_SUCH_PATH if it does not, and
+  returns INITIALIZATION_ERROR if the structure is not initialized.
+  When returning a non-SUCCESS status, *pHash is unchanged.
+*/
+int FT_hash(char *path, size_t *pHash);
+
 /*
   Sets the data structure to initialized status.
   The data structure is initially empty.
@@ -129,4 +261,566 @@ int FT_destroy(void);
 */
 char *FT_toString(void);
 
+/*
+  Returns the same string as FT_toString, built by numThreads threads
+  (0 for one per online processor): each subtree beneath the root is
+  sized and then written by one thread, directly into its own region
+  of the result.
+  Returns NULL if the structure is not initialized or there is an
+  allocation error. The returned string is owned by the client.
+*/
+char *FT_toStringParallel(size_t numThreads);
+
+/*
+  Stores in *pUsage the bytes currently held by the tree's nodes,
+  names, child arrays and file bookkeeping, together with its
+  node and file counts. Takes constant time.
+  Returns INITIALIZATION_ERROR if not in an initialized state,
+  and SUCCESS otherwise.
+*/
+int FT_memoryUsage(struct MemoryUsage *pUsage);
+
+/*
+  Limits the bytes held by the tree's nodes and the copies of contents
+  it stores, as reported by FT_memoryUsage, to maxBytes; 0 removes the
+  limit. FT_insertDir and FT_insertFile return MEMORY_ERROR, before
+  allocating anything, when the nodes they would create, with any
+  stored copy of the new file's contents, do not fit, and
+  FT_replaceFileContents returns NULL when the copy for a file it
+  grows does not fit. A copy that the content store shares is counted
+  as if new. The limit lasts until FT_destroy.
+  Returns INITIALIZATION_ERROR if not in an initialized state,
+  and SUCCESS otherwise.
+*/
+int FT_setMemoryBudget(size_t maxBytes);
+
+/*
+  Limits the hierarchy beneath the directory path to at most maxNodes
+  directories and files and at most maxBytes bytes of file contents
+  (by their lengths); 0 leaves either unlimited. Inserts and content
+  replacements that would take the directory past either limit are
+  rejected, checked against the quotas of every directory along the
+  path. A quota may be set below current usage, in which case it only
+  prevents further growth. Quotas are removed with their directory.
+  Returns SUCCESS if the quota is set.
+  Returns INITIALIZATION_ERROR if not in an initialized state.
+  Returns NOT_A_DIRECTORY if path is a file.
+  Returns NO_SUCH_PATH if path does not exist in the hierarchy.
+  Returns MEMORY_ERROR if unable to copy a node shared by FT_copy.
+*/
+int FT_setQuota(char *path, size_t maxNodes, size_t maxBytes);
+
+/*
+  Moves the file or directory at oldPath, together with everything
+  beneath it, to newPath, as rename(2) does. newPath's parent must
+  already exist as a directory. Nodes store only their own names, so
+  the subtree is relinked rather than copied: the cost is that of
+  finding both paths, independent of the subtree's size.
+  Returns SUCCESS if the node is moved.
+  Returns INITIALIZATION_ERROR if not in an initialized state.
+  Returns NO_SUCH_PATH if oldPath does not exist in the hierarchy,
+                       or newPath's parent does not.
+  Returns CONFLICTING_PATH if oldPath is the root, newPath is not
+                           underneath the root, or newPath lies
+                           within oldPath.
+  Returns ALREADY_IN_TREE if newPath already exists.
+  Returns NOT_A_DIRECTORY if a proper prefix of newPath is a file.
+  Returns QUOTA_EXCEEDED if the moved nodes or contents would take a
+                         directory above newPath past its quota.
+  Returns MEMORY_ERROR if unable to allocate the new name or to copy
+                      a node shared by FT_copy.
+  On a non-SUCCESS status the hierarchy is unchanged.
+*/
+int FT_move(char *oldPath, char *newPath);
+
+/*
+  Copies the file or directory at srcPath, together with everything
+  beneath it, to dstPath, whose parent must already exist as a
+  directory. The copy shares the source's nodes and file contents
+  references rather than duplicating them, so it takes time
+  proportional to the number of children of srcPath, whose references
+  its one new node takes, independent of the size of the hierarchy
+  beneath them; a shared node is copied only when a later call is
+  about to change the hierarchy beneath or at it, in either place.
+  Both copies count towards FT_du and quotas in full.
+  Returns SUCCESS if the hierarchy is copied.
+  Returns INITIALIZATION_ERROR if not in an initialized state.
+  Returns NO_SUCH_PATH if srcPath does not exist in the hierarchy,
+                       or dstPath's parent does not.
+  Returns CONFLICTING_PATH if srcPath is the root, dstPath is not
+                           underneath the root, or dstPath lies
+                           within srcPath.
+  Returns ALREADY_IN_TREE if dstPath already exists.
+  Returns NOT_A_DIRECTORY if a proper prefix of dstPath is a file.
+  Returns QUOTA_EXCEEDED if the copy would take a directory above
+                         dstPath past its quota.
+  Returns MEMORY_ERROR if unable to allocate the copy.
+  On a non-SUCCESS status the hierarchy is unchanged.
+*/
+int FT_copy(char *srcPath, char *dstPath);
+
+/*
+  Makes FT_rmDir and FT_destroy free any subtree of more than threshold
+  nodes on numThreads threads (0 for one per online processor), which
+  share the work by stealing subtrees from one another; threshold 0,
+  the default, frees every subtree on the calling thread. The setting
+  lasts until FT_destroy.
+  Returns INITIALIZATION_ERROR if not in an initialized state,
+  and SUCCESS otherwise.
+*/
+int FT_setParallelDestroy(size_t threshold, size_t numThreads);
+
+/*
+  Makes FT_rmDir, if enable is TRUE, only unlink the removed subtree
+  and hand it to a background thread to free, so that it returns
+  without visiting any node beneath the one removed; with enable
+  FALSE, the default, subtrees are freed before FT_rmDir returns.
+  Memory freed in the background is reported by FT_memoryUsage, and
+  counted against the memory budget, once it has actually been freed.
+  FT_destroy waits for all pending reclamation. The setting lasts
+  until FT_destroy.
+  Returns INITIALIZATION_ERROR if not in an initialized state,
+  and SUCCESS otherwise.
+*/
+int FT_setAsyncReclaim(boolean enable);
+
+/*
+  Makes FT_insertFile, FT_insertMany, FT_build and
+  FT_replaceFileContents, if enable is TRUE, copy the contents they
+  are given into a content store instead of keeping the client's
+  pointer, so that the client may reuse or free its buffer at once.
+  The store hashes the bytes and keeps a single reference-counted copy
+  of them for all the files that hold equal contents, which is freed
+  once the last such file is removed, so the memory held for contents
+  shrinks with their duplication; FT_copy and snapshots share copies
+  likewise. Stored contents, as returned by FT_getFileContents, belong
+  to the tree and must not be changed or freed; those returned by
+  FT_replaceFileContents stay valid until the next
+  FT_replaceFileContents or FT_destroy. Files inserted while the store
+  is off keep the client's pointers. FT_memoryUsage reports the
+  store's size as storedBytes. With enable FALSE, the default, no
+  contents are copied. The setting lasts until FT_destroy.
+  Returns INITIALIZATION_ERROR if not in an initialized state,
+  and SUCCESS otherwise.
+*/
+int FT_setContentStore(boolean enable);
+
+/*
+  The most bytes of contents that the tree keeps inline, inside the
+  file's node itself, when it owns them.
+*/
+enum { FT_INLINE_MAX = 48 };
+
+/*
+  Makes FT_insertFile, FT_insertMany, FT_build and
+  FT_replaceFileContents, if enable is TRUE, copy the contents they
+  are given into storage the tree owns, one reference-counted copy per
+  file, instead of keeping the client's pointer; the client keeps
+  ownership of its own buffer, and may reuse or free it at once. Owned
+  contents are returned as by FT_setContentStore, which also owns
+  contents but shares equal ones, and are best read through
+  FT_getFileView, whose view stays valid however the file is later
+  replaced or removed. Contents of up to FT_INLINE_MAX bytes given to
+  a file as it is inserted are copied into the file node itself, as
+  are later replacements that still fit there, so reading them touches
+  no other allocation; this applies under the content store too, where
+  such small contents are not shared. Owned copies, inline or not,
+  count against the memory budget (see FT_setMemoryBudget). With
+  enable FALSE, the default, contents are owned by the client unless
+  the content store is on. The setting lasts until FT_destroy.
+  Returns INITIALIZATION_ERROR if not in an initialized state,
+  and SUCCESS otherwise.
+*/
+int FT_setOwnedContents(boolean enable);
+
+/*
+  Waits until every subtree handed to the background thread by
+  FT_rmDir has been freed.
+  Returns INITIALIZATION_ERROR if not in an initialized state,
+  and SUCCESS otherwise.
+*/
+int FT_flushReclaim(void);
+
+/*
+  A read-only, point-in-time view of the hierarchy, as returned by
+  FT_snapshot.
+*/
+typedef struct FT_Snapshot *FT_Snapshot_T;
+
+/*
+  Returns a snapshot of the hierarchy as it is now, or NULL if the
+  structure is not initialized or there is an allocation error. The
+  snapshot shares every node with the hierarchy, so taking it costs
+  constant time; afterwards each change to the hierarchy first copies
+  the shared nodes on its path from the root, costing time
+  proportional to the path's depth once per node. The snapshot stays
+  valid, and unchanged, until FT_freeSnapshot, even across
+  FT_destroy. The FT_snapshot* queries may run on other threads
+  concurrently with calls that change the hierarchy; FT_snapshot and
+  FT_freeSnapshot may not.
+*/
+FT_Snapshot_T FT_snapshot(void);
+
+/*
+  Returns TRUE if snapshot contains path as a directory and FALSE
+  otherwise.
+*/
+boolean FT_snapshotContainsDir(FT_Snapshot_T snapshot, char *path);
+
+/*
+  Returns TRUE if snapshot contains path as a file and FALSE
+  otherwise.
+*/
+boolean FT_snapshotContainsFile(FT_Snapshot_T snapshot, char *path);
+
+/*
+  Returns the contents the file at path had when snapshot was taken,
+  or NULL if the path does not exist in snapshot or is a directory.
+*/
+void *FT_snapshotGetFileContents(FT_Snapshot_T snapshot, char *path);
+
+/*
+  As FT_stat, for path as it was when snapshot was taken: returns
+  SUCCESS if path exists in snapshot and NO_SUCH_PATH if it does not.
+*/
+int FT_snapshotStat(FT_Snapshot_T snapshot, char *path, boolean *type,
+                    size_t *length);
+
+/*
+  Returns the string FT_toString returned when snapshot was taken, or
+  NULL if there is an allocation error. The string is owned by the
+  client.
+*/
+char *FT_snapshotToString(FT_Snapshot_T snapshot);
+
+/*
+  Frees snapshot, together with any nodes only it still refers to.
+*/
+void FT_freeSnapshot(FT_Snapshot_T snapshot);
+
+/*
+  A read-only view of a file's contents, from FT_getFileView or
+  FT_snapshotGetFileView, to be released with FT_releaseView.
+*/
+struct FT_View {
+  /* the contents, which must not be changed, and their length */
+  const void *contents;
+  size_t length;
+  /* the reference that keeps contents owned by the tree alive, or
+     NULL for contents that belong to the client */
+  void *reference;
+};
+
+/*
+  Sets *pView to the contents of the file at path and their length,
+  read together in one call. Contents the tree owns (see
+  FT_setOwnedContents and FT_setContentStore) stay valid, and
+  unchanged, until FT_releaseView, even if the file is replaced,
+  removed or destroyed in the meantime, and FT_releaseView may be
+  called on any thread. Contents that belong to the client are valid
+  for as long as the client keeps them. Contents kept inline in the
+  file's node are copied for the view, so that the view may be copied
+  or moved freely.
+  Returns SUCCESS if path is a file in the hierarchy.
+  Returns INITIALIZATION_ERROR if not in an initialized state.
+  Returns NO_SUCH_PATH if path does not exist in the hierarchy.
+  Returns NOT_A_FILE if path is a directory.
+  Returns MEMORY_ERROR if unable to copy inline contents.
+  When returning a non-SUCCESS status, *pView is unchanged.
+*/
+int FT_getFileView(char *path, struct FT_View *pView);
+
+/*
+  As FT_getFileView, for path as it was when snapshot was taken:
+  returns SUCCESS, NO_SUCH_PATH, NOT_A_FILE or MEMORY_ERROR. May run
+  on other threads concurrently with calls that change the hierarchy,
+  as the other FT_snapshot* queries may.
+*/
+int FT_snapshotGetFileView(FT_Snapshot_T snapshot, char *path,
+                           struct FT_View *pView);
+
+/*
+  Releases the view *pView, after which its contents may be freed,
+  and empties it.
+*/
+void FT_releaseView(struct FT_View *pView);
+
+/* The kinds of change that FT_diff reports. */
+enum { FT_DIFF_ADDED, FT_DIFF_REMOVED, FT_DIFF_CHANGED };
+
+/*
+  Calls (*pfReport)(path, change, pvExtra) for each change that turns
+  the hierarchy in snapshot from into the one in snapshot to, in
+  pre-order of path. The edit script is minimal: a subtree only in to
+  is reported once as FT_DIFF_ADDED at its top, one only in from once
+  as FT_DIFF_REMOVED, a path that holds a file in one and a directory
+  in the other as FT_DIFF_REMOVED followed by FT_DIFF_ADDED, and a
+  file whose length or contents differ as FT_DIFF_CHANGED. The two
+  trees are walked in lockstep, merging each directory's sorted
+  children, and subtrees are skipped without being visited when they
+  are shared between the snapshots or, where FT_hash has computed
+  them, have equal hashes. The path passed to pfReport is valid only
+  during the call. FT_diff may run with the same calls as the
+  FT_snapshot* queries, except FT_hash.
+  Returns SUCCESS once every change is reported.
+  Returns MEMORY_ERROR if unable to allocate, in which case only some
+  changes may have been reported.
+*/
+int FT_diff(FT_Snapshot_T from, FT_Snapshot_T to,
+            void (*pfReport)(const char *path, int change,
+                             void *pvExtra),
+            void *pvExtra);
+
+/*
+  Starts a transaction: the calls that change the hierarchy from here
+  until FT_commit or FT_abort take effect together or not at all.
+  Starting one costs constant time, and each change made in it copies
+  only the nodes on its path, as after FT_snapshot. The whole-tree
+  validation that debug builds run on every call is skipped inside a
+  transaction and run once by FT_commit. Settings such as the memory
+  budget are not part of a transaction.
+  Returns SUCCESS if the transaction is started.
+  Returns INITIALIZATION_ERROR if not in an initialized state or if a
+  transaction is already in progress.
+*/
+int FT_begin(void);
+
+/*
+  Ends the transaction in progress. If every call in it that changes
+  the hierarchy succeeded, its changes are kept; otherwise all of them
+  are rolled back, leaving the hierarchy as it was at FT_begin.
+  (FT_replaceFileContents counts as failing when it returns NULL
+  because the path is not a file or a quota would be exceeded.)
+  Returns SUCCESS if the changes are kept.
+  Returns INITIALIZATION_ERROR if not in an initialized state or if no
+  transaction is in progress.
+  Otherwise returns the status of the first call that failed.
+*/
+int FT_commit(void);
+
+/*
+  Ends the transaction in progress, rolling back all of its changes,
+  in time proportional to the nodes it changed.
+  Returns SUCCESS if the changes are rolled back.
+  Returns INITIALIZATION_ERROR if not in an initialized state or if no
+  transaction is in progress.
+*/
+int FT_abort(void);
+
+/*
+  Writes the whole hierarchy to the file descriptor fd, which must be
+  open for writing, in a compact binary format: a header, then the
+  names of all nodes, then a fixed-size record for each node (its
+  type, number of children, length and quota), then the contents of
+  all files, each part in pre-order. Sizes are written as 8-byte
+  little-endian integers, so the format does not depend on the host.
+  A file's contents are saved as its length bytes, or as NULL.
+  Returns SUCCESS if the hierarchy is written.
+  Returns INITIALIZATION_ERROR if not in an initialized state.
+  Returns MEMORY_ERROR if unable to allocate memory to write with.
+  Returns IO_ERROR if a write to fd fails.
+*/
+int FT_save(int fd);
+
+/*
+  Reads a hierarchy written by FT_save from the file descriptor fd,
+  which must be open for reading, into the empty hierarchy, in one
+  pass over the stream that resolves no paths. The contents of the
+  loaded files are allocated by FT_load and owned by the hierarchy
+  until FT_destroy: replacing them with FT_replaceFileContents returns
+  the loaded contents to the caller, who must not free them.
+  Returns SUCCESS if the hierarchy is loaded.
+  Returns INITIALIZATION_ERROR if not in an initialized state.
+  Returns CONFLICTING_PATH if the hierarchy is not empty.
+  Returns MEMORY_ERROR if unable to allocate any node or field.
+  Returns IO_ERROR if a read from fd fails or what is read is not a
+  hierarchy written by FT_save.
+  On any status other than SUCCESS the hierarchy remains empty.
+*/
+int FT_load(int fd);
+
+/*
+  A read-only hierarchy mapped into memory from an image saved by
+  FT_saveImage, as returned by FT_mapImage.
+*/
+typedef struct FT_Image *FT_Image_T;
+
+/*
+  Writes the whole hierarchy to the file descriptor fd, which must be
+  open for writing at its start and able to seek, as an image that
+  FT_mapImage can query in place: each node is a fixed-size record
+  holding the offsets of its name and of its contents or of a sorted
+  array of its children's offsets. Quotas are not saved.
+  Returns SUCCESS if the hierarchy is written.
+  Returns INITIALIZATION_ERROR if not in an initialized state.
+  Returns MEMORY_ERROR if unable to allocate memory to write with.
+  Returns IO_ERROR if a write to or seek on fd fails.
+*/
+int FT_saveImage(int fd);
+
+/*
+  Maps the image in the file open as fd into memory, read-only and
+  shared, and returns a handle to query it with, or NULL if fd cannot
+  be mapped or does not hold an image. Nothing is read or allocated
+  beyond the handle: the FT_image* queries walk the mapped pages
+  directly, so processes that map the same image share them in the
+  page cache. An image is independent of the hierarchy, which need
+  not even be initialized, and fd may be closed once it is mapped.
+  A damaged image may give wrong answers, but is never read outside
+  the mapping.
+*/
+FT_Image_T FT_mapImage(int fd);
+
+/*
+  Returns TRUE if image contains path as a directory and FALSE
+  otherwise.
+*/
+boolean FT_imageContainsDir(FT_Image_T image, char *path);
+
+/*
+  Returns TRUE if image contains path as a file and FALSE otherwise.
+*/
+boolean FT_imageContainsFile(FT_Image_T image, char *path);
+
+/*
+  Returns the contents of the file at path in image, served in place
+  from the mapping and valid until FT_unmapImage, or NULL if the path
+  does not exist there, is a directory, or has NULL contents.
+*/
+const void *FT_imageGetFileContents(FT_Image_T image, char *path);
+
+/*
+  As FT_stat, but for path in image: returns SUCCESS, setting *type
+  and (for a file) *length, if path exists there, and NO_SUCH_PATH,
+  leaving them unchanged, if it does not.
+*/
+int FT_imageStat(FT_Image_T image, char *path, boolean *type,
+                 size_t *length);
+
+/*
+  Unmaps image and frees its handle.
+*/
+void FT_unmapImage(FT_Image_T image);
+
+/*
+  Starts a write-ahead log of the hierarchy in fd, which must be open
+  for writing at the end of the log: from here on, every call that
+  changes the hierarchy -- FT_insertDir, FT_insertFile, FT_insertMany,
+  FT_build, FT_rmDir, FT_rmFile, FT_replaceFileContents,
+  FT_setQuota, FT_move and FT_copy -- appends a compact record of
+  itself once it succeeds (for a transaction, once FT_commit keeps
+  it). Records are held in memory until FT_syncLog writes them.
+  FT_load is not logged: after it, save the hierarchy with FT_save
+  and start a new log. The log stays open until FT_closeLog or
+  FT_destroy; fd is not closed.
+  Returns SUCCESS if the log is started.
+  Returns INITIALIZATION_ERROR if not in an initialized state, if a
+  log is already open or if fd is negative.
+*/
+int FT_openLog(int fd);
+
+/*
+  Makes every change logged before the call durable, by writing its
+  record to the log and syncing the log with fdatasync. May be called
+  from any thread, concurrently with other FT calls except
+  FT_openLog, FT_closeLog and FT_destroy: concurrent callers are
+  group-committed, one of them writing every waiting record and
+  syncing once for all, so that callers which serialize their changes
+  should sync after releasing their own lock.
+  Returns SUCCESS if the changes are durable.
+  Returns INITIALIZATION_ERROR if no log is open.
+  Returns MEMORY_ERROR if a change could not be logged for lack of
+  memory, or IO_ERROR if a write or sync failed; after either, the
+  log is incomplete and every later call returns the same status.
+*/
+int FT_syncLog(void);
+
+/*
+  Syncs the log, as FT_syncLog does, and stops logging. The records of
+  any transaction in progress are dropped.
+  Returns SUCCESS if every logged change is durable.
+  Returns INITIALIZATION_ERROR if no log is open.
+  Otherwise returns the status FT_syncLog would have returned.
+*/
+int FT_closeLog(void);
+
+/*
+  Initializes the data structure, as FT_init does, in recovery mode:
+  loads the hierarchy saved by FT_save to imageFd, unless imageFd is
+  negative, then replays the records logged to logFd since then,
+  unless logFd is negative, reading each from its current offset.
+  A record cut short by a crash ends the log: logFd is left
+  positioned, and truncated where possible, after the last complete
+  record, so that FT_openLog(logFd) continues the log. Contents of
+  files that are loaded are owned by the hierarchy, as after FT_load;
+  those that are replayed are copied as under FT_setOwnedContents,
+  each copy freed once no file holds it.
+  Returns SUCCESS if the hierarchy is recovered.
+  Returns INITIALIZATION_ERROR if already initialized.
+  Returns MEMORY_ERROR if unable to allocate.
+  Returns IO_ERROR if either cannot be read, or if a logged change
+  cannot be made again because the log does not follow the image.
+  On any status other than SUCCESS the structure remains
+  uninitialized.
+*/
+int FT_recover(int imageFd, int logFd);
+
+/*
+  Identifiers for the public FT operations, used to index the
+  per-operation arrays of struct FT_Stats.
+*/
+enum { FT_OP_INSERTDIR, FT_OP_CONTAINSDIR, FT_OP_RMDIR,
+       FT_OP_INSERTFILE, FT_OP_CONTAINSFILE, FT_OP_RMFILE,
+       FT_OP_GETFILECONTENTS, FT_OP_REPLACEFILECONTENTS, FT_OP_STAT,
+       FT_OP_INIT, FT_OP_DESTROY, FT_OP_TOSTRING, FT_OP_INSERTMANY,
+       FT_OP_BUILD, FT_OP_TOSTRINGPARALLEL, FT_OP_DU,
+       FT_OP_SETQUOTA, FT_OP_MOVE, FT_OP_COPY, FT_OP_SNAPSHOT,
+       FT_OP_BEGIN, FT_OP_COMMIT, FT_OP_ABORT, FT_OP_SAVE,
+       FT_OP_LOAD, FT_OP_SAVEIMAGE, FT_OP_OPENLOG, FT_OP_CLOSELOG,
+       FT_OP_RECOVER, FT_OP_IMPORTDIR, FT_OP_EXPORTTO, FT_OP_HASH,
+       FT_OP_GETFILEVIEW, FT_NUM_OPS
+};
+
+/*
+  Sizes of the FT_Stats arrays. FT_NUM_STATUSES covers every return
+  status in a4def.h. Histogram bucket 0 counts zero values and bucket
+  b > 0 counts values in [2^(b-1), 2^b), with the last bucket also
+  absorbing every larger value.
+*/
+enum { FT_NUM_STATUSES = IO_ERROR + 1,
+       FT_LATENCY_BUCKETS = 40,
+       FT_VISIT_BUCKETS = 32
+};
+
+/*
+  Counters collected over every public FT call since the program
+  started or FT_resetStats was last called:
+  calls[op]        number of calls to op
+  statuses[op][s]  number of calls to op that returned status s; only
+                   kept for operations that return a status code, with
+                   FT_containsDir and FT_containsFile counting TRUE as
+                   SUCCESS and FALSE as NO_SUCH_PATH
+  latency[op][b]   histogram of op's wall-clock latency in nanoseconds
+  visits[op][b]    histogram of the number of nodes op's path walks
+                   visited
+*/
+struct FT_Stats {
+   size_t calls[FT_NUM_OPS];
+   size_t statuses[FT_NUM_OPS][FT_NUM_STATUSES];
+   size_t latency[FT_NUM_OPS][FT_LATENCY_BUCKETS];
+   size_t visits[FT_NUM_OPS][FT_VISIT_BUCKETS];
+};
+
+/*
+  Copies the current counters into *pStats. The counters are only
+  maintained when ft.c is compiled with FT_STATS defined; otherwise
+  *pStats is set to all zeros.
+*/
+void FT_getStats(struct FT_Stats *pStats);
+
+/*
+  Resets every counter reported by FT_getStats to zero.
+*/
+void FT_resetStats(void);
+
 #endif
@@ -0,0 +1,373 @@
+/*--------------------------------------------------------------------*/
+/* ft_bench.c                                                         */
+/* Authors: Ellen Su and Michael Garcia                               */
+/*--------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "ft.h"
+
+/*
+   Benchmarks the FT implementation over four workload phases --
+   insert, lookup, toString and destroy -- and reports wall time per
+   operation. With -p, it also samples hardware counters around each
+   phase through perf_event_open and reports per-operation deltas, so
+   that changes to the node layout can be judged by their cache and
+   branch behavior rather than by wall time alone. With -b, the insert
+   phase loads the files, sorted, through one FT_insertMany call; with
+   -t, it loads them unsorted through one FT_build call on that many
+   threads (0 for one per processor), the toString phase uses
+   FT_toStringParallel with as many, and the destroy phase frees the
+   tree on as many threads. -p and -t cannot be combined: the counters
+   follow the calling thread only, so they would miss the work of the
+   parallel phases' threads.
+
+   Usage: ftbench [-n files] [-f fanout] [-d depth] [-b] [-t threads]
+                  [-p]
+*/
+
+/* A hardware counter sampled around each phase. */
+struct counter {
+   /* the column heading used in the report */
+   const char *name;
+   /* the perf_event_attr type and config selecting the event */
+   __u32 type;
+   __u64 config;
+};
+
+/* The counters opened by -p, as one group led by the first. */
+static const struct counter counters[] = {
+   { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+   { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+   { "branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+   { "L1d-misses", PERF_TYPE_HW_CACHE,
+     PERF_COUNT_HW_CACHE_L1D
+     | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+     | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+   { "LLC-misses", PERF_TYPE_HW_CACHE,
+     PERF_COUNT_HW_CACHE_LL
+     | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+     | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) }
+};
+
+/* The number of entries in counters. */
+enum { NUM_COUNTERS = sizeof(counters) / sizeof(counters[0]) };
+
+/* The file descriptors of the opened counters, or -1 if not open. */
+static int counterFds[NUM_COUNTERS];
+
+/* The contents given to every benchmark file. */
+static char fileContents[] = "benchmark";
+
+/* TRUE if the insert phase uses FT_insertMany, and the contents
+   and lengths arrays passed to it. */
+static boolean bulkInsert = FALSE;
+static void **bulkContents;
+static size_t *bulkLengths;
+
+/* TRUE if the insert, toString and destroy phases run in parallel,
+   and the number of threads they use. */
+static boolean parallelBuild = FALSE;
+static size_t buildThreads;
+
+/*--------------------------------------------------------------------*/
+
+/*
+   Opens the counters as one group, disabled. Returns TRUE if every
+   counter was opened and FALSE (with all of them closed) otherwise,
+   for example when perf_event_paranoid forbids user-space counting
+   or the machine is virtualized without a PMU.
+*/
+static boolean Bench_openCounters(void) {
+   struct perf_event_attr attr;
+   size_t i;
+   size_t j;
+
+   for (i = 0; i < NUM_COUNTERS; i++) {
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = counters[i].type;
+      attr.config = counters[i].config;
+      attr.disabled = (i == 0);
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_GROUP;
+
+      counterFds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1,
+                                   i == 0 ? -1 : counterFds[0], 0);
+      if (counterFds[i] < 0) {
+         perror(counters[i].name);
+         for (j = 0; j < i; j++)
+            (void) close(counterFds[j]);
+         return FALSE;
+      }
+   }
+   return TRUE;
+}
+
+/* Closes the counters opened by Bench_openCounters. */
+static void Bench_closeCounters(void) {
+   size_t i;
+
+   for (i = 0; i < NUM_COUNTERS; i++)
+      (void) close(counterFds[i]);
+}
+
+/* Resets and starts the counter group. */
+static void Bench_startCounters(void) {
+   (void) ioctl(counterFds[0], PERF_EVENT_IOC_RESET,
+                PERF_IOC_FLAG_GROUP);
+   (void) ioctl(counterFds[0], PERF_EVENT_IOC_ENABLE,
+                PERF_IOC_FLAG_GROUP);
+}
+
+/*
+   Stops the counter group and stores each counter's value in values.
+   Returns FALSE if the group could not be read.
+*/
+static boolean Bench_stopCounters(__u64 values[NUM_COUNTERS]) {
+   /* PERF_FORMAT_GROUP reads as { nr, value[nr] } */
+   __u64 buffer[1 + NUM_COUNTERS];
+   size_t i;
+
+   (void) ioctl(counterFds[0], PERF_EVENT_IOC_DISABLE,
+                PERF_IOC_FLAG_GROUP);
+   if (read(counterFds[0], buffer, sizeof(buffer))
+       != (ssize_t)sizeof(buffer))
+      return FALSE;
+   assert(buffer[0] == NUM_COUNTERS);
+
+   for (i = 0; i < NUM_COUNTERS; i++)
+      values[i] = buffer[1 + i];
+   return TRUE;
+}
+
+/*--------------------------------------------------------------------*/
+
+/*
+   Writes into path the path of benchmark file i, which lives under
+   depth levels of directories each with fanout subdirectories.
+   path must hold at least 24 * (depth + 2) characters.
+*/
+static void Bench_makePath(char *path, size_t i, size_t fanout,
+                           size_t depth) {
+   size_t level;
+   size_t rest = i;
+
+   path += sprintf(path, "bench");
+   for (level = 0; level < depth; level++) {
+      path += sprintf(path, "/d%lu", (unsigned long)(rest % fanout));
+      rest /= fanout;
+   }
+   (void) sprintf(path, "/f%lu", (unsigned long)i);
+}
+
+/* Compares the paths that pvPath1 and pvPath2 point to, for qsort. */
+static int Bench_comparePaths(const void *pvPath1, const void *pvPath2) {
+   return strcmp(*(char * const *)pvPath1, *(char * const *)pvPath2);
+}
+
+/* Returns the current monotonic time in nanoseconds. */
+static double Bench_now(void) {
+   struct timespec ts;
+
+   (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/* The workload phases. */
+enum { PHASE_INSERT, PHASE_LOOKUP, PHASE_TOSTRING, PHASE_DESTROY,
+       NUM_PHASES };
+
+/* The report names of the workload phases. */
+static const char *phaseNames[NUM_PHASES] =
+   { "insert", "lookup", "toString", "destroy" };
+
+/*
+   Runs phase over the numFiles benchmark files in paths, returning
+   the number of FT operations it performed.
+*/
+static size_t Bench_runPhase(int phase, char **paths, size_t numFiles) {
+   size_t i;
+   char *string;
+
+   switch (phase) {
+   case PHASE_INSERT:
+      if (parallelBuild) {
+         if (FT_build(paths, bulkContents, bulkLengths, numFiles,
+                      buildThreads) != SUCCESS) {
+            fprintf(stderr, "parallel build failed\n");
+            exit(EXIT_FAILURE);
+         }
+         return numFiles;
+      }
+      if (bulkInsert) {
+         if (FT_insertMany(paths, bulkContents, bulkLengths, numFiles)
+             != SUCCESS) {
+            fprintf(stderr, "bulk insert failed\n");
+            exit(EXIT_FAILURE);
+         }
+         return numFiles;
+      }
+      for (i = 0; i < numFiles; i++)
+         if (FT_insertFile(paths[i], fileContents,
+                           sizeof(fileContents)) != SUCCESS) {
+            fprintf(stderr, "insert of %s failed\n", paths[i]);
+            exit(EXIT_FAILURE);
+         }
+      return numFiles;
+   case PHASE_LOOKUP:
+      for (i = 0; i < numFiles; i++)
+         if (FT_getFileContents(paths[i]) != fileContents) {
+            fprintf(stderr, "lookup of %s failed\n", paths[i]);
+            exit(EXIT_FAILURE);
+         }
+      return numFiles;
+   case PHASE_TOSTRING:
+      string = parallelBuild ? FT_toStringParallel(buildThreads)
+         : FT_toString();
+      if (string == NULL) {
+         fprintf(stderr, "toString failed\n");
+         exit(EXIT_FAILURE);
+      }
+      free(string);
+      return 1;
+   default:
+      assert(phase == PHASE_DESTROY);
+      (void) FT_destroy();
+      return 1;
+   }
+}
+
+/*--------------------------------------------------------------------*/
+
+/*
+   Builds and benchmarks a File Tree according to the command-line
+   arguments in argv, printing one report line per phase to stdout.
+   Returns 0, or EXIT_FAILURE on a usage error.
+*/
+int main(int argc, char *argv[]) {
+   size_t numFiles = 4096;
+   size_t fanout = 16;
+   size_t depth = 2;
+   boolean useCounters = FALSE;
+   boolean countersOpen = FALSE;
+   char **paths;
+   size_t i;
+   int phase;
+   int opt;
+   size_t ops;
+   double start;
+   double elapsed;
+   __u64 values[NUM_COUNTERS];
+
+   while ((opt = getopt(argc, argv, "n:f:d:bt:p")) != -1) {
+      switch (opt) {
+      case 'n': numFiles = (size_t)strtoul(optarg, NULL, 10); break;
+      case 'f': fanout = (size_t)strtoul(optarg, NULL, 10); break;
+      case 'd': depth = (size_t)strtoul(optarg, NULL, 10); break;
+      case 'b': bulkInsert = TRUE; break;
+      case 't':
+         parallelBuild = TRUE;
+         buildThreads = (size_t)strtoul(optarg, NULL, 10);
+         break;
+      case 'p': useCounters = TRUE; break;
+      default:
+         fprintf(stderr,
+                 "Usage: %s [-n files] [-f fanout] [-d depth] [-b] "
+                 "[-t threads] [-p]\n", argv[0]);
+         return EXIT_FAILURE;
+      }
+   }
+   if (fanout == 0)
+      fanout = 1;
+   if (useCounters && parallelBuild) {
+      fprintf(stderr, "%s: -p counts only the calling thread, "
+              "so cannot be combined with -t\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   paths = malloc(numFiles * sizeof(char *));
+   if (paths == NULL)
+      return EXIT_FAILURE;
+   for (i = 0; i < numFiles; i++) {
+      paths[i] = malloc(24 * (depth + 2));
+      if (paths[i] == NULL)
+         return EXIT_FAILURE;
+      Bench_makePath(paths[i], i, fanout, depth);
+   }
+   if (bulkInsert && !parallelBuild)
+      qsort(paths, numFiles, sizeof(char *), Bench_comparePaths);
+   if (bulkInsert || parallelBuild) {
+      bulkContents = malloc(numFiles * sizeof(void *));
+      bulkLengths = malloc(numFiles * sizeof(size_t));
+      if (bulkContents == NULL || bulkLengths == NULL)
+         return EXIT_FAILURE;
+      for (i = 0; i < numFiles; i++) {
+         bulkContents[i] = fileContents;
+         bulkLengths[i] = sizeof(fileContents);
+      }
+   }
+
+   if (useCounters) {
+      countersOpen = Bench_openCounters();
+      if (!countersOpen) {
+         fprintf(stderr, "hardware counters unavailable; "
+                 "reporting wall time only\n");
+         useCounters = FALSE;
+      }
+   }
+
+   printf("%-9s %10s %12s", "phase", "ops", "ns/op");
+   if (useCounters)
+      for (i = 0; i < NUM_COUNTERS; i++)
+         printf(" %14s", counters[i].name);
+   printf("\n");
+
+   (void) FT_init();
+   /* FT_build needs an empty tree; the benchmark root comes with the
+      files. */
+   if (parallelBuild)
+      (void) FT_setParallelDestroy(1024, buildThreads);
+   if (!parallelBuild && FT_insertDir("bench") != SUCCESS) {
+      fprintf(stderr, "could not create the benchmark root\n");
+      return EXIT_FAILURE;
+   }
+   for (phase = 0; phase < NUM_PHASES; phase++) {
+      if (useCounters)
+         Bench_startCounters();
+      start = Bench_now();
+      ops = Bench_runPhase(phase, paths, numFiles);
+      elapsed = Bench_now() - start;
+      if (useCounters && !Bench_stopCounters(values)) {
+         fprintf(stderr, "could not read hardware counters\n");
+         useCounters = FALSE;
+      }
+
+      printf("%-9s %10lu %12.1f", phaseNames[phase],
+             (unsigned long)ops, elapsed / (double)ops);
+      if (useCounters)
+         for (i = 0; i < NUM_COUNTERS; i++)
+            printf(" %14.1f", (double)values[i] / (double)ops);
+      printf("\n");
+   }
+
+   if (countersOpen)
+      Bench_closeCounters();
+   for (i = 0; i < numFiles; i++)
+      free(paths[i]);
+   free(paths);
+   free(bulkContents);
+   free(bulkLengths);
+   return 0;
+}
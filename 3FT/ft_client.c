@@ -8,8 +8,24 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include "ft.h"
 
+/* Appends a line for the FT_diff change to path to the string
+   pvChanges: path preceded by '+', '-' or '~' for an addition,
+   removal or change. */
+static void recordChange(const char *path, int change, void *pvChanges) {
+  char *changes = pvChanges;
+
+  changes += strlen(changes);
+  *changes = change == FT_DIFF_ADDED ? '+'
+             : change == FT_DIFF_REMOVED ? '-' : '~';
+  strcpy(changes + 1, path);
+  strcat(changes, "\n");
+}
+
 /* Tests the FT implementation with an assortment of checks.
    Prints the status of the data structure along the way to stderr.
    Returns 0. */
@@ -18,6 +34,38 @@ int main(void) {
   boolean b;
   size_t l;
   char arr[1000] = {'\0'};
+  struct FT_Stats stats;
+  struct MemoryUsage usage;
+  char *bulkPaths[] = { "r/a/F", "r/a/G", "r/b-x/H", "r/b/c/I",
+                        "r/b/d", "r/e" };
+  char *reversedPaths[] = { "r/e", "r/b/d", "r/b/c/I", "r/b-x/H",
+                            "r/a/G", "r/a/F" };
+  void *bulkContents[] = { "F", "G", "H", "I", "d", "e" };
+  size_t bulkLengths[] = { 2, 2, 2, 2, 2, 2 };
+  void *bigContents[6];
+  size_t bigLengths[6];
+  char *badPaths[] = { "r/x/J", "r/x/J/K" };
+  char *dupPaths[] = { "r/e", "r/a/F", "r/e" };
+  char *topPaths[] = { "r/b/c/I", "r/b", "r/a/F" };
+  char manyNames[64][16];
+  char *manyPaths[64];
+  size_t threads;
+  struct MemoryUsage built;
+  char *expected;
+  FT_Snapshot_T snapshot;
+  FT_Snapshot_T empty;
+  FT_Snapshot_T current;
+  struct FT_View view;
+  struct FT_View moved;
+  char changes[256];
+  size_t used;
+  size_t cost;
+  int fds[2];
+  int fd;
+  int logFd;
+  FT_Image_T image;
+  size_t i;
+  size_t sum;
 
   /* Before the data structure is initialized, insert*, remove*,
      and destroy operations should return INITIALIZATION_ERROR, and
@@ -197,6 +245,1144 @@ int main(void) {
   assert(FT_containsDir("a") == FALSE);
   assert(FT_containsFile("a") == FALSE);
   assert((temp = FT_toString()) == NULL);
+
+  /* Bulk insertion builds the same tree as one FT_insertFile per
+     path, whether or not its input is sorted, and stops at the first
+     path that cannot be inserted */
+  assert(FT_insertMany(bulkPaths, NULL, NULL, 6) == INITIALIZATION_ERROR);
+  assert(FT_init() == SUCCESS);
+  assert(FT_insertDir("r") == SUCCESS);
+  for(i = 0; i < 6; i++)
+    assert(FT_insertFile(bulkPaths[i], bulkContents[i], 2) == SUCCESS);
+  assert((expected = FT_toString()) != NULL);
+  assert(FT_rmDir("r") == SUCCESS);
+  assert(FT_insertMany(bulkPaths, bulkContents, bulkLengths, 6)
+         == SUCCESS);
+  assert((temp = FT_toString()) != NULL);
+  assert(!strcmp(temp, expected));
+  free(temp);
+  assert(!strcmp(FT_getFileContents("r/b/c/I"), "I"));
+  assert(FT_stat("r/b/c/I", &b, &l) == SUCCESS);
+  assert(b == TRUE && l == 2);
+  assert(FT_rmDir("r") == SUCCESS);
+  assert(FT_insertMany(reversedPaths, NULL, NULL, 6) == SUCCESS);
+  assert((temp = FT_toString()) != NULL);
+  assert(!strcmp(temp, expected));
+  free(temp);
+  free(expected);
+  assert(FT_getFileContents("r/b/c/I") == NULL);
+  assert(FT_insertMany(bulkPaths, NULL, NULL, 6) == ALREADY_IN_TREE);
+  assert(FT_insertMany(badPaths, NULL, NULL, 2) == NOT_A_DIRECTORY);
+  assert(FT_containsFile("r/x/J") == TRUE);
+  assert(FT_insertMany(&badPaths[1], NULL, NULL, 1) == NOT_A_DIRECTORY);
+  assert(FT_insertMany(&bulkPaths[0], NULL, NULL, 0) == SUCCESS);
+  assert(FT_rmDir("r") == SUCCESS);
+  assert(FT_insertMany(&reversedPaths[0], NULL, NULL, 1) == SUCCESS);
+  assert(FT_insertMany(&badPaths[0], NULL, NULL, 1) == SUCCESS);
+  temp = "s/A";
+  assert(FT_insertMany(&temp, NULL, NULL, 1) == CONFLICTING_PATH);
+  assert(FT_rmDir("r") == SUCCESS);
+  temp = "A";
+  assert(FT_insertMany(&temp, NULL, NULL, 1) == CONFLICTING_PATH);
+  assert(FT_destroy() == SUCCESS);
+
+  /* Memory accounting tracks every node, name and array as the tree
+     grows and shrinks, without walking it */
+  assert(FT_memoryUsage(&usage) == INITIALIZATION_ERROR);
+  assert(FT_init() == SUCCESS);
+  assert(FT_memoryUsage(&usage) == SUCCESS);
+  assert(usage.numNodes == 0 && usage.nodeBytes == 0);
+  assert(usage.pathBytes == 0 && usage.childPhysicalBytes == 0);
+  assert(FT_insertDir("a/b") == SUCCESS);
+  assert(FT_insertFile("a/b/F", "contents", 9) == SUCCESS);
+  assert(FT_insertFile("a/b/G", NULL, 0) == SUCCESS);
+  assert(FT_insertFile("a/b/H", NULL, 0) == SUCCESS);
+  assert(FT_memoryUsage(&usage) == SUCCESS);
+  assert(usage.numNodes == 5);
+  assert(usage.numFiles == 3);
+  assert(usage.pathBytes == strlen("a") + strlen("b")
+         + 3 * strlen("F") + 5);
+  assert(usage.childLogicalBytes == 4 * sizeof(void*));
+  assert(usage.childPhysicalBytes > usage.childLogicalBytes);
+  assert(usage.fileBytes > 0);
+
+  /* A memory budget rejects exactly the inserts that would not fit,
+     without allocating anything */
+  used = usage.nodeBytes + usage.pathBytes + usage.childPhysicalBytes
+    + usage.fileBytes;
+  assert(FT_insertFile("a/x/y/Z", NULL, 0) == SUCCESS);
+  assert(FT_memoryUsage(&usage) == SUCCESS);
+  cost = usage.nodeBytes + usage.pathBytes + usage.childPhysicalBytes
+    + usage.fileBytes - used;
+  assert(FT_rmDir("a/x") == SUCCESS);
+  assert(FT_setMemoryBudget(used + cost - 1) == SUCCESS);
+  assert(FT_insertFile("a/x/y/Z", NULL, 0) == MEMORY_ERROR);
+  assert(FT_insertDir("a/x/y") == SUCCESS);
+  assert(FT_rmDir("a/x") == SUCCESS);
+  assert(FT_memoryUsage(&usage) == SUCCESS);
+  assert(usage.numNodes == 5);
+  assert(FT_setMemoryBudget(used + cost) == SUCCESS);
+  assert(FT_insertFile("a/x/y/Z", NULL, 0) == SUCCESS);
+  assert(FT_insertDir("a/q") == MEMORY_ERROR);
+  assert(FT_setMemoryBudget(0) == SUCCESS);
+  assert(FT_insertDir("a/q") == SUCCESS);
+
+  assert(FT_rmDir("a") == SUCCESS);
+  assert(FT_memoryUsage(&usage) == SUCCESS);
+  assert(usage.numNodes == 0 && usage.numFiles == 0);
+  assert(usage.nodeBytes == 0 && usage.pathBytes == 0);
+  assert(usage.childLogicalBytes == 0 && usage.childPhysicalBytes == 0);
+  assert(usage.fileBytes == 0);
+  assert(FT_destroy() == SUCCESS);
+
+  /* A parallel build of unsorted paths gives the same tree, and the
+     same memory totals, as inserting them one at a time, for any
+     number of threads; on any error it leaves the tree empty */
+  assert(FT_build(bulkPaths, NULL, NULL, 6, 1) == INITIALIZATION_ERROR);
+  assert(FT_init() == SUCCESS);
+  assert(FT_insertMany(bulkPaths, bulkContents, bulkLengths, 6)
+         == SUCCESS);
+  assert((expected = FT_toString()) != NULL);
+  assert(FT_memoryUsage(&usage) == SUCCESS);
+  assert(FT_build(bulkPaths, NULL, NULL, 6, 1) == CONFLICTING_PATH);
+  assert(FT_rmDir("r") == SUCCESS);
+  for(threads = 0; threads <= 8; threads++) {
+    assert(FT_build(reversedPaths, &bulkContents[0], bulkLengths, 6,
+                    threads) == SUCCESS);
+    assert((temp = FT_toString()) != NULL);
+    assert(!strcmp(temp, expected));
+    free(temp);
+    assert(FT_memoryUsage(&built) == SUCCESS);
+    assert(built.numNodes == usage.numNodes);
+    assert(built.pathBytes == usage.pathBytes);
+    assert(built.childLogicalBytes == usage.childLogicalBytes);
+    assert(FT_rmDir("r") == SUCCESS);
+  }
+  free(expected);
+  assert(FT_build(dupPaths, NULL, NULL, 3, 2) == ALREADY_IN_TREE);
+  assert(FT_build(badPaths, NULL, NULL, 2, 2) == NOT_A_DIRECTORY);
+  assert(FT_build(topPaths, NULL, NULL, 3, 2) == NOT_A_DIRECTORY);
+  assert(FT_build(dupPaths, NULL, NULL, 2, 2) == SUCCESS);
+  assert(FT_containsFile("r/e") == TRUE);
+  assert(FT_rmDir("r") == SUCCESS);
+  temp = "A";
+  assert(FT_build(&temp, NULL, NULL, 1, 2) == CONFLICTING_PATH);
+  manyPaths[0] = "r/a/F";
+  manyPaths[1] = "s/a/F";
+  assert(FT_build(manyPaths, NULL, NULL, 2, 2) == CONFLICTING_PATH);
+  for(i = 0; i < 64; i++) {
+    sprintf(manyNames[i], "m/d%lu/f%lu", (unsigned long)(i % 7),
+            (unsigned long)i);
+    manyPaths[i] = manyNames[i];
+  }
+  assert(FT_insertDir("m") == SUCCESS);
+  for(i = 0; i < 64; i++)
+    assert(FT_insertFile(manyPaths[i], NULL, 0) == SUCCESS);
+  assert((expected = FT_toString()) != NULL);
+  assert(FT_memoryUsage(&usage) == SUCCESS);
+  assert(FT_rmDir("m") == SUCCESS);
+  assert(FT_build(manyPaths, NULL, NULL, 64, 4) == SUCCESS);
+  assert((temp = FT_toString()) != NULL);
+  assert(!strcmp(temp, expected));
+  free(temp);
+  free(expected);
+  assert(FT_rmDir("m") == SUCCESS);
+  assert(FT_setMemoryBudget(usage.nodeBytes) == SUCCESS);
+  assert(FT_build(manyPaths, NULL, NULL, 64, 4) == MEMORY_ERROR);
+  assert(FT_memoryUsage(&built) == SUCCESS);
+  assert(built.numNodes == 0 && built.nodeBytes == 0);
+  assert(FT_containsDir("m") == FALSE);
+  /* The budget is checked up front, against exactly the tree built */
+  used = usage.nodeBytes + usage.pathBytes + usage.childPhysicalBytes
+    + usage.fileBytes;
+  assert(FT_setMemoryBudget(used - 1) == SUCCESS);
+  assert(FT_build(manyPaths, NULL, NULL, 64, 4) == MEMORY_ERROR);
+  assert(FT_setMemoryBudget(used) == SUCCESS);
+  assert(FT_build(manyPaths, NULL, NULL, 64, 4) == SUCCESS);
+  assert(FT_setMemoryBudget(0) == SUCCESS);
+  assert(FT_destroy() == SUCCESS);
+
+  /* The parallel serializer matches FT_toString byte for byte */
+  assert(FT_toStringParallel(2) == NULL);
+  assert(FT_init() == SUCCESS);
+  assert((temp = FT_toStringParallel(2)) != NULL);
+  assert(!strcmp(temp, ""));
+  free(temp);
+  assert(FT_insertDir("m") == SUCCESS);
+  for(i = 0; i < 64; i++) {
+    assert((expected = FT_toString()) != NULL);
+    for(threads = 0; threads <= 4; threads++) {
+      assert((temp = FT_toStringParallel(threads)) != NULL);
+      assert(!strcmp(temp, expected));
+      free(temp);
+    }
+    free(expected);
+    assert(FT_insertFile(manyPaths[i], NULL, 0) == SUCCESS);
+  }
+  assert(FT_insertFile("m/F", NULL, 0) == SUCCESS);
+  assert((expected = FT_toString()) != NULL);
+  assert((temp = FT_toStringParallel(3)) != NULL);
+  assert(!strcmp(temp, expected));
+  free(temp);
+  free(expected);
+  assert(FT_destroy() == SUCCESS);
+
+  /* Subtrees above the threshold are freed in parallel, with exact
+     node counts and memory totals */
+  assert(FT_setParallelDestroy(1, 2) == INITIALIZATION_ERROR);
+  assert(FT_init() == SUCCESS);
+  assert(FT_insertDir("m") == SUCCESS);
+  assert(FT_insertMany(manyPaths, NULL, NULL, 64) == SUCCESS);
+  assert(FT_memoryUsage(&usage) == SUCCESS);
+  assert(FT_setParallelDestroy(10, 3) == SUCCESS);
+  assert(FT_rmDir("m/d0") == SUCCESS);
+  assert(FT_rmDir("m/d6") == SUCCESS);
+  assert(FT_memoryUsage(&built) == SUCCESS);
+  assert(built.numNodes == usage.numNodes - 21);
+  assert(built.numFiles == usage.numFiles - 19);
+  assert(FT_containsDir("m/d1") == TRUE);
+  assert(FT_containsFile("m/d1/f1") == TRUE);
+  assert(FT_setParallelDestroy(1, 0) == SUCCESS);
+  assert(FT_rmDir("m/d1") == SUCCESS);
+  assert(FT_setParallelDestroy(2, 8) == SUCCESS);
+  assert(FT_destroy() == SUCCESS);
+  assert(FT_init() == SUCCESS);
+  assert(FT_memoryUsage(&usage) == SUCCESS);
+  assert(usage.numNodes == 0 && usage.nodeBytes == 0);
+  assert(usage.pathBytes == 0 && usage.childPhysicalBytes == 0);
+  assert(usage.fileBytes == 0);
+  assert(FT_destroy() == SUCCESS);
+
+  /* With asynchronous reclamation, FT_rmDir only unlinks the subtree;
+     its memory is released once the background thread has freed it */
+  assert(FT_setAsyncReclaim(TRUE) == INITIALIZATION_ERROR);
+  assert(FT_flushReclaim() == INITIALIZATION_ERROR);
+  assert(FT_init() == SUCCESS);
+  assert(FT_insertDir("m") == SUCCESS);
+  assert(FT_insertMany(manyPaths, NULL, NULL, 64) == SUCCESS);
+  assert(FT_memoryUsage(&usage) == SUCCESS);
+  assert(FT_setAsyncReclaim(TRUE) == SUCCESS);
+  assert(FT_rmDir("m/d0") == SUCCESS);
+  assert(FT_rmDir("m/d6") == SUCCESS);
+  assert(FT_containsDir("m/d0") == FALSE);
+  assert(FT_insertFile("m/d0/f0", NULL, 0) == SUCCESS);
+  assert(FT_flushReclaim() == SUCCESS);
+  assert(FT_memoryUsage(&built) == SUCCESS);
+  assert(built.numNodes == usage.numNodes - 19);
+  assert(built.numFiles == usage.numFiles - 18);
+  assert(FT_setAsyncReclaim(FALSE) == SUCCESS);
+  assert(FT_rmDir("m/d1") == SUCCESS);
+  assert(FT_setAsyncReclaim(TRUE) == SUCCESS);
+  assert(FT_rmDir("m") == SUCCESS);
+  assert(FT_destroy() == SUCCESS);
+  assert(FT_init() == SUCCESS);
+  assert(FT_memoryUsage(&usage) == SUCCESS);
+  assert(usage.numNodes == 0 && usage.nodeBytes == 0);
+  assert(usage.pathBytes == 0 && usage.childPhysicalBytes == 0);
+  assert(usage.fileBytes == 0);
+  assert(FT_destroy() == SUCCESS);
+
+  /* Every directory knows how many nodes and file bytes lie beneath
+     it, through inserts, removals and replacements */
+  assert(FT_du("a", &l, &sum) == INITIALIZATION_ERROR);
+  assert(FT_init() == SUCCESS);
+  assert(FT_du("a", &l, &sum) == NO_SUCH_PATH);
+  assert(FT_insertDir("a/b") == SUCCESS);
+  assert(FT_insertFile("a/b/F", "contents", 9) == SUCCESS);
+  assert(FT_insertFile("a/b/c/G", "g", 2) == SUCCESS);
+  assert(FT_insertDir("a/d") == SUCCESS);
+  assert(FT_du("a", &l, &sum) == SUCCESS);
+  assert(l == 5 && sum == 11);
+  assert(FT_du("a/b", &l, &sum) == SUCCESS);
+  assert(l == 3 && sum == 11);
+  assert(FT_du("a/b/F", &l, &sum) == SUCCESS);
+  assert(l == 0 && sum == 9);
+  assert(FT_du("a/d", &l, &sum) == SUCCESS);
+  assert(l == 0 && sum == 0);
+  assert(FT_du("a/b/c/H", &l, &sum) == NO_SUCH_PATH);
+  assert(FT_replaceFileContents("a/b/c/G", "longer", 7) != NULL);
+  assert(FT_du("a", &l, &sum) == SUCCESS);
+  assert(l == 5 && sum == 16);
+  assert(FT_rmFile("a/b/F") == SUCCESS);
+  assert(FT_du("a/b", &l, &sum) == SUCCESS);
+  assert(l == 2 && sum == 7);
+  assert(FT_rmDir("a/b/c") == SUCCESS);
+  assert(FT_du("a", &l, &sum) == SUCCESS);
+  assert(l == 2 && sum == 0);
+  assert(FT_destroy() == SUCCESS);
+
+  /* Quotas reject inserts and growth that would exceed them, at any
+     directory along the path */
+  assert(FT_setQuota("a", 1, 1) == INITIALIZATION_ERROR);
+  assert(FT_init() == SUCCESS);
+  assert(FT_insertDir("a/b") == SUCCESS);
+  assert(FT_insertFile("a/F", "F", 2) == SUCCESS);
+  assert(FT_setQuota("a/x", 1, 1) == NO_SUCH_PATH);
+  assert(FT_setQuota("a/F", 1, 1) == NOT_A_DIRECTORY);
+  assert(FT_setQuota("a", 4, 10) == SUCCESS);
+  assert(FT_setQuota("a/b", 0, 5) == SUCCESS);
+  assert(FT_insertFile("a/b/G", "G", 6) == QUOTA_EXCEEDED);
+  assert(FT_insertFile("a/b/G", "G", 5) == SUCCESS);
+  assert(FT_insertDir("a/b/c/d") == QUOTA_EXCEEDED);
+  assert(FT_containsDir("a/b/c") == FALSE);
+  assert(FT_insertDir("a/b/c") == SUCCESS);
+  assert(FT_insertDir("a/e") == QUOTA_EXCEEDED);
+  temp = "a/e/H";
+  assert(FT_insertMany(&temp, NULL, NULL, 1) == QUOTA_EXCEEDED);
+  assert(FT_replaceFileContents("a/F", "FFFFF", 6) == NULL);
+  assert(FT_stat("a/F", &b, &l) == SUCCESS);
+  assert(l == 2);
+  assert(!strcmp(FT_replaceFileContents("a/F", "FF", 3), "F"));
+  assert(FT_replaceFileContents("a/b/G", "GG", 6) == NULL);
+  assert(FT_rmDir("a/b/c") == SUCCESS);
+  assert(FT_insertDir("a/e") == SUCCESS);
+  assert(FT_setQuota("a", 0, 0) == SUCCESS);
+  assert(FT_insertMany(&temp, NULL, NULL, 1) == SUCCESS);
+  /* A quota set below current usage stops only the growth it limits */
+  assert(FT_insertDir("a/q") == SUCCESS);
+  assert(FT_insertFile("a/q/f", "f", 2) == SUCCESS);
+  assert(FT_insertFile("a/q/g", "g", 2) == SUCCESS);
+  assert(FT_setQuota("a/q", 1, 1000) == SUCCESS);
+  assert(FT_insertFile("a/q/h", NULL, 0) == QUOTA_EXCEEDED);
+  assert(!strcmp(FT_replaceFileContents("a/q/f", "xxxxx", 6), "f"));
+  assert(FT_stat("a/q/f", &b, &l) == SUCCESS);
+  assert(l == 6);
+  assert(FT_setQuota("a/q", 0, 4) == SUCCESS);
+  assert(FT_insertFile("a/q/h", "h", 2) == QUOTA_EXCEEDED);
+  assert(FT_replaceFileContents("a/q/g", "gg", 3) == NULL);
+  assert(!strcmp(FT_replaceFileContents("a/q/f", "x", 2), "xxxxx"));
+  assert(FT_insertDir("a/q/d") == SUCCESS);
+  assert(FT_insertFile("a/q/h", NULL, 0) == SUCCESS);
+  assert(FT_destroy() == SUCCESS);
+
+  /* FT_move relinks a whole subtree under its new name, carrying its
+     sizes with it, and leaves the hierarchy unchanged on failure */
+  assert(FT_move("a/b", "a/c") == INITIALIZATION_ERROR);
+  assert(FT_init() == SUCCESS);
+  assert(FT_insertDir("a/b/c") == SUCCESS);
+  assert(FT_insertFile("a/b/c/F", "F", 2) == SUCCESS);
+  assert(FT_insertFile("a/b/G", "G", 2) == SUCCESS);
+  assert(FT_insertDir("a/d") == SUCCESS);
+  assert(FT_insertFile("a/H", NULL, 0) == SUCCESS);
+  assert(FT_move("a/x", "a/y") == NO_SUCH_PATH);
+  assert(FT_move("a", "b") == CONFLICTING_PATH);
+  assert(FT_move("a/b", "b") == CONFLICTING_PATH);
+  assert(FT_move("a/b", "a/b/c/b") == CONFLICTING_PATH);
+  assert(FT_move("a/b", "a/b/x") == CONFLICTING_PATH);
+  assert(FT_move("a/b", "a/d") == ALREADY_IN_TREE);
+  assert(FT_move("a/b", "a/H/b") == NOT_A_DIRECTORY);
+  assert(FT_move("a/b", "a/x/b") == NO_SUCH_PATH);
+  assert(FT_setQuota("a/d", 3, 0) == SUCCESS);
+  assert(FT_move("a/b", "a/d/b") == QUOTA_EXCEEDED);
+  assert(FT_containsFile("a/b/c/F"));
+  assert(FT_setQuota("a/d", 4, 4) == SUCCESS);
+  assert(FT_move("a/b", "a/d/e") == SUCCESS);
+  assert(FT_containsDir("a/b") == FALSE);
+  assert(!strcmp(FT_getFileContents("a/d/e/c/F"), "F"));
+  assert(FT_containsFile("a/d/e/G"));
+  assert(FT_du("a/d", &l, &sum) == SUCCESS);
+  assert(l == 4 && sum == 4);
+  assert(FT_move("a/d/e/G", "a/G") == SUCCESS);
+  assert(FT_move("a/H", "a/d/e/H") == SUCCESS);
+  assert(FT_du("a", &l, &sum) == SUCCESS);
+  assert(l == 6 && sum == 4);
+  temp = FT_toString();
+  assert(temp != NULL);
+  assert(!strcmp(temp, "a\na/G\na/d\na/d/e\na/d/e/H\na/d/e/c\n"
+                 "a/d/e/c/F\n"));
+  free(temp);
+  assert(FT_destroy() == SUCCESS);
+
+  /* FT_copy shares the source's nodes, which are copied one at a time
+     as either side changes, and both sides count in full */
+  assert(FT_copy("a/t", "a/c") == INITIALIZATION_ERROR);
+  assert(FT_init() == SUCCESS);
+  assert(FT_insertDir("a/t/d") == SUCCESS);
+  assert(FT_insertFile("a/t/d/F", "F", 2) == SUCCESS);
+  assert(FT_insertFile("a/t/G", "G", 2) == SUCCESS);
+  assert(FT_copy("a/x", "a/c") == NO_SUCH_PATH);
+  assert(FT_copy("a", "a/c") == CONFLICTING_PATH);
+  assert(FT_copy("a/t", "b") == CONFLICTING_PATH);
+  assert(FT_copy("a/t", "a/t/d/c") == CONFLICTING_PATH);
+  assert(FT_copy("a/t", "a/t") == ALREADY_IN_TREE);
+  assert(FT_copy("a/t", "a/x/c") == NO_SUCH_PATH);
+  assert(FT_copy("a/t", "a/t/G/c") == NOT_A_DIRECTORY);
+  assert(FT_copy("a/t", "a/c") == SUCCESS);
+  assert(FT_memoryUsage(&usage) == SUCCESS);
+  assert(usage.numNodes == 6);
+  assert(FT_du("a", &l, &sum) == SUCCESS);
+  assert(l == 8 && sum == 8);
+  assert(FT_getFileContents("a/c/d/F") == FT_getFileContents("a/t/d/F"));
+  assert(!strcmp(FT_replaceFileContents("a/c/d/F", "X", 2), "F"));
+  assert(!strcmp(FT_getFileContents("a/t/d/F"), "F"));
+  assert(FT_memoryUsage(&usage) == SUCCESS);
+  assert(usage.numNodes == 8);
+  assert(FT_insertFile("a/t/H", NULL, 0) == SUCCESS);
+  assert(FT_containsFile("a/c/H") == FALSE);
+  assert(FT_rmDir("a/t") == SUCCESS);
+  assert(FT_memoryUsage(&usage) == SUCCESS);
+  assert(usage.numNodes == 5);
+  temp = FT_toString();
+  assert(temp != NULL);
+  assert(!strcmp(temp, "a\na/c\na/c/G\na/c/d\na/c/d/F\n"));
+  free(temp);
+  assert(FT_setQuota("a", 7, 0) == SUCCESS);
+  assert(FT_copy("a/c", "a/e") == QUOTA_EXCEEDED);
+  assert(FT_setQuota("a", 8, 0) == SUCCESS);
+  assert(FT_copy("a/c", "a/e") == SUCCESS);
+  assert(FT_setQuota("a", 0, 0) == SUCCESS);
+  /* The memory budget prices a copy's child array at its full size */
+  assert(FT_insertFile("a/c/H", NULL, 0) == SUCCESS);
+  assert(FT_insertFile("a/c/I", NULL, 0) == SUCCESS);
+  assert(FT_memoryUsage(&usage) == SUCCESS);
+  used = usage.nodeBytes + usage.pathBytes + usage.childPhysicalBytes
+    + usage.fileBytes;
+  assert(FT_copy("a/c", "a/w") == SUCCESS);
+  assert(FT_memoryUsage(&usage) == SUCCESS);
+  cost = usage.nodeBytes + usage.pathBytes + usage.childPhysicalBytes
+    + usage.fileBytes - used;
+  assert(FT_rmDir("a/w") == SUCCESS);
+  assert(FT_setMemoryBudget(used + cost - 1) == SUCCESS);
+  assert(FT_copy("a/c", "a/w") == MEMORY_ERROR);
+  assert(FT_setMemoryBudget(used + cost) == SUCCESS);
+  assert(FT_copy("a/c", "a/w") == SUCCESS);
+  assert(FT_setMemoryBudget(0) == SUCCESS);
+  assert(FT_rmDir("a/w") == SUCCESS);
+  assert(FT_rmFile("a/c/H") == SUCCESS);
+  assert(FT_rmFile("a/c/I") == SUCCESS);
+  assert(FT_rmFile("a/e/d/F") == SUCCESS);
+  assert(!strcmp(FT_getFileContents("a/c/d/F"), "X"));
+  assert(FT_move("a/c/G", "a/e/d/G") == SUCCESS);
+  assert(FT_containsFile("a/e/G"));
+  assert(FT_copy("a/e", "a/c/e") == SUCCESS);
+  /* Shared nodes are released, not freed, by parallel and background
+     reclamation alike */
+  assert(FT_setAsyncReclaim(TRUE) == SUCCESS);
+  assert(FT_rmDir("a/e") == SUCCESS);
+  assert(FT_insertFile("a/c/e/d/H", NULL, 0) == SUCCESS);
+  assert(FT_flushReclaim() == SUCCESS);
+  assert(FT_setAsyncReclaim(FALSE) == SUCCESS);
+  assert(FT_containsFile("a/c/e/d/G"));
+  assert(FT_setParallelDestroy(1, 3) == SUCCESS);
+  assert(FT_copy("a/c", "a/f") == SUCCESS);
+  assert(FT_rmDir("a/c") == SUCCESS);
+  assert(FT_du("a", &l, &sum) == SUCCESS);
+  assert(l == 8 && sum == 6);
+  assert(FT_destroy() == SUCCESS);
+
+  /* A snapshot keeps showing the hierarchy as it was, while changes
+     copy only the nodes on their own paths */
+  assert(FT_snapshot() == NULL);
+  assert(FT_init() == SUCCESS);
+  empty = FT_snapshot();
+  assert(empty != NULL);
+  assert(FT_insertDir("a/b") == SUCCESS);
+  assert(FT_insertFile("a/b/F", "F", 2) == SUCCESS);
+  assert(FT_insertFile("a/G", "G", 2) == SUCCESS);
+  assert(FT_insertDir("a/h/i") == SUCCESS);
+  expected = FT_toString();
+  assert(expected != NULL);
+  snapshot = FT_snapshot();
+  assert(snapshot != NULL);
+  assert(FT_memoryUsage(&usage) == SUCCESS);
+  assert(usage.numNodes == 6);
+  assert(!strcmp(FT_replaceFileContents("a/b/F", "X", 2), "F"));
+  assert(FT_memoryUsage(&usage) == SUCCESS);
+  assert(usage.numNodes == 9);
+  assert(FT_rmFile("a/G") == SUCCESS);
+  assert(FT_move("a/b", "a/h/b") == SUCCESS);
+  assert(FT_insertFile("a/h/i/J", NULL, 0) == SUCCESS);
+  assert(FT_snapshotContainsDir(snapshot, "a/b"));
+  assert(FT_snapshotContainsDir(snapshot, "a/h/b") == FALSE);
+  assert(FT_snapshotContainsFile(snapshot, "a/G"));
+  assert(FT_snapshotContainsFile(snapshot, "a/h/i/J") == FALSE);
+  assert(FT_snapshotContainsFile(snapshot, "a/b") == FALSE);
+  assert(!strcmp(FT_snapshotGetFileContents(snapshot, "a/b/F"), "F"));
+  assert(FT_snapshotGetFileContents(snapshot, "a/h") == NULL);
+  assert(FT_snapshotStat(snapshot, "a/G", &b, &l) == SUCCESS);
+  assert(b == TRUE && l == 2);
+  assert(FT_snapshotStat(snapshot, "a/x", &b, &l) == NO_SUCH_PATH);
+  assert(!strcmp(FT_getFileContents("a/h/b/F"), "X"));
+  temp = FT_snapshotToString(snapshot);
+  assert(temp != NULL);
+  assert(!strcmp(temp, expected));
+  free(temp);
+  temp = FT_snapshotToString(empty);
+  assert(temp != NULL && *temp == '\0');
+  free(temp);
+  assert(FT_destroy() == SUCCESS);
+  temp = FT_snapshotToString(snapshot);
+  assert(temp != NULL);
+  assert(!strcmp(temp, expected));
+  free(temp);
+  free(expected);
+  FT_freeSnapshot(snapshot);
+  FT_freeSnapshot(empty);
+  assert(FT_init() == SUCCESS);
+  assert(FT_memoryUsage(&usage) == SUCCESS);
+  assert(usage.numNodes == 0 && usage.pathBytes == 0);
+  assert(FT_destroy() == SUCCESS);
+
+  /* FT_diff reports the fewest changes that turn one snapshot into
+     another, whether their subtrees are shared or merely equal */
+  assert(FT_init() == SUCCESS);
+  empty = FT_snapshot();
+  assert(FT_insertDir("a/b") == SUCCESS);
+  assert(FT_insertFile("a/b/F", "F", 2) == SUCCESS);
+  assert(FT_insertFile("a/G", "G", 2) == SUCCESS);
+  assert(FT_insertDir("a/h/i") == SUCCESS);
+  snapshot = FT_snapshot();
+  assert(FT_replaceFileContents("a/b/F", "X", 2) != NULL);
+  assert(FT_rmFile("a/G") == SUCCESS);
+  assert(FT_move("a/b", "a/h/b") == SUCCESS);
+  assert(FT_insertFile("a/h/i/J", NULL, 0) == SUCCESS);
+  current = FT_snapshot();
+  assert(empty != NULL && snapshot != NULL && current != NULL);
+  changes[0] = '\0';
+  assert(FT_diff(snapshot, current, recordChange, changes) == SUCCESS);
+  assert(!strcmp(changes, "-a/G\n-a/b\n+a/h/b\n+a/h/i/J\n"));
+  changes[0] = '\0';
+  assert(FT_diff(current, current, recordChange, changes) == SUCCESS);
+  assert(FT_diff(empty, snapshot, recordChange, changes) == SUCCESS);
+  assert(FT_diff(snapshot, empty, recordChange, changes) == SUCCESS);
+  assert(!strcmp(changes, "+a\n-a\n"));
+  FT_freeSnapshot(snapshot);
+  snapshot = current;
+  assert(FT_replaceFileContents("a/h/b/F", "Y", 2) != NULL);
+  assert(FT_rmFile("a/h/i/J") == SUCCESS);
+  assert(FT_insertDir("a/h/i/J") == SUCCESS);
+  current = FT_snapshot();
+  assert(current != NULL);
+  changes[0] = '\0';
+  assert(FT_diff(snapshot, current, recordChange, changes) == SUCCESS);
+  assert(!strcmp(changes, "~a/h/b/F\n-a/h/i/J\n+a/h/i/J\n"));
+  assert(FT_hash("a", &used) == SUCCESS);
+  assert(FT_destroy() == SUCCESS);
+  assert(FT_init() == SUCCESS);
+  assert(FT_insertDir("a/h/i/J") == SUCCESS);
+  assert(FT_insertDir("a/h/b") == SUCCESS);
+  assert(FT_insertFile("a/h/b/F", "Y", 2) == SUCCESS);
+  assert(FT_hash("a", &l) == SUCCESS);
+  assert(l == used);
+  FT_freeSnapshot(snapshot);
+  snapshot = FT_snapshot();
+  assert(snapshot != NULL);
+  changes[0] = '\0';
+  assert(FT_diff(current, snapshot, recordChange, changes) == SUCCESS);
+  assert(changes[0] == '\0');
+  FT_freeSnapshot(snapshot);
+  FT_freeSnapshot(current);
+  FT_freeSnapshot(empty);
+  assert(FT_destroy() == SUCCESS);
+
+  /* A transaction's changes take effect together at FT_commit, or are
+     all rolled back by FT_abort or by any call in it failing */
+  assert(FT_begin() == INITIALIZATION_ERROR);
+  assert(FT_init() == SUCCESS);
+  assert(FT_commit() == INITIALIZATION_ERROR);
+  assert(FT_abort() == INITIALIZATION_ERROR);
+  assert(FT_begin() == SUCCESS);
+  assert(FT_insertDir("a") == SUCCESS);
+  assert(FT_abort() == SUCCESS);
+  assert(FT_containsDir("a") == FALSE);
+  assert(FT_insertDir("a/b") == SUCCESS);
+  assert(FT_insertFile("a/b/F", "F", 2) == SUCCESS);
+  expected = FT_toString();
+  assert(expected != NULL);
+  assert(FT_begin() == SUCCESS);
+  assert(FT_begin() == INITIALIZATION_ERROR);
+  assert(FT_insertDir("a/c") == SUCCESS);
+  assert(FT_rmDir("a/b") == SUCCESS);
+  assert(FT_insertFile("a/c/G", "G", 2) == SUCCESS);
+  assert(FT_containsDir("a/b") == FALSE);
+  assert(FT_abort() == SUCCESS);
+  temp = FT_toString();
+  assert(temp != NULL);
+  assert(!strcmp(temp, expected));
+  free(temp);
+  free(expected);
+  assert(FT_memoryUsage(&usage) == SUCCESS);
+  assert(usage.numNodes == 3);
+  assert(FT_begin() == SUCCESS);
+  assert(FT_insertDir("a/c") == SUCCESS);
+  assert(FT_insertFile("a/c/G", "G", 2) == SUCCESS);
+  assert(FT_move("a/b/F", "a/c/F") == SUCCESS);
+  assert(FT_commit() == SUCCESS);
+  assert(FT_containsFile("a/c/F"));
+  assert(FT_containsFile("a/b/F") == FALSE);
+  assert(FT_begin() == SUCCESS);
+  assert(FT_insertDir("a/d") == SUCCESS);
+  assert(FT_insertDir("a/c") == ALREADY_IN_TREE);
+  assert(FT_rmDir("a/c") == SUCCESS);
+  assert(FT_commit() == ALREADY_IN_TREE);
+  assert(FT_containsDir("a/d") == FALSE);
+  assert(FT_containsFile("a/c/G"));
+  assert(FT_begin() == SUCCESS);
+  assert(FT_replaceFileContents("a/c/x", "X", 2) == NULL);
+  assert(FT_rmFile("a/c/G") == SUCCESS);
+  assert(FT_commit() == NO_SUCH_PATH);
+  assert(FT_containsFile("a/c/G"));
+  assert(FT_begin() == SUCCESS);
+  assert(FT_rmDir("a/c") == SUCCESS);
+  assert(FT_destroy() == SUCCESS);
+  assert(FT_init() == SUCCESS);
+  assert(FT_memoryUsage(&usage) == SUCCESS);
+  assert(usage.numNodes == 0);
+  assert(FT_commit() == INITIALIZATION_ERROR);
+  assert(FT_destroy() == SUCCESS);
+
+  /* FT_load rebuilds exactly the hierarchy FT_save wrote, contents,
+     lengths and quotas included, and rejects anything else */
+  assert(FT_save(-1) == INITIALIZATION_ERROR);
+  assert(FT_init() == SUCCESS);
+  assert(FT_insertDir("a/b-x") == SUCCESS);
+  assert(FT_insertFile("a/b/F", "F", 2) == SUCCESS);
+  assert(FT_insertFile("a/b/G", NULL, 0) == SUCCESS);
+  assert(FT_insertFile("a/E", "", 0) == SUCCESS);
+  assert(FT_insertDir("a/c/d") == SUCCESS);
+  assert(FT_setQuota("a/c", 2, 10) == SUCCESS);
+  expected = FT_toString();
+  assert(expected != NULL);
+  assert(pipe(fds) == 0);
+  assert(FT_save(fds[1]) == SUCCESS);
+  assert(close(fds[1]) == 0);
+  assert(FT_load(fds[0]) == CONFLICTING_PATH);
+  assert(FT_destroy() == SUCCESS);
+  assert(FT_load(fds[0]) == INITIALIZATION_ERROR);
+  assert(FT_init() == SUCCESS);
+  assert(FT_load(fds[0]) == SUCCESS);
+  assert(close(fds[0]) == 0);
+  temp = FT_toString();
+  assert(temp != NULL);
+  assert(!strcmp(temp, expected));
+  free(temp);
+  free(expected);
+  assert(!strcmp(FT_getFileContents("a/b/F"), "F"));
+  assert(FT_getFileContents("a/b/G") == NULL);
+  assert(FT_getFileContents("a/E") != NULL);
+  assert(FT_stat("a/b/F", &b, &l) == SUCCESS);
+  assert(b == TRUE && l == 2);
+  assert(FT_du("a", &used, &l) == SUCCESS);
+  assert(used == 7 && l == 2);
+  assert(FT_insertDir("a/c/e/f") == QUOTA_EXCEEDED);
+  assert(FT_replaceFileContents("a/b/F", "FF", 3) != NULL);
+  assert(FT_destroy() == SUCCESS);
+  assert(FT_init() == SUCCESS);
+  assert(pipe(fds) == 0);
+  assert(write(fds[1], "FTSAVE0", 8) == 8);
+  assert(close(fds[1]) == 0);
+  assert(FT_load(fds[0]) == IO_ERROR);
+  assert(close(fds[0]) == 0);
+  assert(pipe(fds) == 0);
+  assert(FT_save(fds[1]) == SUCCESS);
+  assert(close(fds[1]) == 0);
+  assert(FT_load(fds[0]) == SUCCESS);
+  assert(close(fds[0]) == 0);
+  assert(FT_containsDir("a") == FALSE);
+  assert(FT_destroy() == SUCCESS);
+
+  /* A mapped image answers queries in place, independently of the
+     hierarchy it was saved from */
+  fd = open("ft_client.img", O_RDWR | O_CREAT | O_TRUNC, 0600);
+  assert(fd >= 0);
+  assert(unlink("ft_client.img") == 0);
+  assert(FT_saveImage(fd) == INITIALIZATION_ERROR);
+  assert(FT_mapImage(fd) == NULL);
+  assert(FT_init() == SUCCESS);
+  assert(FT_insertDir("a/b-x") == SUCCESS);
+  assert(FT_insertFile("a/b/F", "F", 2) == SUCCESS);
+  assert(FT_insertFile("a/b/G", NULL, 0) == SUCCESS);
+  assert(FT_insertFile("a/E", "", 0) == SUCCESS);
+  assert(FT_insertDir("a/c/d") == SUCCESS);
+  assert(FT_saveImage(fd) == SUCCESS);
+  assert(FT_destroy() == SUCCESS);
+  image = FT_mapImage(fd);
+  assert(image != NULL);
+  assert(close(fd) == 0);
+  assert(FT_imageContainsDir(image, "a"));
+  assert(FT_imageContainsDir(image, "a/b-x"));
+  assert(FT_imageContainsDir(image, "a/c/d"));
+  assert(FT_imageContainsDir(image, "a/b/F") == FALSE);
+  assert(FT_imageContainsDir(image, "a/b/") == FALSE);
+  assert(FT_imageContainsDir(image, "b") == FALSE);
+  assert(FT_imageContainsFile(image, "a/b/F"));
+  assert(FT_imageContainsFile(image, "a/E"));
+  assert(FT_imageContainsFile(image, "a/b") == FALSE);
+  assert(FT_imageContainsFile(image, "a/b/F/x") == FALSE);
+  assert(FT_imageContainsFile(image, "a/b/H") == FALSE);
+  assert(!strcmp(FT_imageGetFileContents(image, "a/b/F"), "F"));
+  assert(FT_imageGetFileContents(image, "a/b/G") == NULL);
+  assert(FT_imageGetFileContents(image, "a/E") != NULL);
+  assert(FT_imageGetFileContents(image, "a/c") == NULL);
+  assert(FT_imageStat(image, "a/b/F", &b, &l) == SUCCESS);
+  assert(b == TRUE && l == 2);
+  assert(FT_imageStat(image, "a/c", &b, &l) == SUCCESS);
+  assert(b == FALSE);
+  assert(FT_imageStat(image, "a/x", &b, &l) == NO_SUCH_PATH);
+  FT_unmapImage(image);
+  fd = open("ft_client.img", O_RDWR | O_CREAT | O_TRUNC, 0600);
+  assert(fd >= 0);
+  assert(unlink("ft_client.img") == 0);
+  assert(FT_init() == SUCCESS);
+  assert(FT_saveImage(fd) == SUCCESS);
+  assert(FT_destroy() == SUCCESS);
+  image = FT_mapImage(fd);
+  assert(image != NULL);
+  assert(close(fd) == 0);
+  assert(FT_imageContainsDir(image, "a") == FALSE);
+  FT_unmapImage(image);
+
+  /* Recovery rebuilds the hierarchy from the last saved image and the
+     changes logged after it, up to the last complete record */
+  fd = open("ft_client.img", O_RDWR | O_CREAT | O_TRUNC, 0600);
+  assert(fd >= 0);
+  assert(unlink("ft_client.img") == 0);
+  logFd = open("ft_client.log", O_RDWR | O_CREAT | O_TRUNC, 0600);
+  assert(logFd >= 0);
+  assert(unlink("ft_client.log") == 0);
+  assert(FT_openLog(logFd) == INITIALIZATION_ERROR);
+  assert(FT_init() == SUCCESS);
+  assert(FT_syncLog() == INITIALIZATION_ERROR);
+  assert(FT_insertDir("a/b") == SUCCESS);
+  assert(FT_insertFile("a/b/F", "F", 2) == SUCCESS);
+  assert(FT_save(fd) == SUCCESS);
+  assert(FT_openLog(logFd) == SUCCESS);
+  assert(FT_openLog(logFd) == INITIALIZATION_ERROR);
+  assert(FT_insertDir("a/c") == SUCCESS);
+  assert(FT_insertDir("a/c") == ALREADY_IN_TREE);
+  assert(FT_insertFile("a/c/G", NULL, 4) == SUCCESS);
+  assert(FT_replaceFileContents("a/b/F", "FF", 3) != NULL);
+  assert(FT_replaceFileContents("a/b/x", "X", 2) == NULL);
+  assert(FT_syncLog() == SUCCESS);
+  assert(FT_begin() == SUCCESS);
+  assert(FT_rmFile("a/c/G") == SUCCESS);
+  assert(FT_abort() == SUCCESS);
+  assert(FT_begin() == SUCCESS);
+  assert(FT_copy("a/b", "a/d") == SUCCESS);
+  assert(FT_commit() == SUCCESS);
+  assert(FT_move("a/d/F", "a/E") == SUCCESS);
+  assert(FT_setQuota("a/c", 2, 0) == SUCCESS);
+  assert(FT_insertMany(bulkPaths, bulkContents, bulkLengths, 6)
+         == CONFLICTING_PATH);
+  assert(FT_rmDir("a/b") == SUCCESS);
+  assert(FT_insertDir("a/b") == SUCCESS);
+  expected = FT_toString();
+  assert(expected != NULL);
+  assert(FT_closeLog() == SUCCESS);
+  assert(FT_closeLog() == INITIALIZATION_ERROR);
+  assert(write(logFd, "torn", 4) == 4);
+  assert(FT_destroy() == SUCCESS);
+  assert(lseek(fd, 0, SEEK_SET) == 0);
+  assert(lseek(logFd, 0, SEEK_SET) == 0);
+  assert(FT_recover(fd, logFd) == SUCCESS);
+  assert(FT_recover(fd, logFd) == INITIALIZATION_ERROR);
+  temp = FT_toString();
+  assert(temp != NULL);
+  assert(!strcmp(temp, expected));
+  free(temp);
+  free(expected);
+  assert(!strcmp(FT_getFileContents("a/E"), "FF"));
+  assert(FT_stat("a/c/G", &b, &l) == SUCCESS);
+  assert(b == TRUE && l == 4);
+  assert(FT_getFileContents("a/c/G") == NULL);
+  assert(FT_insertDir("a/c/x/y") == QUOTA_EXCEEDED);
+  /* The log continues where the torn record was cut off */
+  assert(FT_openLog(logFd) == SUCCESS);
+  assert(FT_rmFile("a/E") == SUCCESS);
+  assert(FT_destroy() == SUCCESS);
+  assert(lseek(fd, 0, SEEK_SET) == 0);
+  assert(lseek(logFd, 0, SEEK_SET) == 0);
+  assert(FT_recover(fd, logFd) == SUCCESS);
+  assert(FT_containsFile("a/E") == FALSE);
+  assert(FT_containsFile("a/d/F") == FALSE);
+  assert(FT_destroy() == SUCCESS);
+  assert(lseek(logFd, 0, SEEK_SET) == 0);
+  assert(FT_recover(-1, logFd) == IO_ERROR);
+  assert(FT_containsDir("a") == FALSE);
+  assert(close(fd) == 0);
+  /* Replayed contents are copied as owned ones, and so are freed as
+     the log replaces them rather than kept until FT_destroy */
+  assert(close(logFd) == 0);
+  logFd = open("ft_client.log", O_RDWR | O_CREAT | O_TRUNC, 0600);
+  assert(logFd >= 0);
+  assert(unlink("ft_client.log") == 0);
+  memset(arr, 'r', 63);
+  arr[63] = '\0';
+  memset(arr + 64, 'q', 63);
+  arr[127] = '\0';
+  assert(FT_init() == SUCCESS);
+  assert(FT_setOwnedContents(TRUE) == SUCCESS);
+  assert(FT_openLog(logFd) == SUCCESS);
+  assert(FT_insertDir("a") == SUCCESS);
+  assert(FT_insertFile("a/F", arr, 64) == SUCCESS);
+  assert(FT_memoryUsage(&usage) == SUCCESS);
+  used = usage.storedBytes;
+  for(i = 0; i < 4; i++)
+    assert(FT_replaceFileContents("a/F", arr + 64 * (i % 2 == 0), 64)
+           != NULL);
+  assert(FT_destroy() == SUCCESS);
+  assert(lseek(logFd, 0, SEEK_SET) == 0);
+  assert(FT_recover(-1, logFd) == SUCCESS);
+  assert(!strcmp(FT_getFileContents("a/F"), arr));
+  assert(FT_memoryUsage(&usage) == SUCCESS);
+  assert(usage.storedBytes == 2 * used);
+  assert(FT_destroy() == SUCCESS);
+  assert(close(logFd) == 0);
+
+  /* FT_importDir mirrors a directory of the file system, with its
+     empty directories and, optionally, its files' bytes */
+  assert(mkdir("ft_client.dir", 0700) == 0);
+  assert(mkdir("ft_client.dir/b", 0700) == 0);
+  assert(mkdir("ft_client.dir/b/c", 0700) == 0);
+  fd = open("ft_client.dir/F", O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  assert(fd >= 0);
+  assert(write(fd, "hello", 5) == 5);
+  assert(close(fd) == 0);
+  fd = open("ft_client.dir/b/G", O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  assert(fd >= 0);
+  assert(close(fd) == 0);
+  assert(FT_importDir("ft_client.dir", "a/i", FT_IMPORT_CONTENTS)
+         == INITIALIZATION_ERROR);
+  assert(FT_init() == SUCCESS);
+  assert(FT_insertDir("a/h") == SUCCESS);
+  assert(FT_importDir("ft_client.dir", "a/i", FT_IMPORT_CONTENTS)
+         == SUCCESS);
+  assert(FT_containsDir("a/i/b/c"));
+  assert(FT_containsFile("a/i/F"));
+  assert(FT_stat("a/i/F", &b, &l) == SUCCESS);
+  assert(b == TRUE && l == 5);
+  assert(!strncmp(FT_getFileContents("a/i/F"), "hello", 5));
+  assert(FT_getFileContents("a/i/b/G") != NULL);
+  assert(FT_du("a/i", &used, &l) == SUCCESS);
+  assert(used == 4 && l == 5);
+  assert(FT_importDir("ft_client.dir", "a/i", 0) == ALREADY_IN_TREE);
+  assert(FT_importDir("ft_client.dir/b", "a/j/k", 0) == SUCCESS);
+  assert(FT_containsFile("a/j/k/G"));
+  /* Imported contents are copies the tree owns, freed with the file */
+  fd = open("ft_client.dir/b/G", O_WRONLY | O_TRUNC);
+  assert(fd >= 0);
+  assert(write(fd, "0123456789abcdef0123456789abcdef0123456789abcdef"
+               "0123456789abcdef", 64) == 64);
+  assert(close(fd) == 0);
+  assert(FT_memoryUsage(&usage) == SUCCESS);
+  used = usage.storedBytes;
+  assert(FT_importDir("ft_client.dir/b", "a/j/m", FT_IMPORT_CONTENTS)
+         == SUCCESS);
+  assert(!strncmp(FT_getFileContents("a/j/m/G"), "0123456789abcdef", 16));
+  assert(FT_memoryUsage(&usage) == SUCCESS);
+  assert(usage.storedBytes > used);
+  assert(FT_rmFile("a/j/m/G") == SUCCESS);
+  assert(FT_memoryUsage(&usage) == SUCCESS);
+  assert(usage.storedBytes == used);
+  fd = open("ft_client.dir/b/G", O_WRONLY | O_TRUNC);
+  assert(fd >= 0);
+  assert(close(fd) == 0);
+  assert(FT_getFileContents("a/j/k/G") == NULL);
+  assert(FT_importDir("ft_client.dir/x", "a/x", 0) == IO_ERROR);
+  assert(FT_containsDir("a/x") == FALSE);
+  assert(FT_destroy() == SUCCESS);
+  assert(unlink("ft_client.dir/b/G") == 0);
+  assert(unlink("ft_client.dir/F") == 0);
+  assert(rmdir("ft_client.dir/b/c") == 0);
+  assert(rmdir("ft_client.dir/b") == 0);
+  assert(rmdir("ft_client.dir") == 0);
+
+  /* The content store copies contents in, keeping one copy for all
+     the files that hold the same bytes */
+  assert(FT_setContentStore(TRUE) == INITIALIZATION_ERROR);
+  assert(FT_init() == SUCCESS);
+  assert(FT_setContentStore(TRUE) == SUCCESS);
+  /* (contents this long are too big to be kept inline) */
+  memset(arr, 's', 63);
+  arr[63] = '\0';
+  strcpy(arr + 64, arr);
+  assert(FT_insertDir("a") == SUCCESS);
+  assert(FT_insertFile("a/F", arr, 64) == SUCCESS);
+  assert(FT_insertFile("a/G", arr + 64, 64) == SUCCESS);
+  assert(FT_setQuota("a", 2, 0) == SUCCESS);
+  assert(FT_insertFile("a/X", arr, 64) == QUOTA_EXCEEDED);
+  assert(FT_setQuota("a", 0, 0) == SUCCESS);
+  temp = FT_getFileContents("a/F");
+  assert(temp != arr && temp == FT_getFileContents("a/G"));
+  memset(arr, 'd', 63);
+  assert(!strcmp(FT_getFileContents("a/F"), arr + 64));
+  assert(FT_memoryUsage(&usage) == SUCCESS);
+  used = usage.storedBytes;
+  assert(used >= 64);
+  assert(FT_replaceFileContents("a/G", arr, 64) == temp);
+  assert(!strcmp(temp, arr + 64));
+  assert(!strcmp(FT_getFileContents("a/G"), arr));
+  assert(FT_memoryUsage(&usage) == SUCCESS);
+  assert(usage.storedBytes == 2 * used);
+  assert(FT_rmFile("a/F") == SUCCESS);
+  assert(FT_replaceFileContents("a/G", arr + 64, 64) != NULL);
+  assert(FT_replaceFileContents("a/G", arr + 64, 64) != NULL);
+  assert(FT_memoryUsage(&usage) == SUCCESS);
+  assert(usage.storedBytes == used);
+  /* The memory budget counts the copies the store would make */
+  cost = usage.nodeBytes + usage.pathBytes + usage.childPhysicalBytes
+    + usage.fileBytes + usage.storedBytes;
+  assert(FT_setMemoryBudget(cost + used) == SUCCESS);
+  assert(FT_insertFile("a/X", arr, 64) == MEMORY_ERROR);
+  assert(FT_setMemoryBudget(cost) == SUCCESS);
+  assert(FT_replaceFileContents("a/G", arr, 65) == NULL);
+  assert(FT_replaceFileContents("a/G", arr, 63) != NULL);
+  assert(FT_setMemoryBudget(0) == SUCCESS);
+  assert(FT_setContentStore(FALSE) == SUCCESS);
+  assert(FT_insertFile("a/H", arr, 5) == SUCCESS);
+  assert(FT_getFileContents("a/H") == arr);
+  assert(FT_destroy() == SUCCESS);
+  assert(FT_init() == SUCCESS);
+  assert(FT_memoryUsage(&usage) == SUCCESS);
+  assert(usage.storedBytes == 0);
+  assert(FT_destroy() == SUCCESS);
+
+  /* With owned contents each file gets a copy of its own, and a view
+     keeps the contents it shows alive however the file changes */
+  assert(FT_setOwnedContents(TRUE) == INITIALIZATION_ERROR);
+  assert(FT_init() == SUCCESS);
+  assert(FT_setOwnedContents(TRUE) == SUCCESS);
+  /* (contents this long are too big to be kept inline) */
+  memset(arr, 'a', 63);
+  arr[63] = '\0';
+  memset(arr + 64, 'x', 63);
+  arr[127] = '\0';
+  assert(FT_insertDir("a") == SUCCESS);
+  assert(FT_insertFile("a/F", arr, 64) == SUCCESS);
+  assert(FT_insertFile("a/G", arr, 64) == SUCCESS);
+  temp = FT_getFileContents("a/F");
+  assert(temp != arr && temp != FT_getFileContents("a/G"));
+  assert(FT_getFileView("a", &view) == NOT_A_FILE);
+  assert(FT_getFileView("a/x", &view) == NO_SUCH_PATH);
+  assert(FT_getFileView("a/F", &view) == SUCCESS);
+  assert(view.contents == temp && view.length == 64);
+  assert(FT_replaceFileContents("a/F", arr + 64, 64) == temp);
+  assert(FT_rmFile("a/F") == SUCCESS);
+  assert(FT_replaceFileContents("a/G", arr + 64, 64) != NULL);
+  assert(!strcmp(view.contents, arr));
+  snapshot = FT_snapshot();
+  assert(snapshot != NULL);
+  assert(FT_destroy() == SUCCESS);
+  assert(!strcmp(view.contents, arr));
+  FT_releaseView(&view);
+  assert(view.contents == NULL && view.length == 0);
+  assert(FT_snapshotGetFileView(snapshot, "a/F", &view) == NO_SUCH_PATH);
+  assert(FT_snapshotGetFileView(snapshot, "a/G", &view) == SUCCESS);
+  FT_freeSnapshot(snapshot);
+  assert(!strcmp(view.contents, arr + 64) && view.length == 64);
+  FT_releaseView(&view);
+  assert(FT_init() == SUCCESS);
+  assert(FT_memoryUsage(&usage) == SUCCESS);
+  assert(usage.storedBytes == 0);
+  assert(FT_insertFile("a", arr, 4) == CONFLICTING_PATH);
+  assert(FT_insertDir("a") == SUCCESS);
+  assert(FT_insertFile("a/I", arr, 4) == SUCCESS);
+  assert(FT_getFileView("a/I", &view) == SUCCESS);
+  assert(view.contents == arr && view.reference == NULL);
+  FT_releaseView(&view);
+  assert(FT_destroy() == SUCCESS);
+  /* Bulk inserts copy contents just as FT_insertFile does */
+  assert(FT_init() == SUCCESS);
+  assert(FT_setOwnedContents(TRUE) == SUCCESS);
+  assert(FT_insertMany(bulkPaths, bulkContents, bulkLengths, 6)
+         == SUCCESS);
+  for(i = 0; i < 6; i++) {
+    temp = FT_getFileContents(bulkPaths[i]);
+    assert(temp != bulkContents[i] && !strcmp(temp, bulkContents[i]));
+    bigContents[i] = arr;
+    bigLengths[i] = 64;
+  }
+  assert(FT_destroy() == SUCCESS);
+  assert(FT_init() == SUCCESS);
+  assert(FT_setContentStore(TRUE) == SUCCESS);
+  assert(FT_build(bulkPaths, bigContents, bigLengths, 6, 2) == SUCCESS);
+  temp = FT_getFileContents("r/e");
+  assert(temp != arr && !strcmp(temp, arr));
+  assert(FT_getFileContents("r/b/c/I") == temp);
+  assert(FT_memoryUsage(&usage) == SUCCESS);
+  used = usage.storedBytes;
+  assert(FT_rmDir("r/b") == SUCCESS);
+  assert(FT_memoryUsage(&usage) == SUCCESS);
+  assert(usage.storedBytes == used);
+  assert(FT_destroy() == SUCCESS);
+
+  /* Small owned contents are kept inline in the file's node, and
+     stay there while replacements fit */
+  assert(FT_init() == SUCCESS);
+  assert(FT_setOwnedContents(TRUE) == SUCCESS);
+  strcpy(arr, "abc");
+  assert(FT_insertDir("a") == SUCCESS);
+  assert(FT_insertFile("a/F", arr, 4) == SUCCESS);
+  assert(FT_memoryUsage(&usage) == SUCCESS);
+  assert(usage.storedBytes == 0 && usage.fileBytes == 0);
+  temp = FT_getFileContents("a/F");
+  assert(temp != arr && !strcmp(temp, "abc"));
+  /* (a view of inline contents holds a copy, so may be moved) */
+  assert(FT_getFileView("a/F", &view) == SUCCESS);
+  assert(view.contents != temp && view.reference != NULL);
+  moved = view;
+  view.contents = NULL;
+  assert(!strcmp(FT_replaceFileContents("a/F", "xyz", 4), "abc"));
+  assert(FT_getFileContents("a/F") == temp && !strcmp(temp, "xyz"));
+  assert(!strcmp(moved.contents, "abc") && moved.length == 4);
+  FT_releaseView(&moved);
+  snapshot = FT_snapshot();
+  assert(snapshot != NULL);
+  assert(!strcmp(FT_replaceFileContents("a/F", "pq", 3), "xyz"));
+  assert(!strcmp(FT_snapshotGetFileContents(snapshot, "a/F"), "xyz"));
+  memset(arr, 'b', 63);
+  arr[63] = '\0';
+  assert(!strcmp(FT_replaceFileContents("a/F", arr, 64), "pq"));
+  assert(FT_memoryUsage(&usage) == SUCCESS);
+  assert(usage.storedBytes > 64);
+  assert(FT_replaceFileContents("a/F", "abc", 4) != NULL);
+  assert(!strcmp(FT_getFileContents("a/F"), "abc"));
+  FT_freeSnapshot(snapshot);
+  assert(FT_destroy() == SUCCESS);
+  assert(FT_init() == SUCCESS);
+  assert(FT_memoryUsage(&usage) == SUCCESS);
+  assert(usage.storedBytes == 0);
+  assert(FT_destroy() == SUCCESS);
+
+  /* The memory budget counts the room of each inline file before
+     inserting it, so small owned files fill it without going over */
+  assert(FT_init() == SUCCESS);
+  assert(FT_setOwnedContents(TRUE) == SUCCESS);
+  assert(FT_insertDir("a") == SUCCESS);
+  memset(arr, 'i', FT_INLINE_MAX - 1);
+  arr[FT_INLINE_MAX - 1] = '\0';
+  assert(FT_memoryUsage(&usage) == SUCCESS);
+  used = usage.nodeBytes + usage.pathBytes + usage.childPhysicalBytes
+    + usage.fileBytes;
+  assert(FT_insertFile("a/F", arr, FT_INLINE_MAX) == SUCCESS);
+  assert(FT_memoryUsage(&usage) == SUCCESS);
+  cost = usage.nodeBytes + usage.pathBytes + usage.childPhysicalBytes
+    + usage.fileBytes - used;
+  assert(FT_rmFile("a/F") == SUCCESS);
+  assert(FT_setMemoryBudget(used + cost - 1) == SUCCESS);
+  assert(FT_insertFile("a/F", arr, FT_INLINE_MAX) == MEMORY_ERROR);
+  manyPaths[0] = "a/F";
+  bigContents[0] = arr;
+  bigLengths[0] = FT_INLINE_MAX;
+  assert(FT_insertMany(manyPaths, bigContents, bigLengths, 1)
+         == MEMORY_ERROR);
+  assert(FT_setMemoryBudget(used + 20 * cost) == SUCCESS);
+  for(i = 0; i < 64; i++) {
+    sprintf(manyNames[i], "a/f%lu", (unsigned long) i);
+    if(FT_insertFile(manyNames[i], arr, FT_INLINE_MAX) != SUCCESS)
+      break;
+    assert(FT_memoryUsage(&usage) == SUCCESS);
+    assert(usage.nodeBytes + usage.pathBytes + usage.childPhysicalBytes
+           + usage.fileBytes <= used + 20 * cost);
+  }
+  assert(i > 0 && i < 64);
+  /* and the copy of each larger file, as it is inserted or grown */
+  memset(arr, 'o', 999);
+  arr[999] = '\0';
+  assert(FT_memoryUsage(&usage) == SUCCESS);
+  used = usage.nodeBytes + usage.pathBytes + usage.childPhysicalBytes
+    + usage.fileBytes + usage.storedBytes;
+  assert(FT_setMemoryBudget(used + 1000) == SUCCESS);
+  assert(FT_insertFile("a/o", arr, 1000) == MEMORY_ERROR);
+  assert(FT_insertFile("a/o", arr, 200) == SUCCESS);
+  assert(FT_replaceFileContents("a/o", arr, 1000) == NULL);
+  assert(FT_setMemoryBudget(0) == SUCCESS);
+  assert(FT_replaceFileContents("a/o", arr, 1000) != NULL);
+  assert(FT_destroy() == SUCCESS);
+
+  /* FT_hash is equal for equal hierarchies however they were built,
+     and changes with any change at or beneath its path */
+  assert(FT_hash("a", &used) == INITIALIZATION_ERROR);
+  assert(FT_init() == SUCCESS);
+  assert(FT_insertDir("a/b") == SUCCESS);
+  assert(FT_insertFile("a/b/F", "hello", 5) == SUCCESS);
+  assert(FT_insertDir("a/c") == SUCCESS);
+  assert(FT_hash("a", &used) == SUCCESS);
+  assert(FT_hash("a/b", &l) == SUCCESS);
+  assert(FT_hash("a/x", &l) == NO_SUCH_PATH);
+  assert(FT_replaceFileContents("a/b/F", "jello", 5) != NULL);
+  assert(FT_hash("a/c", &l) == SUCCESS);
+  assert(FT_hash("a", &l) == SUCCESS);
+  assert(l != used);
+  assert(FT_replaceFileContents("a/b/F", "hello", 5) != NULL);
+  assert(FT_hash("a", &l) == SUCCESS);
+  assert(l == used);
+  assert(FT_copy("a/b", "a/d") == SUCCESS);
+  assert(FT_hash("a", &l) == SUCCESS);
+  assert(l != used);
+  assert(FT_rmDir("a/d") == SUCCESS);
+  assert(FT_hash("a", &l) == SUCCESS);
+  assert(l == used);
+  assert(FT_move("a/b", "a/e") == SUCCESS);
+  assert(FT_hash("a", &l) == SUCCESS);
+  assert(l != used);
+  assert(FT_destroy() == SUCCESS);
+  assert(FT_init() == SUCCESS);
+  assert(FT_insertDir("a/c") == SUCCESS);
+  assert(FT_insertDir("a/b") == SUCCESS);
+  assert(FT_insertFile("a/b/F", "hello", 5) == SUCCESS);
+  assert(FT_hash("a", &l) == SUCCESS);
+  assert(l == used);
+  assert(FT_destroy() == SUCCESS);
+
+  /* FT_exportTo recreates the hierarchy beneath a directory of the
+     file system, reusing directories and overwriting files there */
+  assert(FT_exportTo(".") == INITIALIZATION_ERROR);
+  assert(mkdir("ft_client.dir", 0700) == 0);
+  assert(FT_init() == SUCCESS);
+  assert(FT_exportTo("ft_client.dir") == SUCCESS);
+  assert(FT_insertDir("a/b/c") == SUCCESS);
+  assert(FT_insertFile("a/b/F", "hello", 5) == SUCCESS);
+  assert(FT_insertFile("a/G", NULL, 0) == SUCCESS);
+  assert(FT_exportTo("ft_client.dir/x") == IO_ERROR);
+  assert(FT_exportTo("ft_client.dir") == SUCCESS);
+  assert(FT_replaceFileContents("a/b/F", "hi", 2) != NULL);
+  assert(FT_exportTo("ft_client.dir") == SUCCESS);
+  assert(FT_destroy() == SUCCESS);
+  assert(FT_init() == SUCCESS);
+  assert(FT_importDir("ft_client.dir/a", "a", FT_IMPORT_CONTENTS)
+         == SUCCESS);
+  assert(FT_containsDir("a/b/c"));
+  assert(FT_stat("a/b/F", &b, &l) == SUCCESS);
+  assert(b == TRUE && l == 2);
+  assert(!strncmp(FT_getFileContents("a/b/F"), "hi", 2));
+  assert(FT_stat("a/G", &b, &l) == SUCCESS);
+  assert(b == TRUE && l == 0);
+  assert(FT_destroy() == SUCCESS);
+  assert(unlink("ft_client.dir/a/b/F") == 0);
+  assert(unlink("ft_client.dir/a/G") == 0);
+  assert(rmdir("ft_client.dir/a/b/c") == 0);
+  assert(rmdir("ft_client.dir/a/b") == 0);
+  assert(rmdir("ft_client.dir/a") == 0);
+  assert(rmdir("ft_client.dir") == 0);
+
+  /* When instrumentation is compiled in, each public call is counted
+     exactly once, even though some FT functions are implemented in
+     terms of others, and every call lands in one latency bucket. */
+  FT_resetStats();
+  assert(FT_init() == SUCCESS);
+  assert(FT_insertDir("a/b") == SUCCESS);
+  assert(FT_insertDir("a/b") == ALREADY_IN_TREE);
+  assert(FT_containsFile("a/b") == FALSE);
+  FT_getStats(&stats);
+  if(stats.calls[FT_OP_INIT] != 0) {
+    assert(stats.calls[FT_OP_INIT] == 1);
+    assert(stats.calls[FT_OP_INSERTDIR] == 2);
+    assert(stats.statuses[FT_OP_INSERTDIR][SUCCESS] == 1);
+    assert(stats.statuses[FT_OP_INSERTDIR][ALREADY_IN_TREE] == 1);
+    assert(stats.calls[FT_OP_CONTAINSFILE] == 1);
+    assert(stats.statuses[FT_OP_CONTAINSFILE][NO_SUCH_PATH] == 1);
+    assert(stats.calls[FT_OP_CONTAINSDIR] == 0);
+    assert(stats.visits[FT_OP_CONTAINSFILE][0] == 0);
+    sum = 0;
+    for(i = 0; i < FT_LATENCY_BUCKETS; i++)
+      sum += stats.latency[FT_OP_INSERTDIR][i];
+    assert(sum == 2);
+  }
+  FT_resetStats();
+  FT_getStats(&stats);
+  assert(stats.calls[FT_OP_INIT] == 0);
+  assert(FT_destroy() == SUCCESS);
   
   return 0;
 }
@@ -3,10 +3,14 @@
 /* Authors: Ellen Su and Michael Garcia                               */
 /*--------------------------------------------------------------------*/
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include "a4def.h"
 #include "dynarray.h"
@@ -17,98 +21,290 @@
    A node structure represents a directory in the directory tree
 */
 struct node {
-   /* the full path of this directory */
-   char* path;
+   /* the name of this node: the last component of its path, which
+   is never stored whole but rebuilt from the names along the way
+   down from the root when needed */
+   char* name;
 
    /* the parent directory of this directory
-      NULL for the root of the directory tree */
+      NULL for the root of the directory tree. Only meaningful while
+      the node is not shared: a shared node has several parents, and
+      this is set again whenever the node is reached by
+      Node_ownChild. */
    Node_T parent;
 
+   /* the number of directories (or other holders) referring to this
+   node; while it is above 1 the node and everything beneath it are
+   shared and must not change. Updated atomically, since a shared
+   node may be released by the background reclaimer. */
+   size_t refCount;
+
    /* set type to 0 to indicate file node or 1 to
    indicate directory node. */
    nodeType type;
 
    /* either the children of a directory or the contents
    of a file are stored. Children will be stored in lexicographic 
-   order. */
+   order. NULL for a file with room, which keeps its contents there
+   instead. */
    DynArray_T contents;
 
 
    /* stores the length of the contents of a file node. Is NULL for
    a directory node */
    size_t length;
+
+   /* the number of nodes in the subtree rooted at this node, itself
+   included, and the summed length of the files in it, kept up to
+   date as children are linked and unlinked and lengths change */
+   size_t numNodes;
+   size_t totalLength;
+
+   /* the most nodes beneath this directory and the most file bytes at
+   or beneath it that inserts may bring it to, or 0 for no limit */
+   size_t maxNodes;
+   size_t maxLength;
+
+   /* TRUE while this node is in its parent's children, so that size
+   changes beneath a subtree that is still being assembled stop at
+   its top instead of reaching the tree it will later join */
+   boolean isLinked;
+
+   /* the hash of this subtree computed by Node_hash, valid while
+   isHashed is TRUE; any change at or beneath the node clears it */
+   size_t hash;
+   boolean isHashed;
+
+   /* TRUE if this file's contents come from Node_storeContents, in
+   which case the node holds one reference to them */
+   boolean isStored;
+
+   /* the bytes of room for contents allocated right after the node,
+   and TRUE if the file's contents are kept there; otherwise the room
+   begins with the pointer to them */
+   size_t room;
+   boolean isInline;
 };
 
+/*
+   One copy of some contents owned by the tree, followed in the same
+   allocation by the length bytes themselves.
+*/
+struct Node_stored {
+   /* TRUE if the copy is in the content store, to be shared by all
+   files with the same contents, and the next copy in its bucket */
+   boolean isShared;
+   struct Node_stored *next;
+   /* the references held by nodes and callers; once it drops to 0 the
+   copy is no longer found, and is freed by whoever dropped it */
+   size_t refCount;
+   size_t hash;
+   size_t length;
+};
+
+/* The content store: a hash table of struct Node_stored, in buckets
+   by hash, guarded by storeLock since copies may be released by
+   threads freeing nodes in parallel or in the background. */
+static pthread_mutex_t storeLock = PTHREAD_MUTEX_INITIALIZER;
+static struct Node_stored **storeBuckets;
+static size_t storeNumBuckets;
+static size_t storeCount;
+
+/* The bytes held by every struct Node_stored, shared or not. Updated
+   atomically rather than in the totals, since copies may be released
+   on any thread, including ones holding views of them. */
+static size_t storedBytes;
 
 /*
-  returns a path with contents n->path/dir
-  or NULL if there is an allocation error.
-  Allocates memory for the returned string,
-  which is then owned by the caller!
+   Running totals of the memory held by every live node, updated by
+   each function below that allocates, frees or resizes part of a node
+   so that they never have to be recomputed by walking a tree.
 */
-static char* Node_buildPath(Node_T n, const char* dir) {
-   char* path;
+static struct MemoryUsage usage;
 
-   assert(dir != NULL);
+/*
+   The totals that the calling thread's changes are applied to: usage
+   itself, unless the thread is building or freeing nodes privately
+   alongside other threads (see Node_setAccounting).
+*/
+static __thread struct MemoryUsage *totals = &usage;
 
-   if(n == NULL)
-      path = malloc(strlen(dir)+1);
-   else
-      path = malloc(strlen(n->path) + 1 + strlen(dir) + 1);
+/*
+   Adds the current size of n's contents array -- its child array if
+   n is a directory, its contents bookkeeping if n is a file -- to the
+   running totals if add is TRUE, or removes it if add is FALSE.
+   Callers bracket every change to the array with a removal before and
+   an addition after.
+*/
+static void Node_accountContents(Node_T n, boolean add) {
+   size_t logical;
+   size_t physical;
 
-   if(path == NULL)
-      return NULL;
-   *path = '\0';
+   assert(n != NULL);
+
+   if (n->contents == NULL)
+      return;
+   logical = DynArray_getLength(n->contents) * sizeof(void*);
+   physical = DynArray_getFootprint(n->contents);
 
-   if(n != NULL) {
-      strcpy(path, n->path);
-      strcat(path, "/");
+   if (n->type == DIRECTORY) {
+      if (add) {
+         totals->childLogicalBytes += logical;
+         totals->childPhysicalBytes += physical;
+      }
+      else {
+         totals->childLogicalBytes -= logical;
+         totals->childPhysicalBytes -= physical;
+      }
+   }
+   else {
+      if (add)
+         totals->fileBytes += physical;
+      else
+         totals->fileBytes -= physical;
    }
-   strcat(path, dir);
+}
 
-   return path;
+
+/*
+   Adds numNodes and length to the subtree size and total file length
+   of n and of each of its ancestors, or subtracts them if add is
+   FALSE, stopping at the top of n's linked hierarchy. Since something
+   at or beneath each of them has changed, their hashes are forgotten.
+*/
+static void Node_adjustSizes(Node_T n, size_t numNodes, size_t length,
+                             boolean add) {
+   for (; n != NULL; n = n->isLinked ? n->parent : NULL) {
+      n->isHashed = FALSE;
+      if (add) {
+         n->numNodes += numNodes;
+         n->totalLength += length;
+      }
+      else {
+         n->numNodes -= numNodes;
+         n->totalLength -= length;
+      }
+   }
 }
 
-/* see node.h for specification */
-Node_T Node_create(const char* dir, Node_T parent, nodeType type){
+/*
+   Creates a node as Node_create does, with room bytes after it in
+   the same allocation for inline contents.
+*/
+static Node_T Node_allocate(const char* dir, Node_T parent,
+                            nodeType type, size_t room) {
    Node_T new;
 
    assert(parent == NULL || CheckerFT_Node_isValid(parent));
    assert(dir != NULL);
+   assert(room == 0 || (type == FT_FILE && room >= sizeof(void*)));
 
-   new = malloc(sizeof(struct node));
+   new = malloc(sizeof(struct node) + room);
    if(new == NULL) {
       assert(parent == NULL || CheckerFT_Node_isValid(parent));
       return NULL;
    }
 
-   new->path = Node_buildPath(parent, dir);
+   new->name = malloc(strlen(dir) + 1);
 
-   if(new->path == NULL) {
+   if(new->name == NULL) {
       free(new);
       assert(parent == NULL || CheckerFT_Node_isValid(parent));
       return NULL;
    }
 
+   strcpy(new->name, dir);
    new->type = type;
 
    new->parent = parent;
    new->length = (size_t)0;
-   new->contents = DynArray_new(0);
-   if(new->contents == NULL) {
-      free(new->path);
-      free(new);
-      assert(parent == NULL || CheckerFT_Node_isValid(parent));
-      return NULL;
+   new->numNodes = 1;
+   new->totalLength = 0;
+   new->maxNodes = 0;
+   new->maxLength = 0;
+   new->isLinked = FALSE;
+   new->isHashed = FALSE;
+   new->isStored = FALSE;
+   new->room = room;
+   new->isInline = FALSE;
+   new->refCount = 1;
+   /* A file with room needs no contents array, since the room holds
+      either its contents or the pointer to them. */
+   new->contents = NULL;
+   if (room > 0)
+      *(void **)(new + 1) = NULL;
+   else {
+      new->contents = DynArray_new(0);
+      if(new->contents == NULL) {
+         free(new->name);
+         free(new);
+         assert(parent == NULL || CheckerFT_Node_isValid(parent));
+         return NULL;
+      }
    }
 
+   totals->nodeBytes += sizeof(struct node) + room;
+   totals->pathBytes += strlen(new->name) + 1;
+   totals->numNodes++;
+   if (type == FT_FILE)
+      totals->numFiles++;
+   Node_accountContents(new, TRUE);
+
    assert(parent == NULL || CheckerFT_Node_isValid(parent));
    assert(CheckerFT_Node_isValid(new));
    return new;
 }
 
 /* see node.h for specification */
-size_t Node_destroy(Node_T n) {
+Node_T Node_create(const char* dir, Node_T parent, nodeType type){
+   return Node_allocate(dir, parent, type, 0);
+}
+
+/* see node.h for specification */
+Node_T Node_createWithRoom(const char* dir, Node_T parent, size_t room){
+   return Node_allocate(dir, parent, FT_FILE, room);
+}
+
+/*
+   Frees n alone -- its name, its contents array and the node itself --
+   leaving any children untouched, and takes it out of the memory
+   totals.
+*/
+static void Node_free(Node_T n) {
+   assert(n != NULL);
+
+   Node_accountContents(n, FALSE);
+   totals->nodeBytes -= sizeof(struct node) + n->room;
+   totals->pathBytes -= strlen(n->name) + 1;
+   totals->numNodes--;
+   if (n->type == FT_FILE)
+      totals->numFiles--;
+
+   if (n->isStored)
+      Node_releaseContents((void *) Node_getContents(n));
+   if (n->contents != NULL)
+      DynArray_free(n->contents);
+
+   free(n->name);
+   free(n);
+}
+
+/*
+   Drops one reference to n. Returns TRUE if it was the last, in
+   which case the caller must free n, and FALSE otherwise.
+*/
+static boolean Node_release(Node_T n) {
+   assert(n != NULL);
+
+   return (boolean)(__sync_sub_and_fetch(&n->refCount, 1) == 0);
+}
+
+/*
+   Frees n, whose last reference has been released, and releases its
+   children, freeing each whose last reference that was. Returns the
+   number of nodes freed.
+*/
+static size_t Node_freeTree(Node_T n) {
    size_t i;
    size_t count = 0;
    Node_T c;
@@ -122,28 +318,275 @@ size_t Node_destroy(Node_T n) {
             count += Node_destroy(c);
          }
    }
-   DynArray_free(n->contents);
-
-   free(n->path);
-   free(n);
+   Node_free(n);
    count++;
 
    return count;
 }
 
+/* see node.h for specification */
+size_t Node_destroy(Node_T n) {
+   assert(n != NULL);
+
+   if (!Node_release(n))
+      return 0;
+   return Node_freeTree(n);
+}
+
+/* see node.h for specification */
+size_t Node_countUpTo(Node_T n, size_t limit) {
+   size_t i;
+   size_t count = 1;
+
+   assert(n != NULL);
+
+   if (n->type == DIRECTORY)
+      for (i = 0; i < DynArray_getLength(n->contents) && count < limit;
+           i++)
+         count += Node_countUpTo(DynArray_get(n->contents, i),
+                                 limit - count);
+   return count < limit ? count : limit;
+}
+
+/*
+   A worker's deque of nodes still to be freed: items[head..tail). The
+   owner pushes and pops at the tail, so that it works depth-first;
+   other workers steal from the head, where the oldest -- and so
+   typically largest -- subtrees wait.
+*/
+struct Node_deque {
+   pthread_mutex_t lock;
+   Node_T *items;
+   size_t head;
+   size_t tail;
+   size_t capacity;
+};
+
+/* The state shared by Node_destroyParallel's workers. */
+struct Node_destroyPool {
+   /* one deque per worker */
+   struct Node_deque *deques;
+   size_t numWorkers;
+   /* the number of nodes pushed onto some deque and not yet freed;
+      the work is done when it reaches 0 */
+   size_t pending;
+   /* set if a deque could not grow, after which every worker frees
+      what it takes recursively instead of pushing children */
+   int failed;
+};
+
+/* One of Node_destroyParallel's workers. */
+struct Node_destroyWorker {
+   struct Node_destroyPool *pool;
+   /* this worker's index, which is also its deque's */
+   size_t id;
+   /* the number of nodes this worker has freed */
+   size_t count;
+   /* the memory totals of the nodes this worker has freed */
+   struct MemoryUsage usage;
+   pthread_t thread;
+};
+
+/*
+   Pushes the children of the directory parent onto deque. Returns
+   FALSE, with nothing pushed, if the deque could not grow.
+*/
+static boolean Node_dequePushChildren(struct Node_deque *deque,
+                                      Node_T parent) {
+   size_t numItems = DynArray_getLength(parent->contents);
+   Node_T *newItems;
+   size_t newCapacity;
+   size_t i;
+
+   (void) pthread_mutex_lock(&deque->lock);
+   if (deque->tail + numItems > deque->capacity && deque->head > 0) {
+      /* Reclaim the stolen slots first, then grow if still needed. */
+      memmove(deque->items, deque->items + deque->head,
+              (deque->tail - deque->head) * sizeof(Node_T));
+      deque->tail -= deque->head;
+      deque->head = 0;
+   }
+   if (deque->tail + numItems > deque->capacity) {
+      newCapacity = 2 * (deque->tail + numItems);
+      newItems = realloc(deque->items, newCapacity * sizeof(Node_T));
+      if (newItems == NULL) {
+         (void) pthread_mutex_unlock(&deque->lock);
+         return FALSE;
+      }
+      deque->items = newItems;
+      deque->capacity = newCapacity;
+   }
+   for (i = 0; i < numItems; i++)
+      deque->items[deque->tail++] = DynArray_get(parent->contents, i);
+   (void) pthread_mutex_unlock(&deque->lock);
+   return TRUE;
+}
+
+/*
+   Takes a node from deque, from its tail if fromTail and from its head
+   otherwise. Returns NULL if the deque is empty.
+*/
+static Node_T Node_dequeTake(struct Node_deque *deque, boolean fromTail) {
+   Node_T n = NULL;
+
+   (void) pthread_mutex_lock(&deque->lock);
+   if (deque->head < deque->tail)
+      n = fromTail ? deque->items[--deque->tail]
+                   : deque->items[deque->head++];
+   (void) pthread_mutex_unlock(&deque->lock);
+   return n;
+}
+
+/*
+   Runs the Node_destroyParallel worker pvWorker: frees nodes from its
+   own deque, pushing each directory's children back onto it, and
+   steals from the other workers' deques when its own runs dry, until
+   every node has been freed.
+*/
+static void *Node_destroyWork(void *pvWorker) {
+   struct Node_destroyWorker *worker = pvWorker;
+   struct Node_destroyPool *pool = worker->pool;
+   struct Node_deque *own = &pool->deques[worker->id];
+   size_t numChildren;
+   size_t i;
+   Node_T n;
+
+   Node_setAccounting(&worker->usage);
+   for (;;) {
+      n = Node_dequeTake(own, TRUE);
+      for (i = 1; n == NULL && i < pool->numWorkers; i++)
+         n = Node_dequeTake(
+            &pool->deques[(worker->id + i) % pool->numWorkers], FALSE);
+      if (n == NULL) {
+         if (__sync_fetch_and_add(&pool->pending, 0) == 0)
+            break;
+         (void) sched_yield();
+         continue;
+      }
+      /* A node still shared with another hierarchy only loses a
+      reference, and nothing beneath it is visited. */
+      if (!Node_release(n)) {
+         (void) __sync_fetch_and_sub(&pool->pending, 1);
+         continue;
+      }
+
+      numChildren = (n->type == DIRECTORY)
+         ? DynArray_getLength(n->contents) : 0;
+      if (numChildren > 0 && !__sync_fetch_and_add(&pool->failed, 0)) {
+         /* Publish the children before retiring n, so that pending
+         cannot reach 0 while they remain. */
+         (void) __sync_fetch_and_add(&pool->pending, numChildren);
+         if (Node_dequePushChildren(own, n)) {
+            Node_free(n);
+            worker->count++;
+         }
+         else {
+            (void) __sync_fetch_and_sub(&pool->pending, numChildren);
+            (void) __sync_fetch_and_or(&pool->failed, 1);
+            worker->count += Node_freeTree(n);
+         }
+      }
+      else
+         worker->count += Node_freeTree(n);
+      (void) __sync_fetch_and_sub(&pool->pending, 1);
+   }
+   Node_setAccounting(NULL);
+   return NULL;
+}
+
+/* see node.h for specification */
+size_t Node_destroyParallel(Node_T n, size_t numThreads) {
+   struct Node_destroyPool pool;
+   struct Node_destroyWorker *workers;
+   boolean *started;
+   size_t count = 0;
+   size_t i;
+
+   assert(n != NULL);
+
+   if (numThreads <= 1)
+      return Node_destroy(n);
+
+   workers = calloc(numThreads, sizeof(struct Node_destroyWorker));
+   started = calloc(numThreads, sizeof(boolean));
+   pool.deques = calloc(numThreads, sizeof(struct Node_deque));
+   if (workers == NULL || started == NULL || pool.deques == NULL) {
+      free(workers);
+      free(started);
+      free(pool.deques);
+      return Node_destroy(n);
+   }
+   pool.numWorkers = numThreads;
+   pool.pending = 1;
+   pool.failed = 0;
+   for (i = 0; i < numThreads; i++) {
+      (void) pthread_mutex_init(&pool.deques[i].lock, NULL);
+      workers[i].pool = &pool;
+      workers[i].id = i;
+   }
+   pool.deques[0].items = malloc(sizeof(Node_T));
+   if (pool.deques[0].items == NULL) {
+      pool.pending = 0;
+      count = Node_destroy(n);
+   }
+   else {
+      pool.deques[0].items[0] = n;
+      pool.deques[0].tail = 1;
+      pool.deques[0].capacity = 1;
+   }
+
+   /* The calling thread is worker 0; a worker whose thread cannot be
+   started simply leaves its share to be stolen. */
+   for (i = 1; i < numThreads; i++)
+      started[i] = (boolean)(pthread_create(&workers[i].thread, NULL,
+                                            Node_destroyWork,
+                                            &workers[i]) == 0);
+   (void) Node_destroyWork(&workers[0]);
+   for (i = 1; i < numThreads; i++)
+      if (started[i])
+         (void) pthread_join(workers[i].thread, NULL);
+
+   for (i = 0; i < numThreads; i++) {
+      count += workers[i].count;
+      Node_mergeAccounting(&workers[i].usage);
+      (void) pthread_mutex_destroy(&pool.deques[i].lock);
+      free(pool.deques[i].items);
+   }
+   free(workers);
+   free(started);
+   free(pool.deques);
+   return count;
+}
+
 /* see node.h for specification */
 int Node_compare(Node_T node1, Node_T node2) {
    assert(node1 != NULL);
    assert(node2 != NULL);
 
-   return strcmp(node1->path, node2->path);
+   return strcmp(node1->name, node2->name);
 }
 
 /* see node.h for specification */
-const char* Node_getPath(Node_T n) {
+const char* Node_getName(Node_T n) {
    assert(n != NULL);
 
-   return n->path;
+   return n->name;
+}
+
+/* see node.h for specification */
+char* Node_setName(Node_T n, char* name) {
+   char* oldName;
+
+   assert(n != NULL);
+   assert(name != NULL);
+   assert(!n->isLinked);
+
+   oldName = n->name;
+   totals->pathBytes -= strlen(oldName) + 1;
+   totals->pathBytes += strlen(name) + 1;
+   n->name = name;
+   n->isHashed = FALSE;
+   return oldName;
 }
 
 /* see node.h for specification */
@@ -160,6 +603,56 @@ size_t Node_getLength(Node_T n) {
    return(n->length);
 }
 
+/* see node.h for specification */
+size_t Node_getNumNodes(Node_T n) {
+   assert(n != NULL);
+
+   return n->numNodes;
+}
+
+/* see node.h for specification */
+size_t Node_getTotalLength(Node_T n) {
+   assert(n != NULL);
+
+   return n->totalLength;
+}
+
+/* see node.h for specification */
+void Node_setQuota(Node_T n, size_t maxNodes, size_t maxLength) {
+   assert(n != NULL);
+   assert(n->type == DIRECTORY);
+
+   n->maxNodes = maxNodes;
+   n->maxLength = maxLength;
+}
+
+/* see node.h for specification */
+void Node_getQuota(Node_T n, size_t *pMaxNodes, size_t *pMaxLength) {
+   assert(n != NULL);
+   assert(n->type == DIRECTORY);
+   assert(pMaxNodes != NULL);
+   assert(pMaxLength != NULL);
+
+   *pMaxNodes = n->maxNodes;
+   *pMaxLength = n->maxLength;
+}
+
+/* see node.h for specification */
+boolean Node_fitsQuotas(Node_T n, size_t numNodes, size_t length) {
+   /* Each limit is checked only if the change grows what it limits,
+      so that a directory already past one may still grow in the
+      other. */
+   for (; n != NULL; n = n->isLinked ? n->parent : NULL) {
+      if (numNodes > 0 && n->maxNodes != 0
+          && n->numNodes - 1 + numNodes > n->maxNodes)
+         return FALSE;
+      if (length > 0 && n->maxLength != 0
+          && n->totalLength + length > n->maxLength)
+         return FALSE;
+   }
+   return TRUE;
+}
+
 /* see node.h for specification */
 size_t Node_getNumChildren(Node_T n) {
    assert(n != NULL);
@@ -173,30 +666,45 @@ size_t Node_getNumChildren(Node_T n) {
 }
 
 /* see node.h for specification */
-int Node_hasChild(Node_T n, const char* path, size_t* childID) {
-   size_t index;
+int Node_hasChild(Node_T n, const char* name, size_t length,
+                  size_t* childID) {
+   size_t lo = 0;
+   size_t hi;
+   size_t mid;
    int result;
-   Node_T checker;
+   Node_T child;
 
    assert(n != NULL);
-   assert(path != NULL);
+   assert(name != NULL);
 
    if (n->type == FT_FILE){
        return NOT_A_DIRECTORY;
    }
 
-   checker = Node_create(path, NULL, n->type);
-   if(checker == NULL) {
-      return -1;
+   /* Binary search the children by name, comparing only the length
+      characters of name, which need not be terminated there. */
+   hi = DynArray_getLength(n->contents);
+   while (lo < hi) {
+      mid = lo + (hi - lo) / 2;
+      child = DynArray_get(n->contents, mid);
+      result = strncmp(child->name, name, length);
+      if (result == 0 && child->name[length] != '\0')
+         result = 1;
+      if (result == 0) {
+         if (childID != NULL)
+            *childID = mid;
+         return 1;
+      }
+      if (result < 0)
+         lo = mid + 1;
+      else
+         hi = mid;
    }
-   result = DynArray_bsearch(n->contents, checker, &index,
-                    (int (*)(const void*, const void*)) Node_compare);
-   (void) Node_destroy(checker);
 
    if(childID != NULL)
-      *childID = index;
+      *childID = lo;
 
-   return result;
+   return 0;
 }
 
 /* see node.h for specification */
@@ -218,11 +726,221 @@ Node_T Node_getParent(Node_T n) {
    return n->parent;
 }
 
+/*
+   Makes contents the pointer that the file n keeps as its contents,
+   at the start of its room if it has any and in its contents array
+   otherwise, and returns n's previous contents, which are the room
+   itself if they were inline. Cannot fail, since a file's contents
+   array always has room for its one entry.
+*/
+static void *Node_setPointer(Node_T n, void *contents) {
+   void *oldContents;
+
+   assert(n != NULL);
+   assert(n->type == FT_FILE);
+
+   oldContents = (void *) Node_getContents(n);
+   if (n->room > 0)
+      *(void **)(n + 1) = contents;
+   else {
+      Node_accountContents(n, FALSE);
+      if (DynArray_getLength(n->contents) > 0)
+         (void) DynArray_set(n->contents, 0, contents);
+      else
+         (void) DynArray_add(n->contents, contents);
+      Node_accountContents(n, TRUE);
+   }
+   n->isInline = FALSE;
+   return oldContents;
+}
+
+/* see node.h for specification */
+Node_T Node_copy(Node_T n, const char* name, Node_T parent) {
+   Node_T new;
+   DynArray_T children;
+   size_t numItems;
+   size_t i;
+
+   assert(n != NULL);
+   assert(name != NULL);
+
+   numItems = (n->type == DIRECTORY)
+      ? DynArray_getLength(n->contents) : 0;
+   new = Node_allocate(name, parent, n->type, n->room);
+   if (new == NULL)
+      return NULL;
+
+   /* A directory's child array is sized for the children it is about
+      to share; Node_create already left room for a file's contents. */
+   if (numItems > 0) {
+      children = DynArray_new(numItems);
+      if (children == NULL) {
+         (void) Node_destroy(new);
+         return NULL;
+      }
+      Node_accountContents(new, FALSE);
+      DynArray_free(new->contents);
+      new->contents = children;
+      for (i = 0; i < numItems; i++)
+         (void) DynArray_set(children, i, DynArray_get(n->contents, i));
+      Node_accountContents(new, TRUE);
+   }
+   else if (n->isInline) {
+      /* Inline contents are the one part of a file copied, not shared,
+         since they live and die with the node. */
+      memcpy(new + 1, n + 1, n->length);
+      new->isInline = TRUE;
+   }
+   else if (n->type == FT_FILE) {
+      (void) Node_setPointer(new, (void *) Node_getContents(n));
+      if (n->isStored) {
+         (void) Node_retainContents((void *) Node_getContents(n));
+         new->isStored = TRUE;
+      }
+   }
+
+   /* Only now that the copy cannot fail does it take its references,
+      so that n's children stay unshared if it does. */
+   if (n->type == DIRECTORY)
+      for (i = 0; i < numItems; i++)
+         (void) __sync_add_and_fetch(
+            &((Node_T) DynArray_get(n->contents, i))->refCount, 1);
+
+   new->length = n->length;
+   new->numNodes = n->numNodes;
+   new->totalLength = n->totalLength;
+   new->maxNodes = n->maxNodes;
+   new->maxLength = n->maxLength;
+   /* The name is hashed too, so a renamed copy is hashed afresh. */
+   if (n->isHashed && !strcmp(name, n->name)) {
+      new->hash = n->hash;
+      new->isHashed = TRUE;
+   }
+   return new;
+}
+
+/* see node.h for specification */
+Node_T Node_retain(Node_T n) {
+   assert(n != NULL);
+
+   (void) __sync_add_and_fetch(&n->refCount, 1);
+   return n;
+}
+
+/* see node.h for specification */
+Node_T Node_own(Node_T n) {
+   Node_T new;
+
+   assert(n != NULL);
+
+   if (__sync_add_and_fetch(&n->refCount, 0) == 1)
+      return n;
+   new = Node_copy(n, n->name, NULL);
+   if (new == NULL)
+      return NULL;
+   (void) Node_destroy(n);
+   return new;
+}
+
+/* see node.h for specification */
+Node_T Node_ownChild(Node_T parent, size_t childID) {
+   Node_T child;
+   Node_T new;
+
+   assert(parent != NULL);
+   assert(parent->type == DIRECTORY);
+   assert(childID < DynArray_getLength(parent->contents));
+
+   child = DynArray_get(parent->contents, childID);
+   if (__sync_add_and_fetch(&child->refCount, 0) == 1) {
+      child->parent = parent;
+      return child;
+   }
+
+   /* Replace parent's reference to the shared child with one to a
+      private copy of it, which takes over references to its
+      children; the copy has the same name, so stays in place. */
+   new = Node_copy(child, child->name, parent);
+   if (new == NULL)
+      return NULL;
+   new->isLinked = TRUE;
+   (void) DynArray_set(parent->contents, childID, new);
+   (void) Node_destroy(child);
+   return new;
+}
+
+
+/* see node.h for specification */
+boolean Node_isStored(Node_T n) {
+   assert(n != NULL);
+
+   return n->isStored;
+}
+
+/* see node.h for specification */
+void* Node_updateStoredContents(Node_T n, void *stored) {
+   void *oldContents = NULL;
+
+   assert(n != NULL);
+   assert(n->type == FT_FILE);
+   assert(stored != NULL);
+
+   oldContents = Node_setPointer(n, stored);
+   n->isStored = TRUE;
+   Node_adjustSizes(n, 0, 0, TRUE);
+   return oldContents;
+}
+
+/* see node.h for specification */
+void* Node_updateInlineContents(Node_T n, const void *contents,
+                                size_t length) {
+   void *oldContents = NULL;
+
+   assert(n != NULL);
+   assert(n->type == FT_FILE);
+   assert(contents != NULL);
+   assert(n->room > 0 && length <= n->room);
+
+   /* The previous pointer is read before the room is overwritten. */
+   oldContents = (void *) Node_getContents(n);
+   memmove(n + 1, contents, length);
+   n->isStored = FALSE;
+   n->isInline = TRUE;
+   Node_adjustSizes(n, 0, 0, TRUE);
+   return oldContents;
+}
+
+/* see node.h for specification */
+size_t Node_getRoom(Node_T n) {
+   assert(n != NULL);
+
+   return n->room;
+}
+
+/* see node.h for specification */
+boolean Node_isInline(Node_T n) {
+   assert(n != NULL);
+
+   return n->isInline;
+}
+
+/* see node.h for specification */
+const void *Node_getContents(Node_T n) {
+   assert(n != NULL);
+
+   if (n->type != FT_FILE)
+      return NULL;
+   if (n->isInline)
+      return n + 1;
+   if (n->room > 0)
+      return *(void **)(n + 1);
+   if (DynArray_getLength(n->contents) == 0)
+      return NULL;
+   return DynArray_get(n->contents, 0);
+}
 
 /* For Node_T n, updates n's old contents to contents. */
 void* Node_updateFileContents(Node_T n, void *contents) {
-   size_t i = 0;
-   int result;
    void *oldContents;
 
    assert(n != NULL);
@@ -231,15 +949,10 @@ void* Node_updateFileContents(Node_T n, void *contents) {
    if (n->type == DIRECTORY) {
       return NULL;
    }
-   result = DynArray_addAt(n->contents, i, contents);
-   if (result != 1) {
-      return NULL;
-   }
-   if (DynArray_getLength(n->contents) > 1) {
-      /* since addAt shifts the old contents over one index, remove
-      this old content and return void pointer to it. */
-      oldContents = DynArray_removeAt(n->contents, i + 1);
-   }
+   oldContents = Node_setPointer(n, contents);
+   n->isStored = FALSE;
+   /* no size changes, but n and its ancestors must be hashed again */
+   Node_adjustSizes(n, 0, 0, TRUE);
    assert(CheckerFT_Node_isValid(n));
 
    return oldContents;
@@ -249,10 +962,222 @@ void* Node_updateFileContents(Node_T n, void *contents) {
 void Node_updateLength(Node_T n, size_t newLength){
    assert(n != NULL);
    assert(CheckerFT_Node_isValid(n));
+   if (newLength > n->length)
+      Node_adjustSizes(n, 0, newLength - n->length, TRUE);
+   else
+      Node_adjustSizes(n, 0, n->length - newLength, FALSE);
    n->length = newLength;
    assert(CheckerFT_Node_isValid(n));
 }
 
+/*
+   Returns hash updated, FNV-1a style, with the length bytes at bytes.
+*/
+static size_t Node_hashBytes(size_t hash, const void *bytes,
+                             size_t length) {
+   /* the 64-bit FNV prime where size_t holds it, 0x1b3 otherwise */
+   const size_t prime = ((size_t) 1 << 20 << 20) + 0x1b3;
+   const unsigned char *p = bytes;
+   size_t i;
+
+   for (i = 0; i < length; i++)
+      hash = (hash ^ p[i]) * prime;
+   return hash;
+}
+
+/*
+   Returns hash updated with the value value, one byte at a time from
+   the least significant, so that the result does not depend on the
+   byte order of the machine.
+*/
+static size_t Node_hashSize(size_t hash, size_t value) {
+   unsigned char bytes[sizeof(size_t)];
+   size_t i;
+
+   for (i = 0; i < sizeof(size_t); i++) {
+      bytes[i] = (unsigned char) (value & 0xff);
+      value = value >> 4 >> 4;
+   }
+   return Node_hashBytes(hash, bytes, sizeof(size_t));
+}
+
+/* see node.h for specification */
+size_t Node_hash(Node_T n) {
+   unsigned char type;
+   void *contents;
+   size_t hash;
+   size_t i;
+
+   assert(n != NULL);
+
+   if (n->isHashed)
+      return n->hash;
+   type = (unsigned char) n->type;
+
+   /* the 64-bit FNV offset basis where size_t holds it */
+   hash = ((size_t) 0xcbf29ce4UL << 16 << 16) | 0x84222325UL;
+   hash = Node_hashBytes(hash, &type, 1);
+   hash = Node_hashBytes(hash, n->name, strlen(n->name) + 1);
+   if (n->type == DIRECTORY) {
+      hash = Node_hashSize(hash, DynArray_getLength(n->contents));
+      for (i = 0; i < DynArray_getLength(n->contents); i++)
+         hash = Node_hashSize(hash,
+                              Node_hash(DynArray_get(n->contents, i)));
+   }
+   else {
+      contents = (void *) Node_getContents(n);
+      hash = Node_hashSize(hash, n->length);
+      hash = Node_hashSize(hash, contents != NULL);
+      if (contents != NULL)
+         hash = Node_hashBytes(hash, contents, n->length);
+   }
+   n->hash = hash;
+   n->isHashed = TRUE;
+   return hash;
+}
+
+/* see node.h for specification */
+boolean Node_getKnownHash(Node_T n, size_t *pHash) {
+   assert(n != NULL);
+   assert(pHash != NULL);
+
+   if (!n->isHashed)
+      return FALSE;
+   *pHash = n->hash;
+   return TRUE;
+}
+
+/*
+   Doubles the content store's buckets, or makes its first ones, and
+   moves every copy into its new bucket. Leaves the store as it was
+   if unable to allocate. storeLock must be held.
+*/
+static void Node_growStore(void) {
+   struct Node_stored **buckets;
+   struct Node_stored *stored;
+   size_t numBuckets;
+   size_t i;
+
+   numBuckets = storeNumBuckets == 0 ? 64 : 2 * storeNumBuckets;
+   buckets = calloc(numBuckets, sizeof(struct Node_stored *));
+   if (buckets == NULL)
+      return;
+   for (i = 0; i < storeNumBuckets; i++)
+      while (storeBuckets[i] != NULL) {
+         stored = storeBuckets[i];
+         storeBuckets[i] = stored->next;
+         stored->next = buckets[stored->hash % numBuckets];
+         buckets[stored->hash % numBuckets] = stored;
+      }
+   free(storeBuckets);
+   storeBuckets = buckets;
+   storeNumBuckets = numBuckets;
+}
+
+/* see node.h for specification */
+void *Node_storeContents(const void *contents, size_t length,
+                         boolean share) {
+   struct Node_stored *stored;
+   size_t hash;
+   size_t refs;
+
+   assert(contents != NULL);
+
+   if (!share) {
+      stored = malloc(sizeof(struct Node_stored) + length);
+      if (stored == NULL)
+         return NULL;
+      memcpy(stored + 1, contents, length);
+      stored->isShared = FALSE;
+      stored->next = NULL;
+      stored->refCount = 1;
+      stored->hash = 0;
+      stored->length = length;
+      (void) __sync_add_and_fetch(&storedBytes,
+                                  sizeof(struct Node_stored) + length);
+      return stored + 1;
+   }
+
+   hash = Node_hashBytes(((size_t) 0xcbf29ce4UL << 16 << 16)
+                         | 0x84222325UL, contents, length);
+   (void) pthread_mutex_lock(&storeLock);
+   stored = storeNumBuckets == 0 ? NULL
+            : storeBuckets[hash % storeNumBuckets];
+   for (; stored != NULL; stored = stored->next) {
+      if (stored->hash != hash || stored->length != length
+          || memcmp(stored + 1, contents, length))
+         continue;
+      /* A copy whose last reference is being dropped is passed over
+         for a new one. */
+      refs = __sync_add_and_fetch(&stored->refCount, 0);
+      while (refs > 0 && !__sync_bool_compare_and_swap(
+                &stored->refCount, refs, refs + 1))
+         refs = __sync_add_and_fetch(&stored->refCount, 0);
+      if (refs > 0)
+         break;
+   }
+
+   if (stored == NULL) {
+      if (storeCount >= storeNumBuckets)
+         Node_growStore();
+      stored = storeNumBuckets == 0 ? NULL
+               : malloc(sizeof(struct Node_stored) + length);
+      if (stored != NULL) {
+         memcpy(stored + 1, contents, length);
+         stored->isShared = TRUE;
+         stored->refCount = 1;
+         stored->hash = hash;
+         stored->length = length;
+         stored->next = storeBuckets[hash % storeNumBuckets];
+         storeBuckets[hash % storeNumBuckets] = stored;
+         storeCount++;
+         (void) __sync_add_and_fetch(&storedBytes,
+                                     sizeof(struct Node_stored) + length);
+      }
+   }
+   (void) pthread_mutex_unlock(&storeLock);
+   return stored == NULL ? NULL : stored + 1;
+}
+
+/* see node.h for specification */
+void *Node_retainContents(void *contents) {
+   assert(contents != NULL);
+
+   (void) __sync_add_and_fetch(
+      &((struct Node_stored *) contents - 1)->refCount, 1);
+   return contents;
+}
+
+/* see node.h for specification */
+void Node_releaseContents(void *contents) {
+   struct Node_stored *stored = (struct Node_stored *) contents - 1;
+   struct Node_stored **link;
+
+   assert(contents != NULL);
+
+   if (__sync_sub_and_fetch(&stored->refCount, 1) != 0)
+      return;
+   (void) __sync_sub_and_fetch(&storedBytes,
+                               sizeof(struct Node_stored) + stored->length);
+   if (!stored->isShared) {
+      free(stored);
+      return;
+   }
+   (void) pthread_mutex_lock(&storeLock);
+   for (link = &storeBuckets[stored->hash % storeNumBuckets];
+        *link != stored; link = &(*link)->next)
+      ;
+   *link = stored->next;
+   storeCount--;
+   if (storeCount == 0) {
+      free(storeBuckets);
+      storeBuckets = NULL;
+      storeNumBuckets = 0;
+   }
+   (void) pthread_mutex_unlock(&storeLock);
+   free(stored);
+}
+
 /* see node.h for specification */
 DynArray_T Node_getFileContents(Node_T n){
    assert(n != NULL);
@@ -264,7 +1189,7 @@ DynArray_T Node_getFileContents(Node_T n){
 /* see node.h for specification */
 int Node_linkChild(Node_T parent, Node_T child) {
    size_t i;
-   char* rest;
+   int result;
 
    assert(parent != NULL);
    assert(child != NULL);
@@ -275,25 +1200,8 @@ int Node_linkChild(Node_T parent, Node_T child) {
       return PARENT_CHILD_ERROR;
    }
 
-   if(Node_hasChild(parent, child->path, NULL)) {
-      assert(CheckerFT_Node_isValid(parent));
-      assert(CheckerFT_Node_isValid(child));
-      return ALREADY_IN_TREE;
-   }
-   i = strlen(parent->path);
-   if(strncmp(child->path, parent->path, i)) {
-      assert(CheckerFT_Node_isValid(parent));
-      assert(CheckerFT_Node_isValid(child));
-      return PARENT_CHILD_ERROR;
-   }
-   rest = child->path + i;
-   if(strlen(child->path) >= i && rest[0] != '/') {
-      assert(CheckerFT_Node_isValid(parent));
-      assert(CheckerFT_Node_isValid(child));
-      return PARENT_CHILD_ERROR;
-   }
-   rest++;
-   if(strstr(rest, "/") != NULL) {
+   /* A child's name is a single path component. */
+   if(*child->name == '\0' || strchr(child->name, '/') != NULL) {
       assert(CheckerFT_Node_isValid(parent));
       assert(CheckerFT_Node_isValid(child));
       return PARENT_CHILD_ERROR;
@@ -307,7 +1215,14 @@ int Node_linkChild(Node_T parent, Node_T child) {
       return ALREADY_IN_TREE;
    }
 
-   if(DynArray_addAt(parent->contents, i, child) == TRUE) {
+   Node_accountContents(parent, FALSE);
+   result = DynArray_addAt(parent->contents, i, child);
+   Node_accountContents(parent, TRUE);
+
+   if(result == TRUE) {
+      child->isLinked = TRUE;
+      Node_adjustSizes(parent, child->numNodes, child->totalLength,
+                       TRUE);
       assert(CheckerFT_Node_isValid(parent));
       assert(CheckerFT_Node_isValid(child));
       return SUCCESS;
@@ -319,6 +1234,37 @@ int Node_linkChild(Node_T parent, Node_T child) {
    }
 }
 
+/* see node.h for specification */
+int Node_insertChildAt(Node_T parent, Node_T child, size_t childID) {
+   int result;
+
+   assert(parent != NULL);
+   assert(child != NULL);
+   assert(parent->type == DIRECTORY);
+   assert(child->parent == parent);
+   assert(childID <= DynArray_getLength(parent->contents));
+   /* child must belong exactly at childID in sorted order */
+   assert(childID == 0 || Node_compare(
+             DynArray_get(parent->contents, childID - 1), child) < 0);
+   assert(childID == DynArray_getLength(parent->contents)
+          || Node_compare(child,
+                          DynArray_get(parent->contents, childID)) < 0);
+
+   Node_accountContents(parent, FALSE);
+   result = DynArray_addAt(parent->contents, childID, child);
+   Node_accountContents(parent, TRUE);
+
+   if(result != TRUE)
+      return PARENT_CHILD_ERROR;
+   child->isLinked = TRUE;
+   Node_adjustSizes(parent, child->numNodes, child->totalLength,
+                       TRUE);
+
+   assert(CheckerFT_Node_isValid(parent));
+   assert(CheckerFT_Node_isValid(child));
+   return SUCCESS;
+}
+
 /* see node.h for specification */
 int  Node_unlinkChild(Node_T parent, Node_T child) {
     size_t i;
@@ -340,7 +1286,12 @@ int  Node_unlinkChild(Node_T parent, Node_T child) {
         return PARENT_CHILD_ERROR;
     }
 
+    Node_accountContents(parent, FALSE);
     (void) DynArray_removeAt(parent->contents, i);
+    Node_accountContents(parent, TRUE);
+    child->isLinked = FALSE;
+    Node_adjustSizes(parent, child->numNodes, child->totalLength,
+                     FALSE);
 
     assert(CheckerFT_Node_isValid(parent));
     assert(CheckerFT_Node_isValid(child));
@@ -379,15 +1330,108 @@ int Node_addChild(Node_T parent, const char* dir, nodeType type) {
 
 /* see node.h for specification */
 char* Node_toString(Node_T n) {
-   char* copyPath;
+   char* path;
+   size_t length = 0;
+   size_t nameLength;
+   Node_T a;
 
    assert(n != NULL);
 
-   copyPath = malloc(strlen(n->path)+1);
-   if(copyPath == NULL) {
+   /* Measure, then fill in the names from the end backwards: each
+      name is followed by a '/' or, for n's, the terminating '\0'. */
+   for (a = n; a != NULL; a = a->parent)
+      length += strlen(a->name) + 1;
+
+   path = malloc(length);
+   if(path == NULL || length == 0) {
+      free(path);
       return NULL;
    }
-   else {
-      return strcpy(copyPath, n->path);
+   path[--length] = '\0';
+   for (a = n; a != NULL; a = a->parent) {
+      nameLength = strlen(a->name);
+      length -= nameLength;
+      memcpy(path + length, a->name, nameLength);
+      if (length > 0)
+         path[--length] = '/';
    }
-}
\ No newline at end of file
+   return path;
+}
+/* see node.h for specification */
+void Node_getMemoryUsage(struct MemoryUsage *pUsage) {
+   assert(pUsage != NULL);
+
+   *pUsage = usage;
+   pUsage->storedBytes = __sync_add_and_fetch(&storedBytes, 0);
+}
+
+/* see node.h for specification */
+void Node_setAccounting(struct MemoryUsage *pTotals) {
+   totals = (pTotals == NULL) ? &usage : pTotals;
+}
+
+/* see node.h for specification */
+void Node_mergeAccounting(const struct MemoryUsage *pDelta) {
+   assert(pDelta != NULL);
+
+   totals->nodeBytes += pDelta->nodeBytes;
+   totals->pathBytes += pDelta->pathBytes;
+   totals->childLogicalBytes += pDelta->childLogicalBytes;
+   totals->childPhysicalBytes += pDelta->childPhysicalBytes;
+   totals->fileBytes += pDelta->fileBytes;
+   totals->numNodes += pDelta->numNodes;
+   totals->numFiles += pDelta->numFiles;
+}
+
+/* see node.h for specification */
+size_t Node_getInsertCost(Node_T parent, const char* rest,
+                          size_t room) {
+   size_t cost = 0;
+   size_t start = 0;
+   size_t i;
+
+   assert(rest != NULL);
+
+   /* the first new node is added to parent's child array */
+   if(parent != NULL)
+      cost += DynArray_getAddCost(parent->contents);
+
+   /* each component of rest becomes a node holding that component as
+      its name, and whose own array receives at most one element,
+      which fits its initial capacity; the last is made with room, in
+      which case it has no array */
+   for(i = 0;; i++) {
+      if(rest[i] == '\0' && room > 0)
+         cost += sizeof(struct node) + room + (i - start) + 1;
+      else if(rest[i] == '/' || rest[i] == '\0') {
+         cost += sizeof(struct node) + (i - start) + 1
+            + DynArray_getNewFootprint(0);
+         start = i + 1;
+      }
+      if(rest[i] == '\0')
+         break;
+   }
+   return cost;
+}
+
+/* see node.h for specification */
+size_t Node_getCopyCost(Node_T parent, Node_T n, const char* name) {
+   assert(parent != NULL);
+   assert(n != NULL);
+   assert(name != NULL);
+
+   /* the copy is one node, with n's room and, unless that holds its
+      contents, an array sized for every child of n, added to parent's
+      child array */
+   return DynArray_getAddCost(parent->contents)
+      + sizeof(struct node) + n->room + strlen(name) + 1
+      + (n->room > 0 ? 0
+         : DynArray_getNewFootprint(n->type == DIRECTORY
+                                    ? DynArray_getLength(n->contents)
+                                    : 0));
+}
+
+/* see node.h for specification */
+size_t Node_getStoreCost(size_t length) {
+   return sizeof(struct Node_stored) + length;
+}
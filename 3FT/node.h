@@ -10,8 +10,9 @@
 #include "a4def.h"
 
 /*
-   a Node_T is an object that contains a path payload and references to
-   the node's parent (if it exists) and children (if they exist).
+   a Node_T is an object that contains a name payload -- the last
+   component of its path -- and references to the node's parent (if it
+   exists) and children (if they exist).
 */
 typedef struct node* Node_T;
 
@@ -21,9 +22,8 @@ typedef struct node* Node_T;
    Node_T or NULL if any allocation error occurs in creating
    the node or its fields.
 
-   The new structure is initialized to have its path as the parent's
-   path (if it exists) prefixed to the directory string parameter,
-   separated by a slash. It is also initialized with its parent link
+   The new structure is initialized to have a copy of the directory
+   string parameter as its name. It is also initialized with its parent link
    as the parent parameter value, but the parent itself is not changed
    to link to the new node.  The node's type is initialized to FILE or 
    DIRECTORY depending on what argument was passed in its creation. 
@@ -37,25 +37,62 @@ typedef struct node* Node_T;
 Node_T Node_create(const char* dir, Node_T parent, nodeType type);
 
 /*
-  Destroys the entire hierarchy of nodes rooted at n,
-  including n itself.
+   As Node_create for a file, but with room bytes of room allocated
+   right after the node, in the same allocation, to hold contents of
+   up to that many bytes inline (see Node_updateInlineContents). room
+   must be at least sizeof(void*): contents that are not inline are
+   kept as a pointer there, so the node needs no contents array.
+*/
+Node_T Node_createWithRoom(const char* dir, Node_T parent, size_t room);
+
+/*
+  Drops the caller's reference to n and, if it was the last one,
+  destroys the entire hierarchy of nodes rooted at n, including n
+  itself, except for any nodes beneath it that are still shared with
+  another hierarchy (see Node_copy), which only lose a reference.
 
   Returns the number of nodes destroyed.
 */
 size_t Node_destroy(Node_T n);
 
+/*
+  Destroys the entire hierarchy of nodes rooted at n, including n
+  itself, as Node_destroy does (sparing nodes still shared with
+  another hierarchy), but on numThreads threads (counting
+  the calling thread) that share the work by stealing subtrees from
+  one another's queues. n must not be reachable by any other thread.
+
+  Returns the number of nodes destroyed.
+*/
+size_t Node_destroyParallel(Node_T n, size_t numThreads);
+
+/*
+  Returns the number of nodes in the hierarchy rooted at n, including
+  n itself, or limit if there are at least that many. Visits no more
+  than limit nodes.
+*/
+size_t Node_countUpTo(Node_T n, size_t limit);
+
 
 /*
-  Compares node1 and node2 based on their paths.
+  Compares node1 and node2 based on their names.
   Returns <0, 0, or >0 if node1 is less than,
   equal to, or greater than node2, respectively.
 */
 int Node_compare(Node_T node1, Node_T node2);
 
 /*
-   Takes in Node_T n and returns n's path as const char*.
+   Takes in Node_T n and returns n's name, the last component of its
+   path, as const char*.
+*/
+const char* Node_getName(Node_T n);
+
+/*
+   Makes name, which must be allocated with malloc and becomes owned
+   by n, the name of n, which must not be linked to a parent at the
+   time, and returns n's previous name, which the caller now owns.
 */
-const char* Node_getPath(Node_T n);
+char* Node_setName(Node_T n, char* name);
 
 /*
    Takes in Node_T n and returns n's type as int.
@@ -67,6 +104,41 @@ int Node_getType(Node_T n);
 */
 size_t Node_getLength(Node_T n);
 
+/*
+  Returns the number of nodes in the hierarchy rooted at n, including
+  n itself, in constant time.
+*/
+size_t Node_getNumNodes(Node_T n);
+
+/*
+  Returns the summed length of the files in the hierarchy rooted at
+  n, n itself included if it is a file, in constant time.
+*/
+size_t Node_getTotalLength(Node_T n);
+
+/*
+  Limits the directory n to maxNodes nodes beneath it and maxLength
+  bytes of file length at or beneath it, as checked by
+  Node_fitsQuotas; 0 leaves either unlimited.
+*/
+void Node_setQuota(Node_T n, size_t maxNodes, size_t maxLength);
+
+/*
+  Stores in *pMaxNodes and *pMaxLength the limits set on the directory
+  n by Node_setQuota, 0 for either that is unlimited.
+*/
+void Node_getQuota(Node_T n, size_t *pMaxNodes, size_t *pMaxLength);
+
+/*
+  Returns TRUE if numNodes more nodes and length more bytes of file
+  length could be added beneath n without exceeding the quota of n or
+  of any of its linked ancestors, and FALSE otherwise. A limit is
+  only checked if its count grows, so a quota set below current usage
+  stops only the growth it limits. Takes time proportional to n's
+  depth.
+*/
+boolean Node_fitsQuotas(Node_T n, size_t numNodes, size_t length);
+
 /*
   Takes in Node_T n and returns the number of child 
   directories n has. If node is file, return 
@@ -75,16 +147,17 @@ size_t Node_getLength(Node_T n);
 size_t Node_getNumChildren(Node_T n);
 
 /*
-   Returns 1 if n has a child directory with path,
-   0 if it does not have such a child, and -1 if
-   there is an allocation error during search. Returns
-   NOT_A_DIRECTORY if n is a file node. 
+   Returns 1 if n has a child whose name is the first length
+   characters of name, which need not end there, and 0 if it does not
+   have such a child. Returns NOT_A_DIRECTORY if n is a file node.
+   Binary searches n's children without allocating.
 
    If n does have such a child, and childID is not NULL, store the
    child's identifier in *childID. If n does not have such a child,
    store the identifier that such a child would have in *childID.
 */
-int Node_hasChild(Node_T n, const char* path, size_t* childID);
+int Node_hasChild(Node_T n, const char* name, size_t length,
+                  size_t* childID);
 
 /*
    Takes in Node_T n and checks to make sure n is of type 
@@ -94,27 +167,156 @@ int Node_hasChild(Node_T n, const char* path, size_t* childID);
 Node_T Node_getChild(Node_T n, size_t childID);
 
 /*
-   Returns the parent node of n, if it exists, otherwise returns NULL
+   Returns the parent node of n, if it exists, otherwise returns NULL.
+   Only reliable for nodes reached from the root through
+   Node_ownChild, since a node shared by several directories records
+   just one of them.
 */
 Node_T Node_getParent(Node_T n);
 
+/*
+   Returns a new node named name, with parent as its parent (which is
+   not changed to link to it), that is a copy of n and of the whole
+   hierarchy beneath it, or NULL if there is an allocation error. The
+   copy is made in time proportional to n's number of children alone:
+   it refers to n's own children, which from then on are shared by
+   both hierarchies and are copied lazily, one at a time, by
+   Node_ownChild when either hierarchy is about to change beneath
+   them. A file's contents reference is shared likewise.
+*/
+Node_T Node_copy(Node_T n, const char* name, Node_T parent);
+
+/*
+   Adds a reference to n, which from then on is shared with the
+   caller, who later drops the reference with Node_destroy, and
+   returns n.
+*/
+Node_T Node_retain(Node_T n);
+
+/*
+   Returns n, which has no parent, ready to be changed: if n is shared,
+   a private copy made by Node_copy replaces it, and the caller's
+   reference to n is dropped. Returns NULL if there is an allocation
+   error, in which case n is unchanged.
+*/
+Node_T Node_own(Node_T n);
+
+/*
+   Returns the child of parent with identifier childID, ready to be
+   changed: if the child is shared with another hierarchy, it is
+   first replaced among parent's children with a private copy made by
+   Node_copy. The child's parent is set to parent. parent itself must
+   not be shared. Returns NULL if there is an allocation error, in
+   which case parent is unchanged.
+*/
+Node_T Node_ownChild(Node_T parent, size_t childID);
+
 /* 
    Updates file node n's contents to contents. A file's contents are
-   always stored at index 0 of DynArray. If uLength is greater than 
-   1 after adding in the new content, remove the old and return 
-   a void pointer to the old contents, which may be NULL. 
+   stored at index 0 of its DynArray, or, for a file with room, at the
+   start of that room. Returns a void pointer to the old contents,
+   which may be NULL. If the old contents came from
+   Node_storeContents, n's reference to them passes to the caller (see
+   Node_releaseContents).
 */
 void* Node_updateFileContents(Node_T n, void *contents);
 
+/*
+   Returns a reference-counted copy of the length bytes at contents,
+   which must not be NULL, with one reference held by the caller, or
+   NULL if unable to allocate. If share is TRUE the copy is kept in
+   the content store, which keeps one copy of any given bytes, found
+   by their hash, for every file that holds them; otherwise it is a
+   new copy of its own. Safe to call from any thread.
+*/
+void *Node_storeContents(const void *contents, size_t length,
+                         boolean share);
+
+/*
+   Adds a reference to contents, returned by Node_storeContents, and
+   returns them. Safe to call from any thread.
+*/
+void *Node_retainContents(void *contents);
+
+/*
+   Drops a reference to contents, returned by Node_storeContents,
+   freeing them once no node or caller refers to them. Safe to call
+   from any thread.
+*/
+void Node_releaseContents(void *contents);
+
+/*
+   Makes stored, contents from Node_storeContents, the contents of the
+   file n, which takes over the caller's reference to them, and
+   returns n's previous contents. If those were also from
+   Node_storeContents, n's reference to them passes to the caller.
+   Cannot fail.
+*/
+void* Node_updateStoredContents(Node_T n, void *stored);
+
+/*
+   Returns TRUE if the contents of the file n come from
+   Node_storeContents, and FALSE if they belong to the client.
+*/
+boolean Node_isStored(Node_T n);
+
+/*
+   Copies the length bytes at contents, no more than Node_getRoom(n),
+   into the room in the file n's own allocation and makes them n's
+   contents, returning n's previous contents as Node_updateFileContents
+   does. Previous contents that were inline too are overwritten, so
+   must be copied out first. Does not change n's length, and cannot
+   fail. Node_copy copies inline contents rather than sharing them.
+*/
+void* Node_updateInlineContents(Node_T n, const void *contents,
+                                size_t length);
+
+/*
+   Returns the bytes of room for inline contents that n was created
+   with, 0 unless by Node_createWithRoom or by copying such a node.
+*/
+size_t Node_getRoom(Node_T n);
+
+/*
+   Returns TRUE if the contents of the file n are inline, and FALSE
+   otherwise.
+*/
+boolean Node_isInline(Node_T n);
+
+/*
+   Returns the contents of the file n, or NULL if it has none or is a
+   directory. Inline contents are found without reaching past n.
+*/
+const void *Node_getContents(Node_T n);
+
 /*
    Updates the node n's length field. Resets n->length to 
    newLength. 
 */
 void Node_updateLength(Node_T n, size_t newLength);
 
+/*
+   Returns a hash of the hierarchy rooted at n: of n's type and name
+   and either its length and contents, for a file, or its children's
+   hashes in order, for a directory. Each node keeps its hash until
+   something at or beneath it is changed through this interface, so
+   only the changed part of the hierarchy is hashed again. Contents
+   changed in place by their owner are not noticed. Must not run
+   concurrently with anything else hashing a node of the hierarchy.
+*/
+size_t Node_hash(Node_T n);
+
+/*
+   Stores in *pHash the hash Node_hash last returned for n and returns
+   TRUE if it is still valid, or returns FALSE, leaving *pHash
+   unchanged, if n must be hashed again. Computes nothing.
+*/
+boolean Node_getKnownHash(Node_T n, size_t *pHash);
+
 /*
    Returns a DynArray representation of the contents of a file node, 
-   otherwise returns NULL.
+   otherwise returns NULL. A file with room has no such array and
+   also returns NULL: Node_getContents reads the contents of any file.
 */
 DynArray_T Node_getFileContents(Node_T n);
 
@@ -122,14 +324,25 @@ DynArray_T Node_getFileContents(Node_T n);
 /*
   Makes child a child of parent, if possible, and returns SUCCESS.
   This is not possible in the following cases:
-  * parent already has a child with child's path,
+  * parent already has a child with child's name,
     in which case: returns ALREADY_IN_TREE
-  * child's path is not parent's path + / + directory,
+  * child's name is not a single path component,
     or the parent cannot link to the child,
     in which cases: returns PARENT_CHILD_ERROR
  */
 int Node_linkChild(Node_T parent, Node_T child);
 
+/*
+  Makes child, which was created with parent as its parent, the
+  childID'th child of parent without searching parent's children:
+  childID must be the position child belongs at in sorted order, as
+  reported by Node_hasChild, or Node_getNumChildren(parent) when child
+  sorts after every existing child, in which case it is appended with
+  no shifting. Returns SUCCESS, or PARENT_CHILD_ERROR if the parent
+  cannot link to the child.
+*/
+int Node_insertChildAt(Node_T parent, Node_T child, size_t childID);
+
 /*
   Unlinks node parent from its child node child. child is unchanged.
 
@@ -139,8 +352,8 @@ int Node_linkChild(Node_T parent, Node_T child);
 int Node_unlinkChild(Node_T parent, Node_T child);
 
 /*
-  Creates a new node such that the new node's path is dir appended to
-  n's path, separated by a slash, and that the new node has no
+  Creates a new node such that the new node's name is dir, and
+  that the new node has no
   children of its own. The new node's parent is n, and the new node is
   added as a child of n. The new node should be of type type.
 
@@ -148,18 +361,71 @@ int Node_unlinkChild(Node_T parent, Node_T child);
   changed so that the link is bidirectional.)
 
   Returns SUCCESS upon completion, or:
-  ALREADY_IN_TREE if parent already has a child with that path
+  ALREADY_IN_TREE if parent already has a child with that name
   PARENT_CHILD_ERROR if the new child cannot otherwise be added
 */
 int Node_addChild(Node_T parent, const char* dir, nodeType type);
 
 /*
-  Returns a string representation for n, 
-  or NULL if there is an allocation error.
+  Returns a string representation for n -- its full path, rebuilt
+  from the names of n and its ancestors -- or NULL if there is an
+  allocation error.
 
   Allocates memory for the returned string,
   which is then owned by client!
 */
 char* Node_toString(Node_T n);
 
+/*
+  Stores in *pUsage the memory currently held by all live nodes, by
+  category. The totals are maintained as nodes are created, linked,
+  unlinked, updated and destroyed, so this takes constant time.
+*/
+void Node_getMemoryUsage(struct MemoryUsage *pUsage);
+
+/*
+  Makes the calling thread apply its changes to the memory totals to
+  *pTotals instead of the shared totals, or to the shared totals again
+  if pTotals is NULL. Threads that create or destroy nodes of disjoint
+  subtrees concurrently each keep their own *pTotals, starting from
+  zero, so that they neither race nor contend on the shared totals;
+  once they are done, each *pTotals is added back with
+  Node_mergeAccounting. (Totals are unsigned, so a thread that only
+  destroys nodes accumulates wrapped-around negative deltas, which
+  still merge correctly.)
+*/
+void Node_setAccounting(struct MemoryUsage *pTotals);
+
+/*
+  Adds the changes recorded in *pDelta to the totals the calling
+  thread is applying its changes to: the shared totals, unless
+  Node_setAccounting has redirected them. Merging into the shared
+  totals must not run concurrently with other node operations.
+*/
+void Node_mergeAccounting(const struct MemoryUsage *pDelta);
+
+/*
+  Returns the number of bytes by which the totals reported by
+  Node_getMemoryUsage would grow if the path rest were inserted
+  beneath parent (or as a new root hierarchy, if parent is NULL),
+  creating one node for each component of rest, the last with room
+  bytes of room (see Node_createWithRoom). Nothing is allocated.
+*/
+size_t Node_getInsertCost(Node_T parent, const char* rest,
+                          size_t room);
+
+/*
+  Returns the number of bytes by which the totals reported by
+  Node_getMemoryUsage would grow if a copy of n named name were made
+  by Node_copy and linked beneath parent. Nothing is allocated.
+*/
+size_t Node_getCopyCost(Node_T parent, Node_T n, const char* name);
+
+/*
+  Returns the number of bytes by which the stored bytes reported by
+  Node_getMemoryUsage would grow if Node_storeContents made a new copy
+  of length bytes of contents. Nothing is allocated.
+*/
+size_t Node_getStoreCost(size_t length);
+
 #endif